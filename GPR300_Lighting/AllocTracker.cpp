@@ -0,0 +1,536 @@
+#include "AllocTracker.h"
+
+#include <atomic>
+#include <cassert>
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+#include "imgui/imgui.h"
+
+// Every block carries a header in front of it holding the requested size
+const size_t HEADER_SIZE = 16;
+
+struct TagSlot
+{
+	std::atomic<const char*> tag;
+	std::atomic<size_t> count;
+	std::atomic<size_t> bytes;
+	std::atomic<size_t> frameCount;
+	size_t lastFrameCount;
+};
+
+// Zero initialised before any constructor runs, so allocations during static init are safe
+static TagSlot tagSlots[ALLOC_TRACKER_MAX_TAGS];
+static std::atomic<size_t> sizeBuckets[ALLOC_TRACKER_SIZE_BUCKETS];
+
+static std::atomic<size_t> liveBytes;
+static std::atomic<size_t> liveCount;
+static std::atomic<size_t> totalCount;
+static std::atomic<size_t> totalBytes;
+
+static std::atomic<size_t> frameCount;
+static std::atomic<size_t> frameBytes;
+static std::atomic<size_t> frameFrees;
+
+static std::atomic<bool> inFrame;
+static std::atomic<bool> assertMode;
+static std::atomic<size_t> violationCount;
+static int warmupFrames = 60;
+static size_t frameIndex = 0;
+
+static AllocFrameStats lastFrame;
+static float history[ALLOC_TRACKER_HISTORY];
+static int historyHead = 0;
+static int historySize = 0;
+
+// Worst frames seen this run, sorted by allocation count
+const int WORST_FRAME_COUNT = 8;
+struct WorstFrame
+{
+	size_t frame;
+	size_t count;
+	size_t bytes;
+};
+static WorstFrame worstFrames[WORST_FRAME_COUNT];
+
+static thread_local const char* currentTag = nullptr;
+static thread_local bool insideTracker = false;
+static thread_local bool workerThread = false;
+
+static const char* UNTAGGED = "Untagged";
+static const char* OTHER = "Other";
+
+static TagSlot& findTagSlot(const char* tag)
+{
+	if (tag == nullptr)
+		tag = UNTAGGED;
+
+	for (int i = 0; i < ALLOC_TRACKER_MAX_TAGS - 1; i++)
+	{
+		const char* slotTag = tagSlots[i].tag.load(std::memory_order_acquire);
+		if (slotTag == nullptr)
+		{
+			// Claim the empty slot, another thread may race us for it
+			if (tagSlots[i].tag.compare_exchange_strong(slotTag, tag))
+				return tagSlots[i];
+		}
+
+		// Identical literals from different translation units can have different addresses
+		if (slotTag == tag || strcmp(slotTag, tag) == 0)
+			return tagSlots[i];
+	}
+
+	TagSlot& overflow = tagSlots[ALLOC_TRACKER_MAX_TAGS - 1];
+	const char* expected = nullptr;
+	overflow.tag.compare_exchange_strong(expected, OTHER);
+	return overflow;
+}
+
+static int sizeBucket(size_t size)
+{
+	int bucket = 0;
+	while (size > 1 && bucket < ALLOC_TRACKER_SIZE_BUCKETS - 1)
+	{
+		size >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static void recordAlloc(size_t size)
+{
+	liveBytes.fetch_add(size, std::memory_order_relaxed);
+	liveCount.fetch_add(1, std::memory_order_relaxed);
+	totalBytes.fetch_add(size, std::memory_order_relaxed);
+	totalCount.fetch_add(1, std::memory_order_relaxed);
+	frameCount.fetch_add(1, std::memory_order_relaxed);
+	frameBytes.fetch_add(size, std::memory_order_relaxed);
+	sizeBuckets[sizeBucket(size)].fetch_add(1, std::memory_order_relaxed);
+
+	// Guard against the tracker's own output allocating and recursing
+	if (insideTracker)
+		return;
+	insideTracker = true;
+
+	TagSlot& slot = findTagSlot(currentTag);
+	slot.count.fetch_add(1, std::memory_order_relaxed);
+	slot.bytes.fetch_add(size, std::memory_order_relaxed);
+	slot.frameCount.fetch_add(1, std::memory_order_relaxed);
+
+	if (assertMode.load(std::memory_order_relaxed) && inFrame.load(std::memory_order_relaxed) && !workerThread && frameIndex >= (size_t)warmupFrames)
+	{
+		violationCount.fetch_add(1, std::memory_order_relaxed);
+		printf("Allocation of %zu bytes during frame %zu (tag: %s)\n", size, frameIndex, currentTag != nullptr ? currentTag : UNTAGGED);
+		assert(!"Heap allocation inside the frame loop");
+	}
+
+	insideTracker = false;
+}
+
+static void recordFree(size_t size)
+{
+	liveBytes.fetch_sub(size, std::memory_order_relaxed);
+	liveCount.fetch_sub(1, std::memory_order_relaxed);
+	frameFrees.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void* allocBlock(size_t size, size_t alignment)
+{
+	// The header needs to keep the user pointer aligned
+	size_t header = alignment > HEADER_SIZE ? alignment : HEADER_SIZE;
+
+	unsigned char* raw;
+	if (alignment > HEADER_SIZE)
+	{
+#ifdef _WIN32
+		raw = static_cast<unsigned char*>(_aligned_malloc(size + header, alignment));
+#else
+		raw = static_cast<unsigned char*>(aligned_alloc(alignment, (size + header + alignment - 1) / alignment * alignment));
+#endif
+	}
+	else
+	{
+		raw = static_cast<unsigned char*>(malloc(size + header));
+	}
+
+	if (raw == nullptr)
+		return nullptr;
+
+	unsigned char* user = raw + header;
+	reinterpret_cast<size_t*>(user)[-1] = size;
+	recordAlloc(size);
+	return user;
+}
+
+static void freeBlock(void* ptr, size_t alignment)
+{
+	if (ptr == nullptr)
+		return;
+
+	size_t header = alignment > HEADER_SIZE ? alignment : HEADER_SIZE;
+	unsigned char* user = static_cast<unsigned char*>(ptr);
+	recordFree(reinterpret_cast<size_t*>(user)[-1]);
+
+	if (alignment > HEADER_SIZE)
+	{
+#ifdef _WIN32
+		_aligned_free(user - header);
+#else
+		free(user - header);
+#endif
+	}
+	else
+	{
+		free(user - header);
+	}
+}
+
+void* trackedMalloc(size_t size)
+{
+	return allocBlock(size, HEADER_SIZE);
+}
+
+void* trackedRealloc(void* ptr, size_t size)
+{
+	if (ptr == nullptr)
+		return trackedMalloc(size);
+
+	size_t oldSize = reinterpret_cast<size_t*>(ptr)[-1];
+	void* newPtr = trackedMalloc(size);
+	if (newPtr != nullptr)
+	{
+		memcpy(newPtr, ptr, oldSize < size ? oldSize : size);
+		trackedFree(ptr);
+	}
+	return newPtr;
+}
+
+void trackedFree(void* ptr)
+{
+	freeBlock(ptr, HEADER_SIZE);
+}
+
+// Global replacements, only one translation unit may define these
+void* operator new(size_t size)
+{
+	void* ptr = allocBlock(size, HEADER_SIZE);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return allocBlock(size, HEADER_SIZE);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return allocBlock(size, HEADER_SIZE);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	void* ptr = allocBlock(size, (size_t)alignment);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept { freeBlock(ptr, HEADER_SIZE); }
+void operator delete[](void* ptr) noexcept { freeBlock(ptr, HEADER_SIZE); }
+void operator delete(void* ptr, size_t) noexcept { freeBlock(ptr, HEADER_SIZE); }
+void operator delete[](void* ptr, size_t) noexcept { freeBlock(ptr, HEADER_SIZE); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { freeBlock(ptr, HEADER_SIZE); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { freeBlock(ptr, HEADER_SIZE); }
+void operator delete(void* ptr, std::align_val_t alignment) noexcept { freeBlock(ptr, (size_t)alignment); }
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept { freeBlock(ptr, (size_t)alignment); }
+void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept { freeBlock(ptr, (size_t)alignment); }
+void operator delete[](void* ptr, size_t, std::align_val_t alignment) noexcept { freeBlock(ptr, (size_t)alignment); }
+
+AllocScope::AllocScope(const char* tag)
+{
+	mPreviousTag = currentTag;
+	currentTag = tag;
+}
+
+AllocScope::~AllocScope()
+{
+	currentTag = mPreviousTag;
+}
+
+static void* imguiAlloc(size_t size, void*)
+{
+	ALLOC_SCOPE("ImGui");
+	return trackedMalloc(size);
+}
+
+static void imguiFree(void* ptr, void*)
+{
+	trackedFree(ptr);
+}
+
+void allocTrackerHookImGui()
+{
+	ImGui::SetAllocatorFunctions(imguiAlloc, imguiFree);
+}
+
+void allocTrackerBeginFrame()
+{
+	inFrame.store(true);
+}
+
+void allocTrackerEndFrame()
+{
+	inFrame.store(false);
+
+	lastFrame.count = frameCount.exchange(0);
+	lastFrame.bytes = frameBytes.exchange(0);
+	lastFrame.frees = frameFrees.exchange(0);
+
+	for (int i = 0; i < ALLOC_TRACKER_MAX_TAGS; i++)
+	{
+		tagSlots[i].lastFrameCount = tagSlots[i].frameCount.exchange(0);
+	}
+
+	history[historyHead] = (float)lastFrame.count;
+	historyHead = (historyHead + 1) % ALLOC_TRACKER_HISTORY;
+	if (historySize < ALLOC_TRACKER_HISTORY)
+		historySize++;
+
+	// Keep the worst frames after warm-up, startup allocations are expected
+	if (frameIndex >= (size_t)warmupFrames)
+	{
+		for (int i = 0; i < WORST_FRAME_COUNT; i++)
+		{
+			if (lastFrame.count > worstFrames[i].count)
+			{
+				for (int j = WORST_FRAME_COUNT - 1; j > i; j--)
+				{
+					worstFrames[j] = worstFrames[j - 1];
+				}
+				worstFrames[i] = { frameIndex, lastFrame.count, lastFrame.bytes };
+				break;
+			}
+		}
+	}
+
+	frameIndex++;
+}
+
+void allocTrackerSetAssertMode(bool enabled, int warmup)
+{
+	warmupFrames = warmup;
+	assertMode.store(enabled);
+}
+
+void allocTrackerMarkWorkerThread()
+{
+	workerThread = true;
+}
+
+bool allocTrackerGetAssertMode()
+{
+	return assertMode.load();
+}
+
+size_t allocTrackerGetViolationCount()
+{
+	return violationCount.load();
+}
+
+AllocFrameStats allocTrackerGetLastFrame()
+{
+	return lastFrame;
+}
+
+size_t allocTrackerGetLiveBytes()
+{
+	return liveBytes.load();
+}
+
+size_t allocTrackerGetLiveCount()
+{
+	return liveCount.load();
+}
+
+size_t allocTrackerGetFrameIndex()
+{
+	return frameIndex;
+}
+
+int allocTrackerGetHistory(float* counts, int maxCount)
+{
+	int count = historySize < maxCount ? historySize : maxCount;
+	int start = (historyHead - count + ALLOC_TRACKER_HISTORY) % ALLOC_TRACKER_HISTORY;
+	for (int i = 0; i < count; i++)
+	{
+		counts[i] = history[(start + i) % ALLOC_TRACKER_HISTORY];
+	}
+	return count;
+}
+
+int allocTrackerGetTagStats(AllocTagStats* stats, int maxCount)
+{
+	int count = 0;
+	for (int i = 0; i < ALLOC_TRACKER_MAX_TAGS && count < maxCount; i++)
+	{
+		const char* tag = tagSlots[i].tag.load();
+		if (tag == nullptr)
+			continue;
+
+		stats[count].tag = tag;
+		stats[count].count = tagSlots[i].count.load();
+		stats[count].bytes = tagSlots[i].bytes.load();
+		stats[count].frameCount = tagSlots[i].lastFrameCount;
+		count++;
+	}
+	return count;
+}
+
+void allocTrackerGetSizeHistogram(size_t* buckets)
+{
+	for (int i = 0; i < ALLOC_TRACKER_SIZE_BUCKETS; i++)
+	{
+		buckets[i] = sizeBuckets[i].load();
+	}
+}
+
+bool allocTrackerWriteReport(const char* path)
+{
+	// One report per run, named after the time the first report was written
+	static char runPath[64] = {};
+	if (path == nullptr)
+	{
+		if (runPath[0] == '\0')
+		{
+			time_t start = time(nullptr);
+			strftime(runPath, sizeof(runPath), "alloc_report_%Y%m%d_%H%M%S.txt", localtime(&start));
+		}
+		path = runPath;
+	}
+
+	FILE* file = fopen(path, "w");
+	if (file == nullptr)
+	{
+		printf("Failed to write allocation report %s\n", path);
+		return false;
+	}
+
+	time_t now = time(nullptr);
+	fprintf(file, "Allocation report - %s\n", ctime(&now));
+	fprintf(file, "Frames:          %zu\n", frameIndex);
+	fprintf(file, "Total allocs:    %zu (%zu bytes)\n", totalCount.load(), totalBytes.load());
+	fprintf(file, "Live at report:  %zu (%zu bytes)\n", liveCount.load(), liveBytes.load());
+	fprintf(file, "Frame violations: %zu\n\n", violationCount.load());
+
+	fprintf(file, "%-32s %12s %16s\n", "Tag", "Count", "Bytes");
+	AllocTagStats tags[ALLOC_TRACKER_MAX_TAGS];
+	int tagCount = allocTrackerGetTagStats(tags, ALLOC_TRACKER_MAX_TAGS);
+	for (int i = 0; i < tagCount; i++)
+	{
+		fprintf(file, "%-32s %12zu %16zu\n", tags[i].tag, tags[i].count, tags[i].bytes);
+	}
+
+	fprintf(file, "\nSize histogram\n");
+	size_t buckets[ALLOC_TRACKER_SIZE_BUCKETS];
+	allocTrackerGetSizeHistogram(buckets);
+	for (int i = 0; i < ALLOC_TRACKER_SIZE_BUCKETS; i++)
+	{
+		if (buckets[i] > 0)
+			fprintf(file, "  < %12zu bytes: %zu\n", (size_t)2 << i, buckets[i]);
+	}
+
+	fprintf(file, "\nWorst frames after warm-up (%d frames)\n", warmupFrames);
+	for (int i = 0; i < WORST_FRAME_COUNT; i++)
+	{
+		if (worstFrames[i].count > 0)
+			fprintf(file, "  frame %zu: %zu allocs, %zu bytes\n", worstFrames[i].frame, worstFrames[i].count, worstFrames[i].bytes);
+	}
+
+	fclose(file);
+	printf("Wrote allocation report %s\n", path);
+	return true;
+}
+
+void allocTrackerDrawUI()
+{
+	ImGui::Begin("Allocations");
+
+	ImGui::Text("Last frame: %zu allocs, %zu bytes, %zu frees", lastFrame.count, lastFrame.bytes, lastFrame.frees);
+	ImGui::Text("Live: %zu allocs, %.2f MB", liveCount.load(), liveBytes.load() / (1024.0 * 1024.0));
+
+	float counts[ALLOC_TRACKER_HISTORY];
+	int historyCount = allocTrackerGetHistory(counts, ALLOC_TRACKER_HISTORY);
+	ImGui::PlotLines("Allocs/frame", counts, historyCount, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+
+	bool assertEnabled = assertMode.load();
+	if (ImGui::Checkbox("Assert on frame allocations", &assertEnabled))
+		assertMode.store(assertEnabled);
+	ImGui::DragInt("Warm-up frames", &warmupFrames, 1, 0, 10000);
+	ImGui::Text("Violations: %zu", violationCount.load());
+
+	if (ImGui::CollapsingHeader("Tags"))
+	{
+		AllocTagStats tags[ALLOC_TRACKER_MAX_TAGS];
+		int tagCount = allocTrackerGetTagStats(tags, ALLOC_TRACKER_MAX_TAGS);
+		if (ImGui::BeginTable("AllocTags", 4))
+		{
+			ImGui::TableSetupColumn("Tag");
+			ImGui::TableSetupColumn("Frame");
+			ImGui::TableSetupColumn("Total");
+			ImGui::TableSetupColumn("Bytes");
+			ImGui::TableHeadersRow();
+			for (int i = 0; i < tagCount; i++)
+			{
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(tags[i].tag);
+				ImGui::TableNextColumn();
+				ImGui::Text("%zu", tags[i].frameCount);
+				ImGui::TableNextColumn();
+				ImGui::Text("%zu", tags[i].count);
+				ImGui::TableNextColumn();
+				ImGui::Text("%zu", tags[i].bytes);
+			}
+			ImGui::EndTable();
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Size Histogram"))
+	{
+		size_t buckets[ALLOC_TRACKER_SIZE_BUCKETS];
+		allocTrackerGetSizeHistogram(buckets);
+		float values[ALLOC_TRACKER_SIZE_BUCKETS];
+		for (int i = 0; i < ALLOC_TRACKER_SIZE_BUCKETS; i++)
+		{
+			values[i] = (float)buckets[i];
+		}
+		ImGui::PlotHistogram("log2(size)", values, ALLOC_TRACKER_SIZE_BUCKETS, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 80));
+	}
+
+	bool writeReport = ImGui::Button("Write Report");
+	ImGui::End();
+
+	if (writeReport)
+	{
+		// Written outside the frame window so the report's own allocations aren't violations
+		bool wasInFrame = inFrame.exchange(false);
+		allocTrackerWriteReport();
+		inFrame.store(wasInFrame);
+	}
+}
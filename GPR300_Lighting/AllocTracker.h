@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+
+/*
+* Global allocation tracker.
+* AllocTracker.cpp replaces the global operator new/delete so every C++ heap allocation
+* in the program is counted. C libraries are routed through trackedMalloc/trackedFree
+* (stb_image via STBI_MALLOC, ImGui via SetAllocatorFunctions).
+*
+* Allocations are attributed to the innermost ALLOC_SCOPE on the calling thread,
+* counted per frame, and bucketed by power-of-two size.
+*/
+
+// Number of distinct call-site tags that can be tracked, extra tags fold into "Other"
+const int ALLOC_TRACKER_MAX_TAGS = 64;
+// Power of two size buckets, the last one collects everything larger
+const int ALLOC_TRACKER_SIZE_BUCKETS = 32;
+// Frames kept for the per-frame graph
+const int ALLOC_TRACKER_HISTORY = 240;
+
+void* trackedMalloc(size_t size);
+void* trackedRealloc(void* ptr, size_t size);
+void trackedFree(void* ptr);
+
+// Tags allocations made on this thread until the scope ends
+class AllocScope
+{
+public:
+	AllocScope(const char* tag);
+	~AllocScope();
+
+	AllocScope(const AllocScope&) = delete;
+	AllocScope& operator=(const AllocScope&) = delete;
+
+private:
+	const char* mPreviousTag;
+};
+
+#define ALLOC_SCOPE_CONCAT_INNER(a, b) a##b
+#define ALLOC_SCOPE_CONCAT(a, b) ALLOC_SCOPE_CONCAT_INNER(a, b)
+#define ALLOC_SCOPE(tag) AllocScope ALLOC_SCOPE_CONCAT(allocScope, __LINE__)(tag)
+
+struct AllocTagStats
+{
+	const char* tag;
+	size_t count;
+	size_t bytes;
+	size_t frameCount;
+};
+
+struct AllocFrameStats
+{
+	size_t count;
+	size_t bytes;
+	size_t frees;
+};
+
+/*
+* Marks the hot part of the frame (ImGui::NewFrame to glfwSwapBuffers).
+* With assert mode on, any allocation inside that window after the warm-up frames
+* is reported with its tag and size and trips an assert in debug builds.
+*/
+void allocTrackerBeginFrame();
+void allocTrackerEndFrame();
+
+void allocTrackerSetAssertMode(bool enabled, int warmupFrames);
+// Loader and worker threads run next to the frame, their allocations are still counted but never asserted on.
+// Call first thing on the thread.
+void allocTrackerMarkWorkerThread();
+bool allocTrackerGetAssertMode();
+size_t allocTrackerGetViolationCount();
+
+// Stats for the frame that just ended
+AllocFrameStats allocTrackerGetLastFrame();
+size_t allocTrackerGetLiveBytes();
+size_t allocTrackerGetLiveCount();
+size_t allocTrackerGetFrameIndex();
+
+// Allocation counts of recent frames, oldest first. Returns the number written.
+int allocTrackerGetHistory(float* counts, int maxCount);
+int allocTrackerGetTagStats(AllocTagStats* stats, int maxCount);
+void allocTrackerGetSizeHistogram(size_t* buckets);
+
+// Writes totals, per-tag counts, the size histogram and the worst frames to a text file.
+// Without a path the report goes to alloc_report_<date>_<time>.txt for this run.
+bool allocTrackerWriteReport(const char* path = nullptr);
+
+// Routes ImGui's allocations through the tracker, call before ImGui::CreateContext
+void allocTrackerHookImGui();
+
+// ImGui window showing the counters, graph, tags and histogram
+void allocTrackerDrawUI();
@@ -0,0 +1,90 @@
+#include "Bounds.h"
+
+void AABB::expand(const glm::vec3& point)
+{
+	min = glm::min(min, point);
+	max = glm::max(max, point);
+}
+
+void AABB::expand(const AABB& box)
+{
+	if (box.isEmpty())
+		return;
+
+	min = glm::min(min, box.min);
+	max = glm::max(max, box.max);
+}
+
+AABB computeMeshBounds(const ew::MeshData& meshData)
+{
+	AABB bounds;
+	for (const ew::Vertex& vertex : meshData.vertices)
+	{
+		bounds.expand(vertex.position);
+	}
+	return bounds;
+}
+
+AABB transformAABB(const AABB& box, const glm::mat4& matrix)
+{
+	if (box.isEmpty())
+		return box;
+
+	// Transform the center and project the extents onto each axis (Arvo's method)
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extents = (box.max - box.min) * 0.5f;
+
+	glm::vec3 newCenter = glm::vec3(matrix * glm::vec4(center, 1.0f));
+	glm::vec3 newExtents(0.0f);
+	for (int i = 0; i < 3; i++)
+	{
+		newExtents += glm::abs(glm::vec3(matrix[i])) * extents[i];
+	}
+
+	AABB result;
+	result.min = newCenter - newExtents;
+	result.max = newCenter + newExtents;
+	return result;
+}
+
+AABB intersectAABB(const AABB& a, const AABB& b)
+{
+	AABB result;
+	result.min = glm::max(a.min, b.min);
+	result.max = glm::min(a.max, b.max);
+	return result;
+}
+
+Frustum extractFrustum(const glm::mat4& viewProjection)
+{
+	// Gribb/Hartmann, rows of the matrix combined per clip plane
+	glm::mat4 m = glm::transpose(viewProjection);
+
+	Frustum frustum;
+	frustum.planes[0] = m[3] + m[0];
+	frustum.planes[1] = m[3] - m[0];
+	frustum.planes[2] = m[3] + m[1];
+	frustum.planes[3] = m[3] - m[1];
+	frustum.planes[4] = m[3] + m[2];
+	frustum.planes[5] = m[3] - m[2];
+	return frustum;
+}
+
+bool frustumIntersectsAABB(const Frustum& frustum, const AABB& box)
+{
+	if (box.isEmpty())
+		return false;
+
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		// Corner furthest along the plane normal
+		glm::vec3 corner(
+			plane.x >= 0.0f ? box.max.x : box.min.x,
+			plane.y >= 0.0f ? box.max.y : box.min.y,
+			plane.z >= 0.0f ? box.max.z : box.min.z);
+
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cfloat>
+
+#include "EW/Mesh.h"
+
+// Axis aligned bounding box, empty while min > max
+struct AABB
+{
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	bool isEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+	void expand(const glm::vec3& point);
+	void expand(const AABB& box);
+};
+
+// Bounds of the vertex positions in the mesh's local space
+AABB computeMeshBounds(const ew::MeshData& meshData);
+
+// Bounds of the box's eight corners after transforming them by the matrix
+AABB transformAABB(const AABB& box, const glm::mat4& matrix);
+
+AABB intersectAABB(const AABB& a, const AABB& b);
+
+// Six planes of a view projection, normals point inwards
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+Frustum extractFrustum(const glm::mat4& viewProjection);
+
+// Conservative, boxes near a frustum corner can be accepted without intersecting it
+bool frustumIntersectsAABB(const Frustum& frustum, const AABB& box);
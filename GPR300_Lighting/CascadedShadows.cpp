@@ -0,0 +1,235 @@
+#include "CascadedShadows.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+#include "Memory.h"
+
+// A log split starting at a 0.001 near plane would put the first cascade at the lens
+const float MIN_SPLIT_NEAR = 0.1f;
+
+CascadedShadowMap::CascadedShadowMap(int resolution, int cascadeCount)
+	: mBuffer(resolution, resolution, cascadeCount),
+	mStaticBuffer(resolution, resolution, cascadeCount)
+{
+	mResolution = resolution;
+	mCascadeCount = std::min(cascadeCount, MAX_SHADOW_CASCADES);
+}
+
+void CascadedShadowMap::update(Camera& camera, glm::vec3 lightDirection, const AABB* objectBounds, int objectCount)
+{
+	float nearPlane = camera.getNearPlane();
+	float farPlane = camera.getFarPlane();
+	float shadowFar = std::min(farPlane, shadowDistance);
+	float splitNear = std::max(nearPlane, MIN_SPLIT_NEAR);
+
+	// Corners of the full view frustum, near plane first
+	glm::mat4 viewProjection = camera.getProjectionMatrix() * camera.getViewMatrix();
+	glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+	glm::vec3 nearCorners[4];
+	glm::vec3 farCorners[4];
+	for (int i = 0; i < 4; i++)
+	{
+		glm::vec2 ndc((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f);
+		glm::vec4 nearCorner = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+		glm::vec4 farCorner = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+		nearCorners[i] = glm::vec3(nearCorner) / nearCorner.w;
+		farCorners[i] = glm::vec3(farCorner) / farCorner.w;
+	}
+
+	// Rotation into light space, the cascades only differ by their translation
+	glm::vec3 towardLight = glm::normalize(lightDirection);
+	glm::vec3 up = std::abs(towardLight.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), -towardLight, up);
+
+	// Light space bounds of every object, and whether the camera can see it as a receiver
+	Frustum cameraFrustum = extractFrustum(viewProjection);
+	glm::mat4 cameraView = camera.getViewMatrix();
+	FrameVector<AABB> lightBounds(objectCount);
+	FrameVector<glm::vec2> receiverDepths(objectCount);
+	mSceneBounds = AABB();
+	AABB lightSceneBounds;
+	for (int i = 0; i < objectCount; i++)
+	{
+		mSceneBounds.expand(objectBounds[i]);
+		lightBounds[i] = transformAABB(objectBounds[i], lightRotation);
+		lightSceneBounds.expand(lightBounds[i]);
+
+		// View depth range of visible objects, empty range for the rest
+		receiverDepths[i] = glm::vec2(FLT_MAX, -FLT_MAX);
+		if (frustumIntersectsAABB(cameraFrustum, objectBounds[i]))
+		{
+			AABB viewBounds = transformAABB(objectBounds[i], cameraView);
+			receiverDepths[i] = glm::vec2(-viewBounds.max.z, -viewBounds.min.z);
+		}
+	}
+
+	mObjectCount = objectCount;
+	mCasterVisible.resize(MAX_SHADOW_CASCADES * objectCount);
+
+	float sliceNear = nearPlane;
+	for (int i = 0; i < mCascadeCount; i++)
+	{
+		float fraction = (float)(i + 1) / mCascadeCount;
+		float logSplit = splitNear * std::pow(shadowFar / splitNear, fraction);
+		float uniformSplit = splitNear + (shadowFar - splitNear) * fraction;
+		float sliceFar = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+
+		// Edges of the frustum are straight lines, view depth is linear along them
+		float nearT = (sliceNear - nearPlane) / (farPlane - nearPlane);
+		float farT = (sliceFar - nearPlane) / (farPlane - nearPlane);
+		glm::vec3 corners[8];
+		glm::vec3 center(0.0f);
+		AABB lightSliceBounds;
+		for (int c = 0; c < 4; c++)
+		{
+			corners[c] = glm::mix(nearCorners[c], farCorners[c], nearT);
+			corners[c + 4] = glm::mix(nearCorners[c], farCorners[c], farT);
+			center += corners[c] + corners[c + 4];
+			lightSliceBounds.expand(glm::vec3(lightRotation * glm::vec4(corners[c], 1.0f)));
+			lightSliceBounds.expand(glm::vec3(lightRotation * glm::vec4(corners[c + 4], 1.0f)));
+		}
+		center /= 8.0f;
+
+		// Receivers the camera sees inside this slice
+		AABB receiverBounds;
+		for (int o = 0; o < objectCount; o++)
+		{
+			if (receiverDepths[o].x <= sliceFar && receiverDepths[o].y >= sliceNear)
+			{
+				receiverBounds.expand(lightBounds[o]);
+			}
+		}
+		AABB fitBounds = intersectAABB(receiverBounds, lightSliceBounds);
+
+		// Light space box covered by the cascade, z grows toward the light
+		glm::vec3 boxMin;
+		glm::vec3 boxMax;
+		float texelSize;
+		if (fitToScene && !fitBounds.isEmpty())
+		{
+			// Square texels, quantised so small changes in the receivers don't move the cascade
+			float size = std::max(fitBounds.max.x - fitBounds.min.x, fitBounds.max.y - fitBounds.min.y);
+			size = std::ceil(std::max(size, 1.0f / 16.0f) * 16.0f) / 16.0f;
+			texelSize = size / mResolution;
+
+			boxMin.x = std::floor(fitBounds.min.x / texelSize) * texelSize;
+			boxMin.y = std::floor(fitBounds.min.y / texelSize) * texelSize;
+			boxMax.x = boxMin.x + size;
+			boxMax.y = boxMin.y + size;
+
+			// Depth clamp flattens casters in front of the near plane, only the receivers need the range
+			boxMin.z = std::floor(fitBounds.min.z);
+			boxMax.z = std::ceil(fitBounds.max.z);
+		}
+		else
+		{
+			float radius = 0.0f;
+			for (int c = 0; c < 8; c++)
+			{
+				radius = std::max(radius, glm::length(corners[c] - center));
+			}
+			// Quantise so floating point noise doesn't change the projection every frame
+			radius = std::ceil(radius * 16.0f) / 16.0f;
+
+			// Snap the cascade origin to whole texels in light space
+			texelSize = 2.0f * radius / mResolution;
+			glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+			lightCenter = glm::floor(lightCenter / texelSize) * texelSize;
+
+			boxMin = lightCenter - glm::vec3(radius);
+			boxMax = lightCenter + glm::vec3(radius);
+
+			// Reach back to the scene bounds so every caster has a valid depth
+			if (!lightSceneBounds.isEmpty())
+			{
+				boxMax.z = std::max(boxMax.z, std::ceil(lightSceneBounds.max.z));
+			}
+		}
+
+		ShadowCascade& cascade = mCascades[i];
+		cascade.view = lightRotation;
+		cascade.projection = glm::ortho(boxMin.x, boxMax.x, boxMin.y, boxMax.y, -boxMax.z, -boxMin.z);
+		cascade.viewProjection = cascade.projection * cascade.view;
+		cascade.splitFar = sliceFar;
+		cascade.texelSize = texelSize;
+
+		// A caster matters if it overlaps the box sideways and isn't entirely behind it
+		unsigned char* visible = &mCasterVisible[i * objectCount];
+		cascade.casterCount = 0;
+		for (int o = 0; o < objectCount; o++)
+		{
+			const AABB& bounds = lightBounds[o];
+			visible[o] = !bounds.isEmpty()
+				&& bounds.min.x <= boxMax.x && bounds.max.x >= boxMin.x
+				&& bounds.min.y <= boxMax.y && bounds.max.y >= boxMin.y
+				&& bounds.max.z >= boxMin.z;
+			cascade.casterCount += visible[o];
+		}
+
+		if (!caching || cascade.viewProjection != mStaticViewProj[i])
+		{
+			mStaticValid[i] = false;
+		}
+
+		sliceNear = sliceFar;
+	}
+
+	mDrewThisFrame = false;
+}
+
+void CascadedShadowMap::invalidateStaticCasters()
+{
+	for (int i = 0; i < mCascadeCount; i++)
+	{
+		mStaticValid[i] = false;
+	}
+}
+
+void CascadedShadowMap::invalidateDynamicCasters()
+{
+	for (int i = 0; i < mCascadeCount; i++)
+	{
+		mCompositeValid[i] = false;
+	}
+}
+
+void CascadedShadowMap::beginStaticLayer(int cascade)
+{
+	mStaticBuffer.bindLayer(cascade);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	mDrewThisFrame = true;
+}
+
+void CascadedShadowMap::endStaticLayer(int cascade)
+{
+	mStaticViewProj[cascade] = mCascades[cascade].viewProjection;
+	mStaticValid[cascade] = true;
+	mCompositeValid[cascade] = false;
+	mCacheStats.staticRedraws++;
+}
+
+void CascadedShadowMap::beginComposite(int cascade)
+{
+	glCopyImageSubData(mStaticBuffer.getTexture(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade,
+		mBuffer.getTexture(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade,
+		mResolution, mResolution, 1);
+	mBuffer.bindLayer(cascade);
+	mDrewThisFrame = true;
+}
+
+void CascadedShadowMap::endComposite(int cascade)
+{
+	mCompositeValid[cascade] = true;
+	mCacheStats.composites++;
+}
+
+void CascadedShadowMap::endFrame()
+{
+	mCacheStats.frames++;
+	if (!mDrewThisFrame)
+	{
+		mCacheStats.skippedFrames++;
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "RenderTargets.h"
+#include "Bounds.h"
+#include "EW/Camera.h"
+
+const int MAX_SHADOW_CASCADES = 4;
+
+struct ShadowCascade
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 viewProjection;
+
+	// View space distance where this cascade ends
+	float splitFar;
+	// World space size of one shadow map texel, used to scale the depth bias
+	float texelSize;
+	// Objects that can cast into this cascade
+	int casterCount;
+};
+
+struct ShadowCacheStats
+{
+	int frames;
+	// Frames where no cascade had to be drawn at all
+	int skippedFrames;
+	// Cascades whose static layer was re-rendered
+	int staticRedraws;
+	// Cascades where the dynamic casters were drawn over a copy of the static layer
+	int composites;
+};
+
+/*
+* Cascaded shadow map for the directional light.
+* The camera range [near, min(far, shadowDistance)] is split with a blend of logarithmic and
+* uniform distribution, every slice of the view frustum gets its own layer of one depth array.
+* Each cascade is fitted to the bounding sphere of its slice so its size doesn't change as the
+* camera rotates, and its origin is snapped to whole texels so shadow edges don't shimmer as it moves.
+* With fitToScene the cascade is instead shrunk to the receivers the camera can see in that slice,
+* which spends the texels on visible geometry at the cost of some stability.
+*
+* Casters that can't throw a shadow onto the cascade's receivers are culled per cascade.
+*
+* Static casters are rendered into a second array that persists across frames. A cascade's static
+* layer is only redrawn when its light matrix changes or the static casters are invalidated, the
+* sampled layer is then a copy of it with the dynamic casters drawn on top.
+*/
+class CascadedShadowMap
+{
+public:
+	CascadedShadowMap(int resolution, int cascadeCount);
+
+	// Recomputes the split distances, light matrices and caster visibility for this frame
+	// objectBounds holds the world space bounds of every object in the scene
+	void update(Camera& camera, glm::vec3 lightDirection, const AABB* objectBounds, int objectCount);
+
+	// Force every cascade to redraw its static or dynamic casters
+	void invalidateStaticCasters();
+	void invalidateDynamicCasters();
+
+	bool needsStaticRedraw(int cascade) const { return !mStaticValid[cascade]; }
+	bool needsComposite(int cascade) const { return !mStaticValid[cascade] || !mCompositeValid[cascade]; }
+
+	// Binds and clears the cached layer for the static casters
+	void beginStaticLayer(int cascade);
+	void endStaticLayer(int cascade);
+
+	// Copies the cached layer into the sampled one and binds it for the dynamic casters
+	void beginComposite(int cascade);
+	void endComposite(int cascade);
+
+	// Call once the shadow pass is done to update the cache counters
+	void endFrame();
+	const ShadowCacheStats& getCacheStats() const { return mCacheStats; }
+
+	ShadowBuffer& getBuffer() { return mBuffer; }
+	const ShadowCascade& getCascade(int index) const { return mCascades[index]; }
+	int getCascadeCount() const { return mCascadeCount; }
+	int getResolution() const { return mResolution; }
+	const AABB& getSceneBounds() const { return mSceneBounds; }
+
+	// One flag per object, nonzero if it may cast into the cascade
+	const unsigned char* getCasterVisibility(int cascade) const { return &mCasterVisible[cascade * mObjectCount]; }
+
+	// 0 = uniform splits, 1 = logarithmic splits
+	float splitLambda = 0.75f;
+	// Shadows stop at this distance even if the camera sees further
+	float shadowDistance = 60.0f;
+	// Fit each cascade to its visible receivers instead of the bounding sphere of its slice
+	bool fitToScene = true;
+	// Keep the static layers between frames, disable to redraw everything every frame
+	bool caching = true;
+
+private:
+	ShadowBuffer mBuffer;
+	ShadowBuffer mStaticBuffer;
+	ShadowCascade mCascades[MAX_SHADOW_CASCADES];
+
+	// Light matrix each static layer was rendered with
+	glm::mat4 mStaticViewProj[MAX_SHADOW_CASCADES];
+	bool mStaticValid[MAX_SHADOW_CASCADES] = {};
+	bool mCompositeValid[MAX_SHADOW_CASCADES] = {};
+
+	AABB mSceneBounds;
+	std::vector<unsigned char> mCasterVisible;
+	int mObjectCount = 0;
+
+	ShadowCacheStats mCacheStats = {};
+	bool mDrewThisFrame = false;
+	int mCascadeCount;
+	int mResolution;
+};
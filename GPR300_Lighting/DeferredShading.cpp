@@ -0,0 +1,284 @@
+#include "DeferredShading.h"
+
+#include <algorithm>
+
+#include "Bounds.h"
+#include "GpuMemory.h"
+
+// Albedo, mapped and geometric normals, ambient/diffuse/specular/shininess
+static const std::vector<GLenum> GBUFFER_FORMATS = { GL_RGBA8, GL_RGBA16_SNORM, GL_RGBA8 };
+
+DeferredRenderer::DeferredRenderer(int width, int height, unsigned int outputTexture)
+	: mGBuffer(GBUFFER_FORMATS, width, height)
+{
+	// Lighting writes the output while depth testing volumes against the G-buffer depth
+	mLightingFBO = genFramebuffer("DeferredRenderer lighting");
+	glBindFramebuffer(GL_FRAMEBUFFER, mLightingFBO.get());
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outputTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, mGBuffer.getDepthTexture(), 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Deferred lighting frame buffer is incomplete.\n");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// The fullscreen triangle comes from gl_VertexID
+	mEmptyVAO = genVertexArray("DeferredRenderer fullscreen");
+
+	glGenQueries(LATENCY, mSampleQueries);
+}
+
+DeferredRenderer::~DeferredRenderer()
+{
+	glDeleteQueries(LATENCY, mSampleQueries);
+}
+
+size_t DeferredRenderer::getGBufferBytes() const
+{
+	return (size_t)getBytesPerPixel() * mGBuffer.getWidth() * mGBuffer.getHeight();
+}
+
+int DeferredRenderer::getBytesPerPixel() const
+{
+	size_t bytes = gpuTextureBytes(GL_DEPTH24_STENCIL8, 1, 1);
+	for (GLenum format : GBUFFER_FORMATS)
+	{
+		bytes += gpuTextureBytes(format, 1, 1);
+	}
+	return (int)bytes;
+}
+
+void DeferredRenderer::beginGeometry()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mGBuffer.getFBO());
+	glViewport(0, 0, mGBuffer.getWidth(), mGBuffer.getHeight());
+	glEnable(GL_DEPTH_TEST);
+	// Blending would mix the cleared zeros into the albedo alpha and the other targets
+	glDisable(GL_BLEND);
+
+	// Albedo alpha stays 0 where nothing is drawn
+	const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < mGBuffer.getColorCount(); i++)
+	{
+		glClearBufferfv(GL_COLOR, i, clearColor);
+	}
+	glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+}
+
+void DeferredRenderer::endGeometry()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DeferredRenderer::beginLighting()
+{
+	mStats.stencilVolumes = 0;
+	mStats.culledVolumes = 0;
+
+	// Read back the oldest sample count, it should be ready by now
+	if (mQueryPending[mQuerySlot])
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(mSampleQueries[mQuerySlot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			glGetQueryObjectuiv(mSampleQueries[mQuerySlot], GL_QUERY_RESULT, &mStats.volumeSamples);
+			mQueryPending[mQuerySlot] = false;
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mLightingFBO.get());
+	glViewport(0, 0, mGBuffer.getWidth(), mGBuffer.getHeight());
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void DeferredRenderer::bindForLighting(Shader& shader, Camera& camera, int firstUnit)
+{
+	const char* samplerNames[3] = { "_GBufferAlbedo", "_GBufferNormal", "_GBufferMaterial" };
+	for (int i = 0; i < mGBuffer.getColorCount(); i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, mGBuffer.getTexture(i));
+		shader.setInt(samplerNames[i], firstUnit + i);
+	}
+
+	int depthUnit = firstUnit + mGBuffer.getColorCount();
+	glActiveTexture(GL_TEXTURE0 + depthUnit);
+	glBindTexture(GL_TEXTURE_2D, mGBuffer.getDepthTexture());
+	shader.setInt("_GBufferDepth", depthUnit);
+
+	glm::mat4 view = camera.getViewMatrix();
+	glm::mat4 viewProjection = camera.getProjectionMatrix() * view;
+	shader.setMat4("_View", view);
+	shader.setMat4("_InverseViewProjection", glm::inverse(viewProjection));
+	shader.setMat4("_ViewProjection", viewProjection);
+	shader.setFloat("_VolumeScale", volumeScale);
+}
+
+void DeferredRenderer::drawFullscreen()
+{
+	// Every pixel is shaded once, depth is only read
+	glDisable(GL_DEPTH_TEST);
+	glBindVertexArray(mEmptyVAO.get());
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glEnable(GL_DEPTH_TEST);
+}
+
+void DeferredRenderer::beginVolumeQuery()
+{
+	if (mQueryActive)
+		return;
+
+	// The oldest query is still in use, skip counting this frame rather than stall
+	if (mQueryPending[mQuerySlot])
+		return;
+
+	glBeginQuery(GL_SAMPLES_PASSED, mSampleQueries[mQuerySlot]);
+	mQueryActive = true;
+}
+
+void DeferredRenderer::endVolumeQuery()
+{
+	if (!mQueryActive)
+		return;
+
+	glEndQuery(GL_SAMPLES_PASSED);
+	mQueryActive = false;
+	mQueryPending[mQuerySlot] = true;
+	mQuerySlot = (mQuerySlot + 1) % LATENCY;
+}
+
+void DeferredRenderer::drawStencilVolumes(Shader& stencilShader, Shader& lightShader, ew::Mesh& volume, Camera& camera,
+	const std::vector<LocalLight>& lights, int firstLight, int lightCount)
+{
+	if (lightCount <= 0)
+		return;
+
+	glm::mat4 view = camera.getViewMatrix();
+	glm::mat4 projection = camera.getProjectionMatrix();
+	glm::mat4 viewProjection = projection * view;
+	Frustum frustum = extractFrustum(viewProjection);
+	bool depthBounds = GLEW_EXT_depth_bounds_test;
+
+	stencilShader.use();
+	stencilShader.setMat4("_ViewProjection", viewProjection);
+	stencilShader.setFloat("_VolumeScale", volumeScale);
+
+	beginVolumeQuery();
+
+	glEnable(GL_STENCIL_TEST);
+	glEnable(GL_DEPTH_CLAMP);
+	glDepthMask(GL_FALSE);
+	glBlendFunc(GL_ONE, GL_ONE);
+	if (depthBounds)
+	{
+		glEnable(GL_DEPTH_BOUNDS_TEST_EXT);
+	}
+
+	for (int i = firstLight; i < firstLight + lightCount; i++)
+	{
+		glm::vec3 center;
+		float radius;
+		localLightBounds(lights[i], center, radius);
+		radius *= volumeScale;
+
+		AABB sphereBounds;
+		sphereBounds.min = center - glm::vec3(radius);
+		sphereBounds.max = center + glm::vec3(radius);
+		if (!frustumIntersectsAABB(frustum, sphereBounds))
+		{
+			mStats.culledVolumes++;
+			continue;
+		}
+		mStats.stencilVolumes++;
+
+		// Only G-buffer depths inside the sphere's view depth range can be lit by it
+		if (depthBounds)
+		{
+			float viewZ = (view * glm::vec4(center, 1.0f)).z;
+			float depthMin = 0.0f;
+			float depthMax = 1.0f;
+			float nearZ = std::min(viewZ + radius, -camera.getNearPlane());
+			float farZ = viewZ - radius;
+			glm::vec4 nearClip = projection * glm::vec4(0.0f, 0.0f, nearZ, 1.0f);
+			glm::vec4 farClip = projection * glm::vec4(0.0f, 0.0f, farZ, 1.0f);
+			depthMin = glm::clamp(nearClip.z / nearClip.w * 0.5f + 0.5f, 0.0f, 1.0f);
+			depthMax = glm::clamp(farClip.z / farClip.w * 0.5f + 0.5f, 0.0f, 1.0f);
+			glDepthBoundsEXT(depthMin, depthMax);
+		}
+
+		// Mark pixels whose surface is behind the front faces and in front of the back faces
+		stencilShader.use();
+		stencilShader.setInt("_FirstLight", i);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_LESS);
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_BLEND);
+		glStencilFunc(GL_ALWAYS, 0, 0xFF);
+		glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+		glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+		volume.draw();
+
+		// Shade the marked pixels through the back faces so it works with the camera inside,
+		// and reset the stencil behind it for the next light
+		lightShader.use();
+		lightShader.setInt("_FirstLight", i);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_FRONT);
+		glEnable(GL_BLEND);
+		glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+		volume.draw();
+	}
+
+	if (depthBounds)
+	{
+		glDisable(GL_DEPTH_BOUNDS_TEST_EXT);
+	}
+	glDisable(GL_STENCIL_TEST);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	glEnable(GL_DEPTH_TEST);
+}
+
+void DeferredRenderer::drawBatchedVolumes(Shader& lightShader, ew::Mesh& volume, Camera& camera, int firstLight, int lightCount)
+{
+	if (lightCount <= 0)
+		return;
+
+	lightShader.use();
+	lightShader.setMat4("_ViewProjection", camera.getProjectionMatrix() * camera.getViewMatrix());
+	lightShader.setInt("_FirstLight", firstLight);
+
+	beginVolumeQuery();
+
+	// Back faces behind the surface cover every pixel that may be inside, with or without the camera in the volume.
+	// Surfaces in front of the whole volume pass as well, the shader's range falloff leaves them black.
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_GEQUAL);
+	glDepthMask(GL_FALSE);
+	glEnable(GL_DEPTH_CLAMP);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_FRONT);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	volume.drawInstanced(lightCount);
+}
+
+void DeferredRenderer::endLighting()
+{
+	endVolumeQuery();
+
+	// Back to the alpha blending the forward pass and the UI expect
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable(GL_DEPTH_CLAMP);
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	glEnable(GL_DEPTH_TEST);
+	glCullFace(GL_BACK);
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "GL/glew.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "GlHandle.h"
+#include "RenderTargets.h"
+#include "LocalLights.h"
+#include "EW/Camera.h"
+#include "EW/Mesh.h"
+#include "EW/Shader.h"
+
+struct DeferredStats
+{
+	// Stencil tested volumes drawn and skipped outside the view last frame
+	int stencilVolumes;
+	int culledVolumes;
+	// Pixels the light volumes shaded, a few frames old
+	unsigned int volumeSamples;
+};
+
+/*
+* Deferred shading path.
+* The geometry pass writes albedo, octahedral normals and material parameters into a G-buffer,
+* 20 bytes per pixel with depth. Lighting then runs once per visible pixel: either one fullscreen
+* pass that walks the cluster lists, or one bounding volume per local light so a light only costs
+* the pixels it covers. Shadowed lights get an exact stencil mask of the volume, the rest are drawn
+* in a single instanced batch of back faces.
+*/
+class DeferredRenderer
+{
+public:
+	// Lighting is written to outputTexture, which has to be width x height
+	DeferredRenderer(int width, int height, unsigned int outputTexture);
+	~DeferredRenderer();
+
+	DeferredRenderer(const DeferredRenderer&) = delete;
+	DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+	// Binds and clears the G-buffer, blending is off until endLighting()
+	void beginGeometry();
+	void endGeometry();
+
+	// Binds the output with the G-buffer depth and clears its color
+	void beginLighting();
+	// Binds the G-buffer to four texture units from firstUnit and sets the reconstruction uniforms
+	void bindForLighting(Shader& shader, Camera& camera, int firstUnit);
+	// Shades every covered pixel with a fullscreen triangle
+	void drawFullscreen();
+	// One light at a time, the volume is stencil marked first so only pixels inside it are shaded
+	void drawStencilVolumes(Shader& stencilShader, Shader& lightShader, ew::Mesh& volume, Camera& camera,
+		const std::vector<LocalLight>& lights, int firstLight, int lightCount);
+	// All lights in one instanced draw of their back faces, pixels in front of them are shaded
+	void drawBatchedVolumes(Shader& lightShader, ew::Mesh& volume, Camera& camera, int firstLight, int lightCount);
+	// Restores the render state, the output stays bound with the G-buffer depth for forward drawing
+	void endLighting();
+
+	unsigned int getTexture(int index) const { return mGBuffer.getTexture(index); }
+	unsigned int getDepthTexture() const { return mGBuffer.getDepthTexture(); }
+	size_t getGBufferBytes() const;
+	int getBytesPerPixel() const;
+	const DeferredStats& getStats() const { return mStats; }
+
+	// Light volumes are scaled past the true bounds so the sphere's facets don't cut into them
+	float volumeScale = 1.1f;
+
+private:
+	// Frames in flight before a sample count is read back
+	static const int LATENCY = 4;
+
+	void beginVolumeQuery();
+	void endVolumeQuery();
+
+	FrameBuffer mGBuffer;
+	FramebufferHandle mLightingFBO;
+	VertexArrayHandle mEmptyVAO;
+
+	GLuint mSampleQueries[LATENCY];
+	bool mQueryPending[LATENCY] = {};
+	bool mQueryActive = false;
+	int mQuerySlot = 0;
+
+	DeferredStats mStats = {};
+};
@@ -13,6 +13,8 @@ public:
 	inline float getYaw()const { return mYaw; }
 	inline float getPitch()const { return mPitch; }
 	inline float getFov()const { return mFov; }
+	inline float getNearPlane()const { return mNearPlane; }
+	inline float getFarPlane()const { return mFarPlane; }
 	glm::vec3 getForward();
 	glm::mat4 getProjectionMatrix();
 	glm::mat4 getViewMatrix();
@@ -1,19 +1,28 @@
 //Author: Eric Winebrenner
 
 #include "Mesh.h"
+
 namespace ew {
 	Mesh::Mesh(MeshData* meshData) {
+		mData = meshData;
+		upload();
+	}
 
-		glGenVertexArrays(1, &mVAO);
-		glBindVertexArray(mVAO);
+	void Mesh::upload()
+	{
+		MeshData* meshData = mData;
+		mVAO = genVertexArray("Mesh");
+		glBindVertexArray(mVAO.get());
 
-		glGenBuffers(1, &mVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+		mVBO = genBuffer("Mesh vertices");
+		glBindBuffer(GL_ARRAY_BUFFER, mVBO.get());
 		glBufferData(GL_ARRAY_BUFFER, meshData->vertices.size() * sizeof(Vertex), &meshData->vertices[0], GL_STATIC_DRAW);
+		gpuTrackResize(GpuResourceType::Buffer, mVBO.get(), meshData->vertices.size() * sizeof(Vertex), GL_NONE);
 
-		glGenBuffers(1, &mEBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
+		mEBO = genBuffer("Mesh indices");
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO.get());
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshData->indices.size() * sizeof(unsigned int), &meshData->indices[0], GL_STATIC_DRAW);
+		gpuTrackResize(GpuResourceType::Buffer, mEBO.get(), meshData->indices.size() * sizeof(unsigned int), GL_NONE);
 
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)(offsetof(Vertex, position)));
 		glEnableVertexAttribArray(0);
@@ -29,19 +38,46 @@ namespace ew {
 
 		mNumIndices = (GLsizei)meshData->indices.size();
 		mNumVertices = (GLsizei)meshData->vertices.size();
-	}
 
-	Mesh::~Mesh()
-	{
-		glDeleteVertexArrays(1, &mVAO);
-		glDeleteBuffers(1, &mVBO);
-		glDeleteBuffers(1, &mEBO);
+		// Leave the VAO unbound so later buffer binds don't modify it
+		glBindVertexArray(0);
 	}
 
 	void Mesh::draw()
 	{
-		glBindVertexArray(mVAO);
+		if (!mVAO && mData)
+			upload();
+		mUsed = true;
+		glBindVertexArray(mVAO.get());
 		glDrawElements(GL_TRIANGLES, mNumIndices, GL_UNSIGNED_INT, 0);
 	}
 
+	void Mesh::drawInstanced(int instanceCount)
+	{
+		if (!mVAO && mData)
+			upload();
+		mUsed = true;
+		glBindVertexArray(mVAO.get());
+		glDrawElementsInstanced(GL_TRIANGLES, mNumIndices, GL_UNSIGNED_INT, 0, instanceCount);
+	}
+
+	void Mesh::evict()
+	{
+		mVAO.reset();
+		mVBO.reset();
+		mEBO.reset();
+	}
+
+	size_t Mesh::getBytes() const
+	{
+		return (size_t)mNumVertices * sizeof(Vertex) + (size_t)mNumIndices * sizeof(unsigned int);
+	}
+
+	bool Mesh::takeUsed()
+	{
+		bool used = mUsed;
+		mUsed = false;
+		return used;
+	}
+
 }
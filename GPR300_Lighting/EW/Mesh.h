@@ -4,6 +4,7 @@
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <vector>
+#include "../GlHandle.h"
 
 namespace ew {
 	struct Vertex {
@@ -24,16 +25,34 @@ namespace ew {
 	};
 
 	/// <summary>
-	/// Holds OpenGL buffers, can be drawn
+	/// Holds OpenGL buffers, can be drawn.
+	/// Move-only, the buffers are released through the deferred deletion queue.
+	/// Keeps a pointer to its mesh data, which has to outlive it, so evicted buffers
+	/// can be uploaded again by the next draw.
 	/// </summary>
 	class Mesh {
 	public:
+		Mesh() = default;
 		Mesh(MeshData* meshData);
-		~Mesh();
+		Mesh(Mesh&&) = default;
+		Mesh& operator=(Mesh&&) = default;
 		void draw();
+		void drawInstanced(int instanceCount);
+
+		// Releases the GPU buffers, the next draw uploads them again
+		void evict();
+		bool isResident() const { return (bool)mVAO; }
+		size_t getBytes() const;
+		// True if the mesh was drawn since the last call
+		bool takeUsed();
 	private:
-		GLuint mVAO, mVBO, mEBO;
-		GLsizei mNumIndices;
-		GLsizei mNumVertices;
+		void upload();
+
+		MeshData* mData = nullptr;
+		bool mUsed = false;
+		VertexArrayHandle mVAO;
+		BufferHandle mVBO, mEBO;
+		GLsizei mNumIndices = 0;
+		GLsizei mNumVertices = 0;
 	};
 }
@@ -10,67 +10,110 @@
 #include <glm/ext/matrix_transform.hpp> // glm::translate, glm::rotate, glm::scale
 #include <glm/gtc/type_ptr.hpp>
 
-Shader::Shader(std::string vertexShaderPath, std::string fragmentShaderPath)
+Shader::Shader(std::string vertexShaderPath, std::string fragmentShaderPath, const std::string& defines)
 {
 	std::string vertexShaderString = readFile(vertexShaderPath);
+	insertDefines(vertexShaderString, defines);
 	GLuint vertexShader = compileShader(vertexShaderString.c_str(), GL_VERTEX_SHADER);
 
 	std::string fragmentShaderString = readFile(fragmentShaderPath);
+	insertDefines(fragmentShaderString, defines);
 	GLuint fragmentShader = compileShader(fragmentShaderString.c_str(), GL_FRAGMENT_SHADER);
 
 	//Create an empty shader program
-	m_id = glCreateProgram();
+	m_id = createProgram(fragmentShaderPath.c_str());
 
 	//Attach our shader objects
-	glAttachShader(m_id, vertexShader);
-	glAttachShader(m_id, fragmentShader);
+	glAttachShader(m_id.get(), vertexShader);
+	glAttachShader(m_id.get(), fragmentShader);
 
+	linkProgram();
+
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+}
+
+Shader::Shader(std::string computeShaderPath)
+{
+	std::string computeShaderString = readFile(computeShaderPath);
+	GLuint computeShader = compileShader(computeShaderString.c_str(), GL_COMPUTE_SHADER);
+
+	m_id = createProgram(computeShaderPath.c_str());
+	glAttachShader(m_id.get(), computeShader);
+	linkProgram();
+
+	glDeleteShader(computeShader);
+}
+
+void Shader::linkProgram()
+{
 	//Link program - will create an executable program with the attached shaders
-	glLinkProgram(m_id);
+	glLinkProgram(m_id.get());
 
 	//Logging
 	int success;
-	glGetProgramiv(m_id, GL_LINK_STATUS, &success);
+	glGetProgramiv(m_id.get(), GL_LINK_STATUS, &success);
 	if (!success) {
 
 		GLchar infoLog[512];
-		glGetProgramInfoLog(m_id, 512, NULL, infoLog);
+		glGetProgramInfoLog(m_id.get(), 512, NULL, infoLog);
 		printf("Failed to link shader program: %s", infoLog);
 	}
-
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
 }
 
 void Shader::use()
 {
-	glUseProgram(m_id);
+	glUseProgram(m_id.get());
+}
+
+void Shader::setFloat(const char* name, float value)
+{
+	glProgramUniform1f(m_id.get(), glGetUniformLocation(m_id.get(), name), value);
+}
+
+void Shader::setInt(const char* name, int value)
+{
+	glProgramUniform1i(m_id.get(), glGetUniformLocation(m_id.get(), name), value);
+}
+
+void Shader::setMat4(const char* name, const glm::mat4& value) { 
+	glProgramUniformMatrix4fv(m_id.get(), glGetUniformLocation(m_id.get(), name), 1, false, glm::value_ptr(value));
+}
+
+void Shader::setVec3(const char* name, const glm::vec3& value)
+{
+	glProgramUniform3f(m_id.get(), glGetUniformLocation(m_id.get(), name), value.x, value.y, value.z);
 }
 
-void Shader::setFloat(std::string name, float value)
+void Shader::setIVec3(const char* name, const glm::ivec3& value)
 {
-	glProgramUniform1f(m_id, glGetUniformLocation(m_id, name.c_str()), value);
+	glProgramUniform3i(m_id.get(), glGetUniformLocation(m_id.get(), name), value.x, value.y, value.z);
 }
 
-void Shader::setInt(std::string name, int value)
+void Shader::setVec2(const char* name, const glm::vec2& value)
 {
-	glProgramUniform1i(m_id, glGetUniformLocation(m_id, name.c_str()), value);
+	glProgramUniform2f(m_id.get(), glGetUniformLocation(m_id.get(), name), value.x, value.y);
 }
 
-void Shader::setMat4(std::string name, const glm::mat4& value) { 
-	glProgramUniformMatrix4fv(m_id, glGetUniformLocation(m_id, name.c_str()), 1, false, glm::value_ptr(value));
+void Shader::setMat4Array(const char* name, int count, const glm::mat4* values)
+{
+	glProgramUniformMatrix4fv(m_id.get(), glGetUniformLocation(m_id.get(), name), count, false, glm::value_ptr(values[0]));
 }
 
-void Shader::setVec3(std::string name, const glm::vec3& value)
+void Shader::setFloatArray(const char* name, int count, const float* values)
 {
-	glProgramUniform3f(m_id, glGetUniformLocation(m_id, name.c_str()), value.x, value.y, value.z);
+	glProgramUniform1fv(m_id.get(), glGetUniformLocation(m_id.get(), name), count, values);
 }
 
-void Shader::setVec2(std::string name, const glm::vec2& value)
+void Shader::setIntArray(const char* name, int count, const int* values)
 {
-	glProgramUniform2f(m_id, glGetUniformLocation(m_id, name.c_str()), value.x, value.y);
+	glProgramUniform1iv(m_id.get(), glGetUniformLocation(m_id.get(), name), count, values);
 }
 
+void Shader::setIVec2Array(const char* name, int count, const glm::ivec2* values)
+{
+	glProgramUniform2iv(m_id.get(), glGetUniformLocation(m_id.get(), name), count, glm::value_ptr(values[0]));
+}
 
 std::string Shader::readFile(const std::string& filePath)
 {
@@ -85,6 +128,16 @@ std::string Shader::readFile(const std::string& filePath)
 	return stringStream.str();
 }
 
+void Shader::insertDefines(std::string& source, const std::string& defines)
+{
+	if (defines.empty())
+		return;
+
+	// #version has to stay the first line
+	size_t lineEnd = source.find('\n');
+	source.insert(lineEnd == std::string::npos ? source.size() : lineEnd + 1, defines);
+}
+
 GLuint Shader::compileShader(const char* shaderSource, GLenum shaderType)
 {
 	GLuint shader = glCreateShader(shaderType);
@@ -97,7 +150,7 @@ GLuint Shader::compileShader(const char* shaderSource, GLenum shaderType)
 	GLint success;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
 	if (!success) {
-		const char* shaderName = shaderType == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT";
+		const char* shaderName = shaderType == GL_VERTEX_SHADER ? "VERTEX" : shaderType == GL_COMPUTE_SHADER ? "COMPUTE" : "FRAGMENT";
 		//Dump logs into a char array - 512 is an arbitrary length
 		GLchar infoLog[512];
 		glGetShaderInfoLog(shader, 512, NULL, infoLog);
@@ -4,21 +4,34 @@
 #include "GL/glew.h"
 #include <glm/glm.hpp>
 #include <string>
+#include "../GlHandle.h"
 
 class Shader
 {
 public:
-	Shader(std::string vertexShaderPath, std::string fragmentShaderPath);
+	// defines is inserted after the #version line of both stages, e.g. "#define DEFERRED_LIGHTING\n"
+	Shader(std::string vertexShaderPath, std::string fragmentShaderPath, const std::string& defines = "");
+	// Compute-only program, run with glDispatchCompute after use()
+	explicit Shader(std::string computeShaderPath);
+	Shader(Shader&&) = default;
+	Shader& operator=(Shader&&) = default;
 	void use();
-	void setFloat(std::string name, float value);
-	void setInt(std::string name, int value);
-	void setMat4(std::string name, const glm::mat4& value);
-	void setVec2(std::string name, const glm::vec2& value);
-	void setVec3(std::string name, const glm::vec3& value);
+	void setFloat(const char* name, float value);
+	void setInt(const char* name, int value);
+	void setMat4(const char* name, const glm::mat4& value);
+	void setVec2(const char* name, const glm::vec2& value);
+	void setVec3(const char* name, const glm::vec3& value);
+	void setIVec3(const char* name, const glm::ivec3& value);
+	void setMat4Array(const char* name, int count, const glm::mat4* values);
+	void setFloatArray(const char* name, int count, const float* values);
+	void setIntArray(const char* name, int count, const int* values);
+	void setIVec2Array(const char* name, int count, const glm::ivec2* values);
 private:
 	Shader(const Shader& r) = delete;
 	std::string readFile(const std::string& filePath);
+	void insertDefines(std::string& source, const std::string& defines);
 	GLuint compileShader(const char* shaderSource, GLenum type);
-	GLuint m_id;
+	void linkProgram();
+	ProgramHandle m_id;
 };
 
@@ -0,0 +1,173 @@
+#include "GlHandle.h"
+
+#include <deque>
+#include <vector>
+
+struct PendingDeletion
+{
+	GpuResourceType type;
+	GLuint id;
+};
+
+struct DeletionBatch
+{
+	GLsync fence;
+	std::vector<PendingDeletion> objects;
+};
+
+// Released since the last end of frame, not fenced yet
+static std::vector<PendingDeletion> currentBatch;
+// Fenced batches, oldest first
+static std::deque<DeletionBatch> fencedBatches;
+static int pendingCount = 0;
+
+static void deleteObject(const PendingDeletion& object)
+{
+	gpuTrackDelete(object.type, object.id);
+
+	switch (object.type)
+	{
+	case GpuResourceType::Buffer:
+		glDeleteBuffers(1, &object.id);
+		break;
+	case GpuResourceType::Texture:
+		glDeleteTextures(1, &object.id);
+		break;
+	case GpuResourceType::Renderbuffer:
+		glDeleteRenderbuffers(1, &object.id);
+		break;
+	case GpuResourceType::Framebuffer:
+		glDeleteFramebuffers(1, &object.id);
+		break;
+	case GpuResourceType::VertexArray:
+		glDeleteVertexArrays(1, &object.id);
+		break;
+	case GpuResourceType::Program:
+		glDeleteProgram(object.id);
+		break;
+	case GpuResourceType::Sampler:
+		glDeleteSamplers(1, &object.id);
+		break;
+	default:
+		break;
+	}
+
+	pendingCount--;
+}
+
+void gpuDeferDelete(GpuResourceType type, GLuint id)
+{
+	if (id == 0)
+		return;
+
+	currentBatch.push_back({ type, id });
+	pendingCount++;
+}
+
+void gpuProcessDeferredDeletions()
+{
+	// Retire batches in order, stop at the first one the GPU hasn't reached
+	while (!fencedBatches.empty())
+	{
+		DeletionBatch& batch = fencedBatches.front();
+		GLenum status = glClientWaitSync(batch.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+
+		for (const PendingDeletion& object : batch.objects)
+		{
+			deleteObject(object);
+		}
+		glDeleteSync(batch.fence);
+		fencedBatches.pop_front();
+	}
+
+	if (!currentBatch.empty())
+	{
+		DeletionBatch batch;
+		batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		batch.objects.swap(currentBatch);
+		fencedBatches.push_back(std::move(batch));
+	}
+}
+
+void gpuFlushDeferredDeletions()
+{
+	glFinish();
+
+	for (DeletionBatch& batch : fencedBatches)
+	{
+		for (const PendingDeletion& object : batch.objects)
+		{
+			deleteObject(object);
+		}
+		glDeleteSync(batch.fence);
+	}
+	fencedBatches.clear();
+
+	for (const PendingDeletion& object : currentBatch)
+	{
+		deleteObject(object);
+	}
+	currentBatch.clear();
+}
+
+int gpuGetPendingDeletionCount()
+{
+	return pendingCount;
+}
+
+BufferHandle genBuffer(const char* owner)
+{
+	GLuint id;
+	glGenBuffers(1, &id);
+	gpuTrackCreate(GpuResourceType::Buffer, id, 0, GL_NONE, owner);
+	return BufferHandle(id);
+}
+
+TextureHandle genTexture(const char* owner)
+{
+	GLuint id;
+	glGenTextures(1, &id);
+	gpuTrackCreate(GpuResourceType::Texture, id, 0, GL_NONE, owner);
+	return TextureHandle(id);
+}
+
+RenderbufferHandle genRenderbuffer(const char* owner)
+{
+	GLuint id;
+	glGenRenderbuffers(1, &id);
+	gpuTrackCreate(GpuResourceType::Renderbuffer, id, 0, GL_NONE, owner);
+	return RenderbufferHandle(id);
+}
+
+FramebufferHandle genFramebuffer(const char* owner)
+{
+	GLuint id;
+	glGenFramebuffers(1, &id);
+	gpuTrackCreate(GpuResourceType::Framebuffer, id, 0, GL_NONE, owner);
+	return FramebufferHandle(id);
+}
+
+VertexArrayHandle genVertexArray(const char* owner)
+{
+	GLuint id;
+	glGenVertexArrays(1, &id);
+	gpuTrackCreate(GpuResourceType::VertexArray, id, 0, GL_NONE, owner);
+	return VertexArrayHandle(id);
+}
+
+ProgramHandle createProgram(const char* owner)
+{
+	GLuint id = glCreateProgram();
+	gpuTrackCreate(GpuResourceType::Program, id, 0, GL_NONE, owner);
+	return ProgramHandle(id);
+}
+
+SamplerHandle genSampler(const char* owner)
+{
+	GLuint id;
+	glGenSamplers(1, &id);
+	gpuTrackCreate(GpuResourceType::Sampler, id, 0, GL_NONE, owner);
+	return SamplerHandle(id);
+}
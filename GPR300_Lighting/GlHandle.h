@@ -0,0 +1,91 @@
+#pragma once
+#include "GL/glew.h"
+#include "GpuMemory.h"
+
+/*
+* Deletion of GL objects is deferred until the GPU has finished the frame that last used them.
+* Objects released during a frame are batched behind a fence inserted at the end of that frame,
+* and only handed back to GL once the fence has signaled, so a name is never reused
+* while queued commands may still reference it.
+*/
+void gpuDeferDelete(GpuResourceType type, GLuint id);
+
+// Call once per frame after submitting the frame's work
+void gpuProcessDeferredDeletions();
+
+// Waits for the GPU and deletes everything still queued, call before destroying the context
+void gpuFlushDeferredDeletions();
+
+int gpuGetPendingDeletionCount();
+
+/*
+* Move-only owner of one GL object name.
+* Destroying or resetting the handle queues the object for deferred deletion,
+* moving transfers ownership and leaves the source empty.
+*/
+template<GpuResourceType Type>
+class GlHandle
+{
+public:
+	GlHandle() = default;
+	explicit GlHandle(GLuint id) : mId(id) {}
+	~GlHandle() { reset(); }
+
+	GlHandle(const GlHandle&) = delete;
+	GlHandle& operator=(const GlHandle&) = delete;
+
+	GlHandle(GlHandle&& other) noexcept : mId(other.mId)
+	{
+		other.mId = 0;
+	}
+
+	GlHandle& operator=(GlHandle&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			mId = other.mId;
+			other.mId = 0;
+		}
+		return *this;
+	}
+
+	GLuint get() const { return mId; }
+	explicit operator bool() const { return mId != 0; }
+
+	// Gives up ownership without deleting
+	GLuint release()
+	{
+		GLuint id = mId;
+		mId = 0;
+		return id;
+	}
+
+	void reset(GLuint id = 0)
+	{
+		if (mId != 0)
+			gpuDeferDelete(Type, mId);
+		mId = id;
+	}
+
+private:
+	GLuint mId = 0;
+};
+
+typedef GlHandle<GpuResourceType::Buffer> BufferHandle;
+typedef GlHandle<GpuResourceType::Texture> TextureHandle;
+typedef GlHandle<GpuResourceType::Renderbuffer> RenderbufferHandle;
+typedef GlHandle<GpuResourceType::Framebuffer> FramebufferHandle;
+typedef GlHandle<GpuResourceType::VertexArray> VertexArrayHandle;
+typedef GlHandle<GpuResourceType::Program> ProgramHandle;
+typedef GlHandle<GpuResourceType::Sampler> SamplerHandle;
+
+// Generate a new object and register it with the GPU memory registry.
+// Report the size with gpuTrackResize once storage is allocated.
+BufferHandle genBuffer(const char* owner);
+TextureHandle genTexture(const char* owner);
+RenderbufferHandle genRenderbuffer(const char* owner);
+FramebufferHandle genFramebuffer(const char* owner);
+VertexArrayHandle genVertexArray(const char* owner);
+ProgramHandle createProgram(const char* owner);
+SamplerHandle genSampler(const char* owner);
@@ -0,0 +1,302 @@
+#include "GpuMemory.h"
+#include "GlHandle.h"
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+#include "imgui/imgui.h"
+
+struct GpuResourceRecord
+{
+	GpuResourceType type;
+	GLuint id;
+	size_t bytes;
+	GLenum format;
+	std::string owner;
+};
+
+static std::unordered_map<unsigned long long, GpuResourceRecord> resources;
+static size_t liveBytes[(int)GpuResourceType::Count];
+static int liveCounts[(int)GpuResourceType::Count];
+
+static unsigned long long resourceKey(GpuResourceType type, GLuint id)
+{
+	return ((unsigned long long)type << 32) | id;
+}
+
+void gpuTrackCreate(GpuResourceType type, GLuint id, size_t bytes, GLenum format, const char* owner)
+{
+	if (id == 0)
+		return;
+
+	GpuResourceRecord& record = resources[resourceKey(type, id)];
+	record.type = type;
+	record.id = id;
+	record.bytes = bytes;
+	record.format = format;
+	record.owner = owner != nullptr ? owner : "Unknown";
+
+	liveBytes[(int)type] += bytes;
+	liveCounts[(int)type]++;
+}
+
+void gpuTrackResize(GpuResourceType type, GLuint id, size_t bytes, GLenum format)
+{
+	auto it = resources.find(resourceKey(type, id));
+	if (it == resources.end())
+	{
+		printf("Resized untracked %s %u\n", gpuResourceTypeName(type), id);
+		return;
+	}
+
+	liveBytes[(int)type] -= it->second.bytes;
+	liveBytes[(int)type] += bytes;
+	it->second.bytes = bytes;
+	it->second.format = format;
+}
+
+void gpuTrackDelete(GpuResourceType type, GLuint id)
+{
+	if (id == 0)
+		return;
+
+	auto it = resources.find(resourceKey(type, id));
+	if (it == resources.end())
+	{
+		printf("Deleted untracked %s %u\n", gpuResourceTypeName(type), id);
+		return;
+	}
+
+	liveBytes[(int)type] -= it->second.bytes;
+	liveCounts[(int)type]--;
+	resources.erase(it);
+}
+
+size_t gpuGetLiveBytes(GpuResourceType type)
+{
+	return liveBytes[(int)type];
+}
+
+int gpuGetLiveCount(GpuResourceType type)
+{
+	return liveCounts[(int)type];
+}
+
+size_t gpuGetTotalBytes()
+{
+	size_t total = 0;
+	for (int i = 0; i < (int)GpuResourceType::Count; i++)
+	{
+		total += liveBytes[i];
+	}
+	return total;
+}
+
+// Bytes per texel, or bytes per 4x4 block for compressed formats
+static size_t formatSize(GLenum internalFormat, bool& compressed)
+{
+	compressed = false;
+	switch (internalFormat)
+	{
+	case GL_R8:
+	case GL_STENCIL_INDEX8:
+		return 1;
+	case GL_RG8:
+	case GL_R16F:
+	case GL_DEPTH_COMPONENT16:
+		return 2;
+	// Unsized and 24 bit formats are padded to 4 bytes by most drivers
+	case GL_RGB:
+	case GL_RGB8:
+	case GL_RGBA:
+	case GL_RGBA8:
+	case GL_SRGB8:
+	case GL_SRGB8_ALPHA8:
+	case GL_RGB10_A2:
+	case GL_RG16F:
+	case GL_RG16:
+	case GL_RG16_SNORM:
+	case GL_R32F:
+	case GL_R32UI:
+	case GL_RGBA8UI:
+	case GL_DEPTH_COMPONENT:
+	case GL_DEPTH_COMPONENT24:
+	case GL_DEPTH_COMPONENT32F:
+	case GL_DEPTH24_STENCIL8:
+		return 4;
+	case GL_DEPTH32F_STENCIL8:
+	case GL_RG32F:
+	case GL_RG32UI:
+	case GL_RGBA16F:
+	case GL_RGBA16_SNORM:
+		return 8;
+	case GL_RGBA32F:
+		return 16;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RED_RGTC1:
+		compressed = true;
+		return 8;
+	case GL_COMPRESSED_RG_RGTC2:
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+		compressed = true;
+		return 16;
+	default:
+		return 4;
+	}
+}
+
+size_t gpuTextureBytes(GLenum internalFormat, int width, int height, int depth, int levels)
+{
+	bool compressed;
+	size_t unitSize = formatSize(internalFormat, compressed);
+
+	size_t total = 0;
+	for (int level = 0; level < levels; level++)
+	{
+		int levelWidth = std::max(width >> level, 1);
+		int levelHeight = std::max(height >> level, 1);
+
+		if (compressed)
+			total += (size_t)((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * unitSize;
+		else
+			total += (size_t)levelWidth * levelHeight * unitSize;
+	}
+	return total * depth;
+}
+
+int gpuMipLevelCount(int width, int height)
+{
+	int levels = 1;
+	int size = std::max(width, height);
+	while (size > 1)
+	{
+		size >>= 1;
+		levels++;
+	}
+	return levels;
+}
+
+const char* gpuFormatName(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_NONE: return "-";
+	case GL_R8: return "R8";
+	case GL_RG8: return "RG8";
+	case GL_RGB: return "RGB";
+	case GL_RGB8: return "RGB8";
+	case GL_RGBA: return "RGBA";
+	case GL_RGBA8: return "RGBA8";
+	case GL_SRGB8: return "SRGB8";
+	case GL_SRGB8_ALPHA8: return "SRGB8_A8";
+	case GL_RGB10_A2: return "RGB10_A2";
+	case GL_R16F: return "R16F";
+	case GL_RG16F: return "RG16F";
+	case GL_RG16: return "RG16";
+	case GL_RG16_SNORM: return "RG16_SNORM";
+	case GL_RGBA16_SNORM: return "RGBA16_SNORM";
+	case GL_R32F: return "R32F";
+	case GL_R32UI: return "R32UI";
+	case GL_RGBA8UI: return "RGBA8UI";
+	case GL_RG32F: return "RG32F";
+	case GL_RG32UI: return "RG32UI";
+	case GL_RGBA16F: return "RGBA16F";
+	case GL_RGBA32F: return "RGBA32F";
+	case GL_DEPTH_COMPONENT: return "DEPTH";
+	case GL_DEPTH_COMPONENT16: return "DEPTH16";
+	case GL_DEPTH_COMPONENT24: return "DEPTH24";
+	case GL_DEPTH_COMPONENT32F: return "DEPTH32F";
+	case GL_DEPTH24_STENCIL8: return "DEPTH24_S8";
+	case GL_DEPTH32F_STENCIL8: return "DEPTH32F_S8";
+	case GL_STENCIL_INDEX8: return "S8";
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: return "BC1A";
+	case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: return "BC1_SRGB";
+	case GL_COMPRESSED_RED_RGTC1: return "BC4";
+	case GL_COMPRESSED_RG_RGTC2: return "BC5";
+	case GL_COMPRESSED_RGBA_BPTC_UNORM: return "BC7";
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: return "BC7_SRGB";
+	default: return "Other";
+	}
+}
+
+const char* gpuResourceTypeName(GpuResourceType type)
+{
+	switch (type)
+	{
+	case GpuResourceType::Buffer: return "Buffer";
+	case GpuResourceType::Texture: return "Texture";
+	case GpuResourceType::Renderbuffer: return "Renderbuffer";
+	case GpuResourceType::Framebuffer: return "Framebuffer";
+	case GpuResourceType::VertexArray: return "Vertex Array";
+	case GpuResourceType::Program: return "Program";
+	case GpuResourceType::Sampler: return "Sampler";
+	default: return "Unknown";
+	}
+}
+
+int gpuReportLeaks()
+{
+	if (resources.empty())
+	{
+		printf("No GL objects leaked.\n");
+		return 0;
+	}
+
+	printf("%d GL objects leaked:\n", (int)resources.size());
+	for (const auto& entry : resources)
+	{
+		const GpuResourceRecord& record = entry.second;
+		printf("  %s %u (%s, %zu bytes) owned by %s\n", gpuResourceTypeName(record.type), record.id,
+			gpuFormatName(record.format), record.bytes, record.owner.c_str());
+	}
+	return (int)resources.size();
+}
+
+void gpuMemoryDrawUI()
+{
+	ImGui::Begin("GPU Memory");
+
+	ImGui::Text("Total: %.2f MB", gpuGetTotalBytes() / (1024.0 * 1024.0));
+	ImGui::Text("Pending deletion: %d", gpuGetPendingDeletionCount());
+	for (int i = 0; i < (int)GpuResourceType::Count; i++)
+	{
+		ImGui::Text("%-14s %4d  %9.2f MB", gpuResourceTypeName((GpuResourceType)i), liveCounts[i], liveBytes[i] / (1024.0 * 1024.0));
+	}
+
+	if (ImGui::CollapsingHeader("Resources"))
+	{
+		if (ImGui::BeginTable("GpuResources", 5, ImGuiTableFlags_ScrollY, ImVec2(0, 240)))
+		{
+			ImGui::TableSetupColumn("Type");
+			ImGui::TableSetupColumn("ID");
+			ImGui::TableSetupColumn("Format");
+			ImGui::TableSetupColumn("KB");
+			ImGui::TableSetupColumn("Owner");
+			ImGui::TableHeadersRow();
+			for (const auto& entry : resources)
+			{
+				const GpuResourceRecord& record = entry.second;
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(gpuResourceTypeName(record.type));
+				ImGui::TableNextColumn();
+				ImGui::Text("%u", record.id);
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(gpuFormatName(record.format));
+				ImGui::TableNextColumn();
+				ImGui::Text("%.1f", record.bytes / 1024.0);
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(record.owner.c_str());
+			}
+			ImGui::EndTable();
+		}
+	}
+
+	ImGui::End();
+}
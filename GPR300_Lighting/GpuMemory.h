@@ -0,0 +1,43 @@
+#pragma once
+#include "GL/glew.h"
+#include <cstddef>
+
+/*
+* Registry of every live GL object the app creates.
+* Each creation site reports the object with its estimated size, format and owner,
+* and each deletion site removes it again. Whatever is still registered at shutdown is a leak.
+*/
+enum class GpuResourceType
+{
+	Buffer,
+	Texture,
+	Renderbuffer,
+	Framebuffer,
+	VertexArray,
+	Program,
+	Sampler,
+	Count
+};
+
+void gpuTrackCreate(GpuResourceType type, GLuint id, size_t bytes, GLenum format, const char* owner);
+// Storage of an existing object was reallocated
+void gpuTrackResize(GpuResourceType type, GLuint id, size_t bytes, GLenum format);
+void gpuTrackDelete(GpuResourceType type, GLuint id);
+
+size_t gpuGetLiveBytes(GpuResourceType type);
+int gpuGetLiveCount(GpuResourceType type);
+size_t gpuGetTotalBytes();
+
+// Size of a texture's storage, including its mip chain when levels > 1
+size_t gpuTextureBytes(GLenum internalFormat, int width, int height, int depth = 1, int levels = 1);
+// Number of levels in a full mip chain for the given size
+int gpuMipLevelCount(int width, int height);
+
+const char* gpuFormatName(GLenum internalFormat);
+const char* gpuResourceTypeName(GpuResourceType type);
+
+// Prints every object still registered, returns how many there were
+int gpuReportLeaks();
+
+// ImGui window with live totals per category and a list of resources
+void gpuMemoryDrawUI();
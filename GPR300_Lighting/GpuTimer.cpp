@@ -0,0 +1,47 @@
+#include "GpuTimer.h"
+
+// Weight of the newest sample in the running average
+const float SMOOTHING = 0.1f;
+
+GpuTimer::GpuTimer()
+{
+	glGenQueries(LATENCY * 2, &mQueries[0][0]);
+}
+
+GpuTimer::~GpuTimer()
+{
+	glDeleteQueries(LATENCY * 2, &mQueries[0][0]);
+}
+
+void GpuTimer::collect(int slot)
+{
+	if (!mPending[slot])
+		return;
+
+	GLint available = 0;
+	glGetQueryObjectiv(mQueries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	GLuint64 start, stop;
+	glGetQueryObjectui64v(mQueries[slot][0], GL_QUERY_RESULT, &start);
+	glGetQueryObjectui64v(mQueries[slot][1], GL_QUERY_RESULT, &stop);
+	mPending[slot] = false;
+
+	float milliseconds = (float)(stop - start) / 1000000.0f;
+	mMilliseconds += (milliseconds - mMilliseconds) * SMOOTHING;
+}
+
+void GpuTimer::begin()
+{
+	// Reuse the oldest slot, its result should be ready by now
+	collect(mSlot);
+	glQueryCounter(mQueries[mSlot][0], GL_TIMESTAMP);
+}
+
+void GpuTimer::end()
+{
+	glQueryCounter(mQueries[mSlot][1], GL_TIMESTAMP);
+	mPending[mSlot] = true;
+	mSlot = (mSlot + 1) % LATENCY;
+}
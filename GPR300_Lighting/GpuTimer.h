@@ -0,0 +1,34 @@
+#pragma once
+#include "GL/glew.h"
+
+/*
+* Measures GPU time between begin() and end() with timestamp queries.
+* Results are read back a few frames later so the CPU never waits on the GPU,
+* and are smoothed to keep the UI readable.
+*/
+class GpuTimer
+{
+public:
+	GpuTimer();
+	~GpuTimer();
+
+	GpuTimer(const GpuTimer&) = delete;
+	GpuTimer& operator=(const GpuTimer&) = delete;
+
+	void begin();
+	void end();
+
+	// Smoothed duration of recent frames
+	float getMilliseconds() const { return mMilliseconds; }
+
+private:
+	// Frames in flight before a result is read back
+	static const int LATENCY = 4;
+
+	void collect(int slot);
+
+	GLuint mQueries[LATENCY][2];
+	bool mPending[LATENCY] = {};
+	int mSlot = 0;
+	float mMilliseconds = 0.0f;
+};
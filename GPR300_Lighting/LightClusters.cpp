@@ -0,0 +1,65 @@
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "GpuMemory.h"
+
+LightClusterGrid::LightClusterGrid(int tilesX, int tilesY, int slices, int maxLightsPerCluster)
+	: mAssignShader("shaders/lightClusters.comp")
+{
+	mTilesX = tilesX;
+	mTilesY = tilesY;
+	mSlices = slices;
+	mMaxLightsPerCluster = maxLightsPerCluster;
+
+	size_t countBytes = getClusterCount() * sizeof(unsigned int);
+	mCountBuffer = genBuffer("LightClusters counts");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCountBuffer.get());
+	glBufferData(GL_SHADER_STORAGE_BUFFER, countBytes, nullptr, GL_DYNAMIC_COPY);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	gpuTrackResize(GpuResourceType::Buffer, mCountBuffer.get(), countBytes, GL_NONE);
+
+	size_t indexBytes = countBytes * maxLightsPerCluster;
+	mIndexBuffer = genBuffer("LightClusters indices");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mIndexBuffer.get());
+	glBufferData(GL_SHADER_STORAGE_BUFFER, indexBytes, nullptr, GL_DYNAMIC_COPY);
+	gpuTrackResize(GpuResourceType::Buffer, mIndexBuffer.get(), indexBytes, GL_NONE);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	mAssignShader.setIVec3("_ClusterGrid", glm::ivec3(tilesX, tilesY, slices));
+	mAssignShader.setInt("_MaxLightsPerCluster", maxLightsPerCluster);
+}
+
+void LightClusterGrid::build(Camera& camera, int lightCount)
+{
+	glm::mat4 projection = camera.getProjectionMatrix();
+	mFarDepth = std::min(clusterFar, camera.getFarPlane());
+
+	mAssignShader.use();
+	mAssignShader.setInt("_LightCount", lightCount);
+	mAssignShader.setFloat("_ClusterNear", clusterNear);
+	mAssignShader.setFloat("_ClusterFar", mFarDepth);
+	mAssignShader.setMat4("_View", camera.getViewMatrix());
+	mAssignShader.setVec2("_ProjectionScale", glm::vec2(projection[0][0], projection[1][1]));
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mCountBuffer.get());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mIndexBuffer.get());
+	glDispatchCompute(getClusterCount(), 1, 1);
+
+	// The lit pass reads the lists
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void LightClusterGrid::bindForLighting(Shader& shader, int screenWidth, int screenHeight)
+{
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mCountBuffer.get());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mIndexBuffer.get());
+
+	shader.setIVec3("_ClusterGrid", glm::ivec3(mTilesX, mTilesY, mSlices));
+	shader.setInt("_MaxLightsPerCluster", mMaxLightsPerCluster);
+	shader.setVec2("_ClusterTileSize", glm::vec2((float)screenWidth / mTilesX, (float)screenHeight / mTilesY));
+	shader.setFloat("_ClusterNear", clusterNear);
+	// slice = log(depth / near) * scale
+	shader.setFloat("_ClusterSliceScale", mSlices / std::log(mFarDepth / clusterNear));
+}
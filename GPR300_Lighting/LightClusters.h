@@ -0,0 +1,44 @@
+#pragma once
+#include "GL/glew.h"
+
+#include "GlHandle.h"
+#include "EW/Camera.h"
+#include "EW/Shader.h"
+
+/*
+* Froxel grid for clustered forward shading.
+* The view frustum is cut into screen tiles and exponentially spaced depth slices, and a compute pass
+* lists the local lights touching each cluster. The lit shader finds its cluster from the fragment
+* position and view depth and only shades the lights in that list, so the cost per pixel follows the
+* local light density instead of the total light count.
+*/
+class LightClusterGrid
+{
+public:
+	LightClusterGrid(int tilesX, int tilesY, int slices, int maxLightsPerCluster);
+
+	// Lists the lights in storage binding 0 per cluster, bind the light buffer first
+	void build(Camera& camera, int lightCount);
+
+	// Binds the cluster buffers to storage bindings 3 and 4 and sets the lookup uniforms
+	void bindForLighting(Shader& shader, int screenWidth, int screenHeight);
+
+	int getClusterCount() const { return mTilesX * mTilesY * mSlices; }
+	int getMaxLightsPerCluster() const { return mMaxLightsPerCluster; }
+
+	// Where the first slice ends, everything closer shares it
+	float clusterNear = 0.1f;
+	// Lights don't reach further than this, the last slice ends here
+	float clusterFar = 200.0f;
+
+private:
+	Shader mAssignShader;
+	BufferHandle mCountBuffer;
+	BufferHandle mIndexBuffer;
+
+	int mTilesX;
+	int mTilesY;
+	int mSlices;
+	int mMaxLightsPerCluster;
+	float mFarDepth = 200.0f;
+};
@@ -0,0 +1,221 @@
+#include "LocalLights.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+#include "GpuMemory.h"
+#include "Memory.h"
+#include "PointShadows.h"
+
+const float LOCAL_SHADOW_NEAR = 0.05f;
+
+// std430 layouts matching defaultLit.frag
+struct GpuLocalLight
+{
+	// xyz position, w 0 for spot and 1 for point
+	glm::vec4 positionType;
+	// xyz spot direction, w range
+	glm::vec4 directionRange;
+	glm::vec4 colorIntensity;
+	// x cos outer angle, y cos inner angle
+	glm::vec4 spotAngles;
+	// x first shadow view or -1, y view count
+	glm::ivec4 shadow;
+};
+
+struct GpuShadowView
+{
+	glm::mat4 viewProjection;
+	// xy offset and zw size of the tile in atlas uv
+	glm::vec4 atlasRect;
+};
+
+LocalLightSystem::LocalLightSystem(int atlasSize, int minTileSize, int maxTileSize)
+	: mAtlas(atlasSize, minTileSize, maxTileSize)
+{
+	mLightBuffer = genBuffer("LocalLights lights");
+	mViewBuffer = genBuffer("LocalLights shadow views");
+}
+
+void localLightBounds(const LocalLight& light, glm::vec3& center, float& radius)
+{
+	if (light.isPoint)
+	{
+		center = light.position;
+		radius = light.range;
+		return;
+	}
+
+	float baseRadius = light.range * std::tan(glm::radians(std::min(light.outerAngle, 89.0f)));
+	center = light.position + glm::normalize(light.direction) * light.range * 0.5f;
+	radius = std::sqrt(light.range * light.range * 0.25f + baseRadius * baseRadius);
+}
+
+void LocalLightSystem::update(Camera& camera, int screenHeight, const AABB* objectBounds, int objectCount, bool castersMoved)
+{
+	int lightCount = (int)lights.size();
+	mObjectCount = objectCount;
+	mStats = {};
+
+	glm::mat4 cameraProjection = camera.getProjectionMatrix();
+	Frustum cameraFrustum = extractFrustum(cameraProjection * camera.getViewMatrix());
+	glm::vec3 cameraPosition = camera.getPosition();
+
+	// Tile requests from screen coverage, lights the camera can't see ask for nothing
+	mRequests.resize(lightCount);
+	for (int i = 0; i < lightCount; i++)
+	{
+		const LocalLight& light = lights[i];
+		AtlasRequest& request = mRequests[i];
+		request.viewCount = light.isPoint ? 6 : 1;
+		request.desiredSize = 0;
+		request.priority = 0.0f;
+
+		glm::vec3 center;
+		float radius;
+		localLightBounds(light, center, radius);
+
+		AABB sphereBounds;
+		sphereBounds.min = center - glm::vec3(radius);
+		sphereBounds.max = center + glm::vec3(radius);
+		if (!frustumIntersectsAABB(cameraFrustum, sphereBounds))
+			continue;
+
+		mStats.visibleLights++;
+		if (!light.castsShadows)
+			continue;
+
+		// Projected diameter of the bounding sphere in pixels
+		float distance = glm::length(center - cameraPosition);
+		float coverage = (float)screenHeight;
+		if (distance > radius)
+		{
+			coverage = std::min(coverage, radius / std::sqrt(distance * distance - radius * radius) * cameraProjection[1][1] * screenHeight);
+		}
+
+		request.desiredSize = (int)(coverage * shadowQuality * light.importance);
+		request.priority = coverage * light.importance * light.intensity;
+	}
+
+	mAtlas.update(mRequests.data(), lightCount);
+
+	// Shadow views of every light that got tiles
+	mViews.clear();
+	mFirstView.assign(lightCount, -1);
+	mRendered.resize(lightCount);
+	for (int i = 0; i < lightCount; i++)
+	{
+		const LocalLight& light = lights[i];
+		const AtlasAllocation& allocation = mAtlas.getAllocation(i);
+		if (allocation.size == 0)
+			continue;
+
+		RenderedState& rendered = mRendered[i];
+		glm::vec3 direction = glm::normalize(light.direction);
+		bool lightChanged = allocation.changed || castersMoved
+			|| rendered.position != light.position || rendered.range != light.range || rendered.isPoint != light.isPoint
+			|| (!light.isPoint && (rendered.direction != direction || rendered.outerAngle != light.outerAngle));
+		rendered = { light.position, direction, light.range, light.outerAngle, light.isPoint };
+
+		mStats.shadowedLights++;
+		mFirstView[i] = (int)mViews.size();
+		for (int face = 0; face < allocation.viewCount; face++)
+		{
+			LocalShadowView view;
+			if (light.isPoint)
+			{
+				view.view = cubeFaceView(light.position, face);
+				view.projection = glm::perspective(glm::radians(90.0f), 1.0f, LOCAL_SHADOW_NEAR, light.range);
+			}
+			else
+			{
+				glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+				view.view = glm::lookAt(light.position, light.position + direction, up);
+				view.projection = glm::perspective(glm::radians(std::min(light.outerAngle * 2.0f, 170.0f)), 1.0f, LOCAL_SHADOW_NEAR, light.range);
+			}
+			view.viewProjection = view.projection * view.view;
+			view.tile = allocation.tiles[face];
+			view.light = i;
+			view.needsRender = lightChanged;
+			mViews.push_back(view);
+		}
+	}
+
+	// Casters per view
+	mViewCasters.resize(mViews.size() * objectCount);
+	for (int v = 0; v < (int)mViews.size(); v++)
+	{
+		Frustum viewFrustum = extractFrustum(mViews[v].viewProjection);
+		for (int object = 0; object < objectCount; object++)
+		{
+			mViewCasters[v * objectCount + object] = frustumIntersectsAABB(viewFrustum, objectBounds[object]);
+		}
+		mStats.renderedViews += mViews[v].needsRender;
+	}
+
+	uploadGpuData();
+}
+
+void LocalLightSystem::uploadGpuData()
+{
+	int lightCount = (int)lights.size();
+	float atlasSize = (float)mAtlas.getSize();
+
+	FrameVector<GpuLocalLight> gpuLights(std::max(lightCount, 1));
+	for (int i = 0; i < lightCount; i++)
+	{
+		const LocalLight& light = lights[i];
+		GpuLocalLight& gpuLight = gpuLights[i];
+		gpuLight.positionType = glm::vec4(light.position, light.isPoint ? 1.0f : 0.0f);
+		gpuLight.directionRange = glm::vec4(glm::normalize(light.direction), light.range);
+		gpuLight.colorIntensity = glm::vec4(light.color, light.intensity);
+		gpuLight.spotAngles = glm::vec4(std::cos(glm::radians(light.outerAngle)), std::cos(glm::radians(light.innerAngle)), 0.0f, 0.0f);
+		gpuLight.shadow = glm::ivec4(mFirstView[i], mFirstView[i] >= 0 ? mAtlas.getAllocation(i).viewCount : 0, 0, 0);
+	}
+
+	FrameVector<GpuShadowView> gpuViews(std::max((int)mViews.size(), 1));
+	for (int v = 0; v < (int)mViews.size(); v++)
+	{
+		const AtlasTile& tile = mViews[v].tile;
+		gpuViews[v].viewProjection = mViews[v].viewProjection;
+		gpuViews[v].atlasRect = glm::vec4(tile.x, tile.y, tile.size, tile.size) / atlasSize;
+	}
+
+	// Storage only grows, smaller uploads reuse it
+	size_t lightBytes = gpuLights.size() * sizeof(GpuLocalLight);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mLightBuffer.get());
+	if (lightBytes > mLightBufferSize)
+	{
+		glBufferData(GL_SHADER_STORAGE_BUFFER, lightBytes, gpuLights.data(), GL_DYNAMIC_DRAW);
+		mLightBufferSize = lightBytes;
+		gpuTrackResize(GpuResourceType::Buffer, mLightBuffer.get(), lightBytes, GL_NONE);
+	}
+	else
+	{
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, lightBytes, gpuLights.data());
+	}
+
+	size_t viewBytes = gpuViews.size() * sizeof(GpuShadowView);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mViewBuffer.get());
+	if (viewBytes > mViewBufferSize)
+	{
+		glBufferData(GL_SHADER_STORAGE_BUFFER, viewBytes, gpuViews.data(), GL_DYNAMIC_DRAW);
+		mViewBufferSize = viewBytes;
+		gpuTrackResize(GpuResourceType::Buffer, mViewBuffer.get(), viewBytes, GL_NONE);
+	}
+	else
+	{
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, viewBytes, gpuViews.data());
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void LocalLightSystem::bindForLighting(int atlasUnit)
+{
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mLightBuffer.get());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mViewBuffer.get());
+
+	glActiveTexture(GL_TEXTURE0 + atlasUnit);
+	glBindTexture(GL_TEXTURE_2D, mAtlas.getTexture());
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "GL/glew.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "GlHandle.h"
+#include "Bounds.h"
+#include "ShadowAtlas.h"
+#include "EW/Camera.h"
+
+// Spot or point light with a limited range
+struct LocalLight
+{
+	glm::vec3 position;
+	// Spot lights only
+	glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+	glm::vec3 color = glm::vec3(1.0f);
+	float intensity = 1.0f;
+	float range = 8.0f;
+	// Degrees from the axis, spot lights only
+	float innerAngle = 20.0f;
+	float outerAngle = 30.0f;
+	bool isPoint = false;
+
+	bool castsShadows = true;
+	// Scales the shadow tile and how long the shadow is kept when the atlas is full
+	float importance = 1.0f;
+};
+
+// Sphere around everything the light can reach
+void localLightBounds(const LocalLight& light, glm::vec3& center, float& radius);
+
+// One shadow render of a local light, a spot light has one and a point light six
+struct LocalShadowView
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 viewProjection;
+	AtlasTile tile;
+	int light;
+	// The tile's contents are stale and have to be drawn this frame
+	bool needsRender;
+};
+
+struct LocalLightStats
+{
+	int visibleLights;
+	int shadowedLights;
+	int renderedViews;
+	int drawCalls;
+};
+
+/*
+* Local lights and their shadows in a shared atlas.
+* Every frame each shadowed light asks for a tile sized by its screen coverage times its importance,
+* the atlas fits the requests into its budget, and only views whose light, tile or casters changed
+* are re-rendered. Lights and shadow views are uploaded to shader storage buffers for the lit pass.
+*/
+class LocalLightSystem
+{
+public:
+	LocalLightSystem(int atlasSize, int minTileSize, int maxTileSize);
+
+	// Assigns tiles, builds the shadow views and uploads the light data
+	void update(Camera& camera, int screenHeight, const AABB* objectBounds, int objectCount, bool castersMoved);
+
+	int getViewCount() const { return (int)mViews.size(); }
+	const LocalShadowView& getView(int view) const { return mViews[view]; }
+	// One flag per object, nonzero if it may cast into the view
+	const unsigned char* getViewCasters(int view) const { return &mViewCasters[view * mObjectCount]; }
+	void countDraw() { mStats.drawCalls++; }
+
+	// Binds the light and view buffers to storage bindings 0 and 1 and the atlas to the texture unit
+	void bindForLighting(int atlasUnit);
+
+	ShadowAtlas& getAtlas() { return mAtlas; }
+	const LocalLightStats& getStats() const { return mStats; }
+
+	std::vector<LocalLight> lights;
+
+	// Shadow tile texels per pixel of the light's screen coverage
+	float shadowQuality = 1.0f;
+
+private:
+	// Light state the current tile contents were rendered with
+	struct RenderedState
+	{
+		glm::vec3 position;
+		glm::vec3 direction;
+		float range;
+		float outerAngle;
+		bool isPoint;
+	};
+
+	void uploadGpuData();
+
+	ShadowAtlas mAtlas;
+	BufferHandle mLightBuffer;
+	BufferHandle mViewBuffer;
+	size_t mLightBufferSize = 0;
+	size_t mViewBufferSize = 0;
+
+	std::vector<LocalShadowView> mViews;
+	std::vector<unsigned char> mViewCasters;
+	std::vector<AtlasRequest> mRequests;
+	std::vector<int> mFirstView;
+	std::vector<RenderedState> mRendered;
+	int mObjectCount = 0;
+
+	LocalLightStats mStats = {};
+};
@@ -0,0 +1,65 @@
+#include "MaterialTable.h"
+
+#include "GpuMemory.h"
+
+// std430 layout matching defaultLit.frag, gbuffer.frag and vtFeedback.frag
+struct GpuMaterial
+{
+	// rgb color, a ambientK
+	glm::vec4 colorAmbient;
+	// diffuseK, specularK, shininess, normal intensity
+	glm::vec4 params;
+	// x albedo layer, y normal layer, z virtual albedo
+	glm::ivec4 layers;
+};
+
+MaterialTable::MaterialTable()
+{
+	mBuffer = genBuffer("MaterialTable");
+}
+
+int MaterialTable::add(const char* name, const Material& material)
+{
+	mMaterials.push_back(material);
+	mNames.push_back(name);
+	mDirty = true;
+	return (int)mMaterials.size() - 1;
+}
+
+Material& MaterialTable::edit(int index)
+{
+	mDirty = true;
+	return mMaterials[index];
+}
+
+void MaterialTable::bind(int binding)
+{
+	if (mDirty)
+	{
+		std::vector<GpuMaterial> packed(mMaterials.size());
+		for (size_t i = 0; i < mMaterials.size(); i++)
+		{
+			const Material& material = mMaterials[i];
+			packed[i].colorAmbient = glm::vec4(material.color, material.ambientK);
+			packed[i].params = glm::vec4(material.diffuseK, material.specularK, material.shininess, material.normalIntensity);
+			packed[i].layers = glm::ivec4(material.albedoLayer, material.normalLayer, material.virtualAlbedo ? 1 : 0, 0);
+		}
+
+		size_t bytes = packed.size() * sizeof(GpuMaterial);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBuffer.get());
+		if (bytes > mBufferSize)
+		{
+			glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, packed.data(), GL_DYNAMIC_DRAW);
+			gpuTrackResize(GpuResourceType::Buffer, mBuffer.get(), bytes, GL_NONE);
+			mBufferSize = bytes;
+		}
+		else if (bytes > 0)
+		{
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, packed.data());
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		mDirty = false;
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, mBuffer.get());
+}
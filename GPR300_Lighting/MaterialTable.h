@@ -0,0 +1,53 @@
+#pragma once
+#include "GL/glew.h"
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "GlHandle.h"
+
+struct Material
+{
+	glm::vec3 color = glm::vec3(1.0f);
+	float ambientK = 1.0f, diffuseK = 1.0f, specularK = 1.0f; // (0-1 range)
+	float shininess = 1; // (1-512 range)
+	float normalIntensity = 1.0f;
+
+	// Layers of the albedo and normal texture arrays
+	int albedoLayer = 0;
+	int normalLayer = 0;
+	// Albedo comes from the virtual texture instead of the albedo array
+	bool virtualAlbedo = false;
+};
+
+/*
+* Every material packed into one shader storage buffer.
+* Draws only carry a material index, _MaterialIndex or the visibility object table, so adding
+* materials doesn't add uniform calls. Edits are uploaded once before the frame's first draw.
+*/
+class MaterialTable
+{
+public:
+	MaterialTable();
+
+	// Returns the index shaders look the material up with
+	int add(const char* name, const Material& material);
+
+	const Material& get(int index) const { return mMaterials[index]; }
+	// Marks the table for upload, use it for edits
+	Material& edit(int index);
+
+	int getCount() const { return (int)mMaterials.size(); }
+	const char* getName(int index) const { return mNames[index].c_str(); }
+
+	// Uploads pending edits and binds the table to the storage binding
+	void bind(int binding);
+
+private:
+	BufferHandle mBuffer;
+	size_t mBufferSize = 0;
+	bool mDirty = false;
+
+	std::vector<Material> mMaterials;
+	std::vector<std::string> mNames;
+};
@@ -0,0 +1,182 @@
+#include "Memory.h"
+
+#include <cstdlib>
+#include <mutex>
+
+// Default size of a thread's frame arena, regrown to the observed peak when exceeded
+const size_t FRAME_ARENA_CAPACITY = 1024 * 1024;
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+LinearArena::LinearArena(size_t capacity)
+{
+	mCapacity = capacity;
+	mBuffer = static_cast<unsigned char*>(::operator new(mCapacity));
+}
+
+LinearArena::~LinearArena()
+{
+	// Drop the buffer first so reset only frees the spilled blocks
+	::operator delete(mBuffer);
+	mBuffer = nullptr;
+	reset();
+}
+
+void* LinearArena::allocate(size_t size, size_t alignment)
+{
+	// Align the absolute address, the buffer itself is only max_align_t aligned
+	uintptr_t base = reinterpret_cast<uintptr_t>(mBuffer);
+	size_t start = alignUp(base + mOffset, alignment) - base;
+
+	if (start + size <= mCapacity)
+	{
+		mOffset = start + size;
+		if (mOffset > mPeak)
+			mPeak = mOffset;
+		return mBuffer + start;
+	}
+
+	// Out of space this frame, hand out heap memory and remember to grow on reset
+	size_t blockAlignment = alignment < alignof(std::max_align_t) ? alignof(std::max_align_t) : alignment;
+	void* block = ::operator new(size, std::align_val_t(blockAlignment));
+	mOverflow.push_back({ block, blockAlignment });
+	mOverflowBytes += size + alignment;
+	mOverflowCount++;
+	return block;
+}
+
+void LinearArena::reset()
+{
+	for (const OverflowBlock& block : mOverflow)
+	{
+		::operator delete(block.ptr, std::align_val_t(block.alignment));
+	}
+
+	// Grow so the same workload fits next frame without spilling
+	if (mOverflowBytes > 0 && mBuffer != nullptr)
+	{
+		::operator delete(mBuffer);
+		mCapacity = alignUp(mPeak + mOverflowBytes, 4096);
+		mBuffer = static_cast<unsigned char*>(::operator new(mCapacity));
+	}
+
+	mOverflow.clear();
+	mOverflowBytes = 0;
+	mOffset = 0;
+}
+
+PoolAllocator::PoolAllocator(size_t blockSize, size_t blocksPerChunk)
+{
+	mBlockSize = alignUp(blockSize < sizeof(FreeBlock) ? sizeof(FreeBlock) : blockSize, alignof(FreeBlock));
+	mBlocksPerChunk = blocksPerChunk;
+}
+
+PoolAllocator::~PoolAllocator()
+{
+	for (void* chunk : mChunks)
+	{
+		::operator delete(chunk);
+	}
+}
+
+void PoolAllocator::addChunk()
+{
+	unsigned char* chunk = static_cast<unsigned char*>(::operator new(mBlockSize * mBlocksPerChunk));
+	mChunks.push_back(chunk);
+
+	// Thread the new blocks onto the free list
+	for (size_t i = 0; i < mBlocksPerChunk; i++)
+	{
+		FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * mBlockSize);
+		block->next = mFreeList;
+		mFreeList = block;
+	}
+}
+
+void* PoolAllocator::allocate()
+{
+	if (mFreeList == nullptr)
+		addChunk();
+
+	FreeBlock* block = mFreeList;
+	mFreeList = block->next;
+	mBlocksInUse++;
+	return block;
+}
+
+void PoolAllocator::deallocate(void* block)
+{
+	if (block == nullptr)
+		return;
+
+	FreeBlock* freed = static_cast<FreeBlock*>(block);
+	freed->next = mFreeList;
+	mFreeList = freed;
+	mBlocksInUse--;
+}
+
+// Every thread's arena, so the main thread can reset them all at frame end
+static std::mutex frameArenaMutex;
+static std::vector<LinearArena*> frameArenas;
+
+namespace
+{
+	// Owns a thread's arena and unregisters it when the thread exits
+	struct ThreadFrameArena
+	{
+		LinearArena arena;
+
+		ThreadFrameArena() : arena(FRAME_ARENA_CAPACITY)
+		{
+			std::lock_guard<std::mutex> lock(frameArenaMutex);
+			frameArenas.push_back(&arena);
+		}
+
+		~ThreadFrameArena()
+		{
+			std::lock_guard<std::mutex> lock(frameArenaMutex);
+			for (size_t i = 0; i < frameArenas.size(); i++)
+			{
+				if (frameArenas[i] == &arena)
+				{
+					frameArenas[i] = frameArenas.back();
+					frameArenas.pop_back();
+					break;
+				}
+			}
+		}
+	};
+}
+
+LinearArena& getFrameArena()
+{
+	thread_local ThreadFrameArena threadArena;
+	return threadArena.arena;
+}
+
+void resetFrameArenas()
+{
+	std::lock_guard<std::mutex> lock(frameArenaMutex);
+	for (LinearArena* arena : frameArenas)
+	{
+		arena->reset();
+	}
+}
+
+FrameArenaStats getFrameArenaStats()
+{
+	FrameArenaStats stats = {};
+
+	std::lock_guard<std::mutex> lock(frameArenaMutex);
+	stats.arenaCount = (int)frameArenas.size();
+	for (LinearArena* arena : frameArenas)
+	{
+		stats.capacity += arena->getCapacity();
+		stats.peak += arena->getPeak();
+		stats.overflowCount += arena->getOverflowCount();
+	}
+	return stats;
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+/*
+* Bump allocator over one contiguous block.
+* Individual frees are no-ops, everything is released at once by reset().
+* If a frame asks for more than the block holds, the extra requests spill to the heap
+* and the block is regrown to the peak size on the next reset, so after a few warm-up
+* frames a steady-state frame never touches the general-purpose heap.
+*/
+class LinearArena
+{
+public:
+	LinearArena(size_t capacity);
+	~LinearArena();
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+	void reset();
+
+	size_t getCapacity() const { return mCapacity; }
+	size_t getUsed() const { return mOffset; }
+	size_t getPeak() const { return mPeak; }
+	size_t getOverflowCount() const { return mOverflowCount; }
+
+private:
+	unsigned char* mBuffer;
+	size_t mCapacity;
+	size_t mOffset = 0;
+	size_t mPeak = 0;
+
+	// Heap blocks handed out after the buffer ran out, freed on reset
+	struct OverflowBlock { void* ptr; size_t alignment; };
+	std::vector<OverflowBlock> mOverflow;
+	size_t mOverflowBytes = 0;
+	size_t mOverflowCount = 0;
+};
+
+/*
+* Fixed-size block allocator with an intrusive free list.
+* Memory is carved out of chunks of blocksPerChunk blocks, a new chunk is only
+* allocated when every block is in use.
+*/
+class PoolAllocator
+{
+public:
+	PoolAllocator(size_t blockSize, size_t blocksPerChunk = 256);
+	~PoolAllocator();
+
+	PoolAllocator(const PoolAllocator&) = delete;
+	PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+	void* allocate();
+	void deallocate(void* block);
+
+	size_t getBlockSize() const { return mBlockSize; }
+	size_t getBlocksInUse() const { return mBlocksInUse; }
+	size_t getChunkCount() const { return mChunks.size(); }
+
+private:
+	void addChunk();
+
+	struct FreeBlock { FreeBlock* next; };
+
+	size_t mBlockSize;
+	size_t mBlocksPerChunk;
+	size_t mBlocksInUse = 0;
+	FreeBlock* mFreeList = nullptr;
+	std::vector<void*> mChunks;
+};
+
+// Arena owned by the calling thread, created on first use
+LinearArena& getFrameArena();
+
+// Resets the frame arena of every thread that has one.
+// Call once at the end of a frame while no worker is using its arena.
+void resetFrameArenas();
+
+// Combined statistics over every thread's frame arena
+struct FrameArenaStats
+{
+	int arenaCount;
+	size_t capacity;
+	size_t peak;
+	size_t overflowCount;
+};
+FrameArenaStats getFrameArenaStats();
+
+// Per-thread pool for blocks of the given size class
+template<size_t Size, size_t Alignment>
+PoolAllocator& getThreadPool()
+{
+	static_assert(Alignment <= alignof(std::max_align_t), "Pool blocks are only max_align_t aligned");
+	constexpr size_t blockSize = Size < sizeof(void*) ? sizeof(void*) : Size;
+	thread_local PoolAllocator pool((blockSize + Alignment - 1) / Alignment * Alignment);
+	return pool;
+}
+
+/*
+* STL allocator that takes its memory from the current thread's frame arena.
+* Containers using it must not outlive the frame they were filled in.
+*/
+template<typename T>
+class FrameAllocator
+{
+public:
+	typedef T value_type;
+
+	FrameAllocator() = default;
+	template<typename U>
+	FrameAllocator(const FrameAllocator<U>&) {}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(getFrameArena().allocate(count * sizeof(T), alignof(T)));
+	}
+
+	// Released in bulk by resetFrameArenas
+	void deallocate(T*, size_t) {}
+
+	template<typename U>
+	bool operator==(const FrameAllocator<U>&) const { return true; }
+	template<typename U>
+	bool operator!=(const FrameAllocator<U>&) const { return false; }
+};
+
+/*
+* STL allocator for node based containers (list, map, set).
+* Single element requests come from a per-thread pool sized for the node type,
+* anything bigger goes to the regular heap.
+* Pools are per thread, so nodes must be freed on the thread that created them.
+*/
+template<typename T>
+class PoolStlAllocator
+{
+public:
+	typedef T value_type;
+
+	PoolStlAllocator() = default;
+	template<typename U>
+	PoolStlAllocator(const PoolStlAllocator<U>&) {}
+
+	T* allocate(size_t count)
+	{
+		if (count == 1)
+		{
+			return static_cast<T*>(getThreadPool<sizeof(T), alignof(T)>().allocate());
+		}
+		return static_cast<T*>(::operator new(count * sizeof(T)));
+	}
+
+	void deallocate(T* ptr, size_t count)
+	{
+		if (count == 1)
+		{
+			getThreadPool<sizeof(T), alignof(T)>().deallocate(ptr);
+			return;
+		}
+		::operator delete(ptr);
+	}
+
+	template<typename U>
+	bool operator==(const PoolStlAllocator<U>&) const { return true; }
+	template<typename U>
+	bool operator!=(const PoolStlAllocator<U>&) const { return false; }
+};
+
+// Vector living in the frame arena, for per-frame render lists and culling results
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
@@ -0,0 +1,150 @@
+#include "PointShadows.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <stdio.h>
+
+#include "GpuMemory.h"
+
+const float POINT_SHADOW_NEAR = 0.05f;
+
+// Face order of GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, with the cube map's up vectors
+const glm::vec3 CUBE_FACE_DIRECTIONS[6] =
+{
+	glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+	glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+};
+const glm::vec3 CUBE_FACE_UPS[6] =
+{
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+};
+
+glm::mat4 cubeFaceView(glm::vec3 position, int face)
+{
+	return glm::lookAt(position, position + CUBE_FACE_DIRECTIONS[face], CUBE_FACE_UPS[face]);
+}
+
+PointShadowMap::PointShadowMap(int resolution)
+	: mShader("shaders/pointShadow.vert", "shaders/pointShadow.frag")
+{
+	mResolution = resolution;
+	mSupported = GLEW_ARB_shader_viewport_layer_array;
+	if (!mSupported)
+	{
+		printf("ARB_shader_viewport_layer_array is not supported, point light shadows are disabled.\n");
+	}
+
+	mCubeMap = genTexture("PointShadowMap");
+	glBindTexture(GL_TEXTURE_CUBE_MAP, mCubeMap.get());
+	glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT32F, resolution, resolution);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	gpuTrackResize(GpuResourceType::Texture, mCubeMap.get(), gpuTextureBytes(GL_DEPTH_COMPONENT32F, resolution, resolution, 6), GL_DEPTH_COMPONENT32F);
+
+	// Attaching the whole cube makes the framebuffer layered, gl_Layer picks the face
+	mFBO = genFramebuffer("PointShadowMap");
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mCubeMap.get(), 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Frame buffer is incomplete.\n");
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PointShadowMap::update(glm::vec3 lightPosition, float farPlane, const AABB* objectBounds, int objectCount)
+{
+	if (lightPosition != mPosition || farPlane != mFarPlane)
+	{
+		mValid = false;
+	}
+	mPosition = lightPosition;
+	mFarPlane = farPlane;
+
+	glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, POINT_SHADOW_NEAR, farPlane);
+	Frustum faceFrustums[6];
+	for (int face = 0; face < 6; face++)
+	{
+		mFaceViewProj[face] = projection * cubeFaceView(lightPosition, face);
+		faceFrustums[face] = extractFrustum(mFaceViewProj[face]);
+	}
+
+	mObjectFaces.resize(objectCount * 6);
+	mObjectFaceCounts.resize(objectCount);
+
+	mStats.activeFaces = 0;
+	bool faceActive[6] = {};
+	for (int object = 0; object < objectCount; object++)
+	{
+		int count = 0;
+		for (int face = 0; face < 6; face++)
+		{
+			if (frustumIntersectsAABB(faceFrustums[face], objectBounds[object]))
+			{
+				mObjectFaces[object * 6 + count++] = face;
+				faceActive[face] = true;
+			}
+		}
+		mObjectFaceCounts[object] = count;
+	}
+
+	for (int face = 0; face < 6; face++)
+	{
+		mStats.activeFaces += faceActive[face];
+	}
+}
+
+void PointShadowMap::begin()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+	glViewport(0, 0, mResolution, mResolution);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	mShader.use();
+	mShader.setMat4Array("_FaceViewProj", 6, mFaceViewProj);
+	mShader.setVec3("_LightPosition", mPosition);
+	mShader.setFloat("_FarPlane", mFarPlane);
+
+	mStats.draws = 0;
+	mStats.instances = 0;
+}
+
+int PointShadowMap::prepareObject(int object, const glm::mat4& model)
+{
+	int count = mObjectFaceCounts[object];
+	if (count == 0)
+		return 0;
+
+	mShader.setMat4("_Model", model);
+	mShader.setIntArray("_FaceIndices", count, &mObjectFaces[object * 6]);
+
+	mStats.draws++;
+	mStats.instances += count;
+	return count;
+}
+
+void PointShadowMap::end()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	mValid = true;
+}
+
+void PointShadowMap::endFrame(bool rendered)
+{
+	if (!rendered)
+	{
+		mStats.skippedFrames++;
+	}
+}
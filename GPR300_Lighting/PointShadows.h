@@ -0,0 +1,74 @@
+#pragma once
+#include "GL/glew.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "GlHandle.h"
+#include "Bounds.h"
+#include "EW/Shader.h"
+
+// View matrix of a cube map face, faces are ordered like GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+glm::mat4 cubeFaceView(glm::vec3 position, int face);
+
+struct PointShadowStats
+{
+	// Faces that had at least one caster in the last render
+	int activeFaces;
+	// Objects drawn and cube faces written across them
+	int draws;
+	int instances;
+	// Renders skipped because neither the light nor the scene changed
+	int skippedFrames;
+};
+
+/*
+* Omnidirectional shadow map for a point light.
+* All six faces are written in one layered pass: each object is drawn once, instanced once per face
+* it intersects, and the vertex shader routes every instance to its face with gl_Layer.
+* The cube stores linear distance to the light divided by the far plane.
+*/
+class PointShadowMap
+{
+public:
+	explicit PointShadowMap(int resolution);
+
+	// Layered output from the vertex shader needs ARB_shader_viewport_layer_array
+	bool isSupported() const { return mSupported; }
+
+	// Recomputes the face matrices and which faces each object can cast into
+	void update(glm::vec3 lightPosition, float farPlane, const AABB* objectBounds, int objectCount);
+	// Forces a redraw after casters moved, or while the pass is skipped and moves go unseen
+	void invalidate() { mValid = false; }
+	bool needsRedraw() const { return !mValid; }
+
+	// Binds and clears the cube and sets up the shader
+	void begin();
+	// Sets the per-object uniforms, returns how many instances to draw (0 to skip the object)
+	int prepareObject(int object, const glm::mat4& model);
+	void end();
+
+	// Call once per frame after the point light pass to update the counters
+	void endFrame(bool rendered);
+
+	unsigned int getTexture() const { return mCubeMap.get(); }
+	float getFarPlane() const { return mFarPlane; }
+	const PointShadowStats& getStats() const { return mStats; }
+
+private:
+	TextureHandle mCubeMap;
+	FramebufferHandle mFBO;
+	Shader mShader;
+	bool mSupported;
+
+	int mResolution;
+	glm::vec3 mPosition = glm::vec3(0.0f);
+	float mFarPlane = 0.0f;
+	glm::mat4 mFaceViewProj[6];
+	bool mValid = false;
+
+	// Six face slots per object, the first mObjectFaceCounts[object] are used
+	std::vector<int> mObjectFaces;
+	std::vector<int> mObjectFaceCounts;
+
+	PointShadowStats mStats = {};
+};
@@ -0,0 +1,173 @@
+#include "RenderTargets.h"
+
+#include <stdio.h>
+
+FrameBuffer::FrameBuffer(int colorBuffers, int width, int height)
+{
+	mWidth = width;
+	mHeight = height;
+
+	// Create frame buffer object
+	mFBO = genFramebuffer("FrameBuffer");
+
+	// Bind frame buffer to GL_FRAMEBUFFER target
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+
+	// Stores attachments to be passed into glDrawBuffers
+	std::vector<GLenum> attachments(colorBuffers);
+
+	// Create textures for each color buffer
+	mTextures.reserve(colorBuffers);
+	for (int i = 0; i < colorBuffers; i++)
+	{
+		mTextures.push_back(genTexture("FrameBuffer color"));
+		GLuint texture = mTextures[i].get();
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		gpuTrackResize(GpuResourceType::Texture, texture, gpuTextureBytes(GL_RGBA8, width, height), GL_RGBA8);
+
+		// Attach the texture to the corresponding frame buffer slot
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, texture, 0);
+
+		// Add the attachment to the attachment array
+		attachments[i] = GL_COLOR_ATTACHMENT0 + i;
+	}
+
+	// Create render buffer object
+	mRBO = genRenderbuffer("FrameBuffer depth");
+	glBindRenderbuffer(GL_RENDERBUFFER, mRBO.get());
+
+	// Allocate space for the depth component
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	gpuTrackResize(GpuResourceType::Renderbuffer, mRBO.get(), gpuTextureBytes(GL_DEPTH_COMPONENT32F, width, height), GL_DEPTH_COMPONENT32F);
+
+	// Attach render buffer object to the frame buffer
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, mRBO.get());
+
+	// Specify how many attachments are being used in drawing
+	glDrawBuffers(colorBuffers, attachments.data());
+
+	// Check for completeness
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Frame buffer is incomplete.\n");
+	}
+
+	else
+	{
+		printf("Successfully created frame buffer.\n");
+	}
+
+	// Unbind framebuffer
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+FrameBuffer::FrameBuffer(const std::vector<GLenum>& colorFormats, int width, int height)
+{
+	mWidth = width;
+	mHeight = height;
+
+	mFBO = genFramebuffer("FrameBuffer");
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+
+	int colorBuffers = (int)colorFormats.size();
+	std::vector<GLenum> attachments(colorBuffers);
+
+	mTextures.reserve(colorBuffers);
+	for (int i = 0; i < colorBuffers; i++)
+	{
+		mTextures.push_back(genTexture("FrameBuffer color"));
+		GLuint texture = mTextures[i].get();
+
+		// Read with texelFetch, one texel per pixel
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, colorFormats[i], width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		gpuTrackResize(GpuResourceType::Texture, texture, gpuTextureBytes(colorFormats[i], width, height), colorFormats[i]);
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, texture, 0);
+		attachments[i] = GL_COLOR_ATTACHMENT0 + i;
+	}
+
+	mDepthTexture = genTexture("FrameBuffer depth");
+	glBindTexture(GL_TEXTURE_2D, mDepthTexture.get());
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gpuTrackResize(GpuResourceType::Texture, mDepthTexture.get(), gpuTextureBytes(GL_DEPTH24_STENCIL8, width, height), GL_DEPTH24_STENCIL8);
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, mDepthTexture.get(), 0);
+
+	glDrawBuffers(colorBuffers, attachments.data());
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Frame buffer is incomplete.\n");
+	}
+
+	else
+	{
+		printf("Successfully created frame buffer.\n");
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShadowBuffer::ShadowBuffer(int width, int height, int layers)
+{
+	mWidth = width;
+	mHeight = height;
+	mLayers = layers;
+
+	mFBO = genFramebuffer("ShadowBuffer");
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+
+	mDepthTexture = genTexture("ShadowBuffer depth");
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mDepthTexture.get());
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, mWidth, mHeight, mLayers);
+
+	// Depth comparison in the sampler, linear filtering turns each fetch into a 2x2 PCF
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// Everything outside the map compares as lit
+	float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	gpuTrackResize(GpuResourceType::Texture, mDepthTexture.get(), gpuTextureBytes(GL_DEPTH_COMPONENT32F, mWidth, mHeight, mLayers), GL_DEPTH_COMPONENT32F);
+
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepthTexture.get(), 0, 0);
+
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Frame buffer is incomplete.\n");
+	}
+
+	else
+	{
+		printf("Successfully created frame buffer.\n");
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowBuffer::bindLayer(int layer)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepthTexture.get(), 0, layer);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "GL/glew.h"
+#include <vector>
+
+#include "GlHandle.h"
+
+// Going fullscreen messes this up because it isn't being properly
+// resized to fit the new dimensions of the fullscreen viewport. (I think)
+class FrameBuffer
+{
+public:
+	/*
+	* Init frame buffer
+	* Limitation of this implementation is that it messes with glSetActiveTexture
+	* by overwriting the active texture with the texture being created here.
+	*/
+	FrameBuffer(int colorBuffers, int width, int height);
+
+	/*
+	* Color attachments with the given internal formats, nearest filtered,
+	* and a depth-stencil texture instead of a renderbuffer so the depth can be sampled.
+	*/
+	FrameBuffer(const std::vector<GLenum>& colorFormats, int width, int height);
+
+	// Move-only, the GL objects are released through the deferred deletion queue
+	FrameBuffer(FrameBuffer&&) = default;
+	FrameBuffer& operator=(FrameBuffer&&) = default;
+
+	// Getter for the current frame buffer
+	unsigned int getFBO() const { return mFBO.get(); }
+
+	// Gett for the buffer's texture
+	unsigned int getTexture(int texNum) const { return mTextures[texNum].get(); }
+
+	// 0 unless the buffer was created with a sampled depth-stencil texture
+	unsigned int getDepthTexture() const { return mDepthTexture.get(); }
+	int getColorCount() const { return (int)mTextures.size(); }
+	int getWidth() const { return mWidth; }
+	int getHeight() const { return mHeight; }
+
+private:
+	FramebufferHandle mFBO;
+	std::vector<TextureHandle> mTextures;
+	RenderbufferHandle mRBO;
+	TextureHandle mDepthTexture;
+
+	int mWidth, mHeight;
+};
+
+// Depth-only target backed by a 2D texture array, one layer per shadow view
+class ShadowBuffer
+{
+public:
+	ShadowBuffer(int width, int height, int layers = 1);
+
+	ShadowBuffer(ShadowBuffer&&) = default;
+	ShadowBuffer& operator=(ShadowBuffer&&) = default;
+
+	// Binds the FBO with the given layer as its depth attachment
+	void bindLayer(int layer);
+
+	unsigned int getFBO() const { return mFBO.get(); }
+	unsigned int getTexture() const { return mDepthTexture.get(); }
+	int getWidth() const { return mWidth; }
+	int getHeight() const { return mHeight; }
+	int getLayerCount() const { return mLayers; }
+
+private:
+	FramebufferHandle mFBO;
+	TextureHandle mDepthTexture;
+
+	int mWidth, mHeight;
+	int mLayers;
+};
@@ -0,0 +1,140 @@
+#include "ResidencyManager.h"
+
+static const char* SET_NAMES[(int)TextureSet::Count] = { "Albedo array", "Normal array" };
+
+ResidencyManager::ResidencyManager(size_t budget)
+{
+	mBudget = budget;
+}
+
+void ResidencyManager::addMesh(const char* name, ew::Mesh* mesh)
+{
+	Entry entry = { name, ResidentKind::Mesh, mesh, TextureSet::Count, 0, mFrame, false };
+	measure(entry);
+	mEntries.push_back(entry);
+}
+
+void ResidencyManager::addTextures(TextureManager* textures)
+{
+	mTextures = textures;
+	for (int i = 0; i < (int)TextureSet::Count; i++)
+	{
+		Entry entry = { SET_NAMES[i], ResidentKind::Texture, nullptr, (TextureSet)i, 0, mFrame, false };
+		measure(entry);
+		mEntries.push_back(entry);
+	}
+}
+
+size_t ResidencyManager::getResidentBytes() const
+{
+	size_t bytes = 0;
+	for (const Entry& entry : mEntries)
+	{
+		bytes += entry.bytes;
+	}
+	return bytes;
+}
+
+void ResidencyManager::measure(Entry& entry)
+{
+	if (entry.kind == ResidentKind::Mesh)
+	{
+		entry.bytes = entry.mesh->isResident() ? entry.mesh->getBytes() : 0;
+	}
+	else
+	{
+		entry.bytes = mTextures->getBytes(entry.set);
+	}
+}
+
+bool ResidencyManager::evictOne()
+{
+	Entry* victim = nullptr;
+	for (Entry& entry : mEntries)
+	{
+		// Meshes drawn this frame would only upload again on the next one
+		bool canFree = entry.kind == ResidentKind::Mesh
+			? entry.mesh->isResident() && entry.lastUsedFrame < mFrame
+			: mTextures->canDropLevel(entry.set);
+		if (!canFree)
+			continue;
+
+		if (victim == nullptr || entry.lastUsedFrame < victim->lastUsedFrame
+			|| (entry.lastUsedFrame == victim->lastUsedFrame && entry.bytes > victim->bytes))
+		{
+			victim = &entry;
+		}
+	}
+
+	if (victim == nullptr)
+		return false;
+
+	if (victim->kind == ResidentKind::Mesh)
+	{
+		victim->mesh->evict();
+	}
+	else
+	{
+		mTextures->dropTopLevel(victim->set);
+	}
+	victim->reduced = true;
+	mEvictions++;
+	measure(*victim);
+	return true;
+}
+
+void ResidencyManager::restoreOne()
+{
+	Entry* candidate = nullptr;
+	for (Entry& entry : mEntries)
+	{
+		if (entry.kind == ResidentKind::Texture && entry.reduced
+			&& (candidate == nullptr || entry.lastUsedFrame > candidate->lastUsedFrame))
+		{
+			candidate = &entry;
+		}
+	}
+
+	// Only restores what stays under budget, so a restored level is never dropped again on the next frame
+	if (candidate == nullptr || getResidentBytes() + mTextures->getRestoreBytes(candidate->set) > mBudget)
+		return;
+
+	mTextures->restoreTopLevel(candidate->set);
+	candidate->reduced = mTextures->getDroppedLevels(candidate->set) > 0;
+	mReloads++;
+	measure(*candidate);
+}
+
+void ResidencyManager::update()
+{
+	mFrame++;
+
+	bool texturesUsed = mTextures && mTextures->takeUsed();
+	for (Entry& entry : mEntries)
+	{
+		bool used = entry.kind == ResidentKind::Mesh ? entry.mesh->takeUsed() : texturesUsed;
+		if (used)
+		{
+			entry.lastUsedFrame = mFrame;
+		}
+
+		// Drawing an evicted mesh uploaded it again
+		if (entry.kind == ResidentKind::Mesh && entry.reduced && entry.mesh->isResident())
+		{
+			entry.reduced = false;
+			mReloads++;
+		}
+		measure(entry);
+	}
+
+	if (getResidentBytes() > mBudget)
+	{
+		while (getResidentBytes() > mBudget && evictOne())
+		{
+		}
+	}
+	else
+	{
+		restoreOne();
+	}
+}
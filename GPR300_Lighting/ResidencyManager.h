@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+
+#include "TextureManager.h"
+#include "EW/Mesh.h"
+
+enum class ResidentKind
+{
+	Mesh,
+	Texture
+};
+
+/*
+* Keeps the meshes and texture arrays it manages under a memory budget.
+* Every update records which resources were used since the last one. While the managed bytes are
+* over budget the least recently used resource gives memory back, the larger one on a tie: a mesh
+* that wasn't drawn this frame drops its buffers and a texture array drops its finest mip level.
+* Evicted meshes upload again on their next draw. Dropped levels come back one per frame once
+* they fit in the budget again, and stream in like freshly loaded ones.
+*/
+class ResidencyManager
+{
+public:
+	struct Entry
+	{
+		const char* name;
+		ResidentKind kind;
+		ew::Mesh* mesh;
+		TextureSet set;
+		size_t bytes;
+		int lastUsedFrame;
+		// An evicted mesh or an array with dropped levels
+		bool reduced;
+	};
+
+	explicit ResidencyManager(size_t budget);
+
+	// The mesh has to outlive the manager
+	void addMesh(const char* name, ew::Mesh* mesh);
+	// Adds every texture set of the manager
+	void addTextures(TextureManager* textures);
+
+	// Call once per frame after drawing
+	void update();
+
+	void setBudget(size_t budget) { mBudget = budget; }
+	size_t getBudget() const { return mBudget; }
+	size_t getResidentBytes() const;
+	int getEntryCount() const { return (int)mEntries.size(); }
+	const Entry& getEntry(int index) const { return mEntries[index]; }
+	int getFrame() const { return mFrame; }
+	int getEvictionCount() const { return mEvictions; }
+	int getReloadCount() const { return mReloads; }
+
+private:
+	void measure(Entry& entry);
+	// Frees memory from the least recently used resource that has any to give, false if none has
+	bool evictOne();
+	// Brings back one level of the most recently used reduced array if it fits
+	void restoreOne();
+
+	std::vector<Entry> mEntries;
+	TextureManager* mTextures = nullptr;
+	size_t mBudget;
+	int mFrame = 0;
+	int mEvictions = 0;
+	int mReloads = 0;
+};
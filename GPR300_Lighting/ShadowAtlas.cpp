@@ -0,0 +1,380 @@
+#include "ShadowAtlas.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#include "GpuMemory.h"
+#include "Memory.h"
+
+QuadtreeAllocator::QuadtreeAllocator(int size, int minTileSize)
+{
+	mSize = size;
+	mLevelCount = 1;
+	while ((size >> (mLevelCount - 1)) > minTileSize)
+	{
+		mLevelCount++;
+	}
+
+	int nodeCount = 0;
+	for (int level = 0; level < mLevelCount; level++)
+	{
+		mLevelOffsets.push_back(nodeCount);
+		nodeCount += (1 << level) * (1 << level);
+	}
+	mNodes.assign(nodeCount, NodeState::Free);
+}
+
+int QuadtreeAllocator::findFree(int level, int x, int y, int targetLevel) const
+{
+	NodeState state = mNodes[nodeIndex(level, x, y)];
+	if (state == NodeState::Allocated)
+		return -1;
+
+	if (level == targetLevel)
+		return state == NodeState::Free ? nodeIndex(level, x, y) : -1;
+
+	// Everything below a free node is free, take its first descendant
+	if (state == NodeState::Free)
+	{
+		int shift = targetLevel - level;
+		return nodeIndex(targetLevel, x << shift, y << shift);
+	}
+
+	// Fill partially used children before breaking up free ones
+	for (NodeState pass : { NodeState::Split, NodeState::Free })
+	{
+		for (int child = 0; child < 4; child++)
+		{
+			int childX = x * 2 + (child & 1);
+			int childY = y * 2 + (child >> 1);
+			if (mNodes[nodeIndex(level + 1, childX, childY)] != pass)
+				continue;
+
+			int found = findFree(level + 1, childX, childY, targetLevel);
+			if (found >= 0)
+				return found;
+		}
+	}
+	return -1;
+}
+
+AtlasTile QuadtreeAllocator::allocate(int tileSize)
+{
+	AtlasTile tile;
+	tile.size = tileSize;
+
+	int targetLevel = 0;
+	while ((mSize >> targetLevel) > tileSize && targetLevel < mLevelCount - 1)
+	{
+		targetLevel++;
+	}
+	if ((mSize >> targetLevel) != tileSize)
+		return tile;
+
+	int node = findFree(0, 0, 0, targetLevel);
+	if (node < 0)
+		return tile;
+
+	int cell = node - mLevelOffsets[targetLevel];
+	int x = cell % (1 << targetLevel);
+	int y = cell / (1 << targetLevel);
+	mNodes[node] = NodeState::Allocated;
+
+	// Free ancestors become split, their other children are already free
+	for (int level = targetLevel - 1; level >= 0; level--)
+	{
+		int shift = targetLevel - level;
+		mNodes[nodeIndex(level, x >> shift, y >> shift)] = NodeState::Split;
+	}
+
+	tile.x = x * tileSize;
+	tile.y = y * tileSize;
+	tile.node = node;
+	mUsedTexels += tileSize * tileSize;
+	return tile;
+}
+
+void QuadtreeAllocator::free(const AtlasTile& tile)
+{
+	if (tile.node < 0)
+		return;
+
+	int level = 0;
+	while (level + 1 < mLevelCount && mLevelOffsets[level + 1] <= tile.node)
+	{
+		level++;
+	}
+	int cell = tile.node - mLevelOffsets[level];
+	int x = cell % (1 << level);
+	int y = cell / (1 << level);
+
+	mNodes[tile.node] = NodeState::Free;
+	mUsedTexels -= tile.size * tile.size;
+
+	// Merge upwards while all four siblings are free
+	while (level > 0)
+	{
+		int parentX = x / 2;
+		int parentY = y / 2;
+		for (int child = 0; child < 4; child++)
+		{
+			if (mNodes[nodeIndex(level, parentX * 2 + (child & 1), parentY * 2 + (child >> 1))] != NodeState::Free)
+				return;
+		}
+
+		level--;
+		x = parentX;
+		y = parentY;
+		mNodes[nodeIndex(level, x, y)] = NodeState::Free;
+	}
+}
+
+void QuadtreeAllocator::clear()
+{
+	std::fill(mNodes.begin(), mNodes.end(), NodeState::Free);
+	mUsedTexels = 0;
+}
+
+ShadowAtlas::ShadowAtlas(int size, int minTileSize, int maxTileSize)
+	: mAllocator(size, minTileSize)
+{
+	mSize = size;
+	mMinTileSize = minTileSize;
+	mMaxTileSize = maxTileSize;
+
+	mDepthTexture = genTexture("ShadowAtlas");
+	glBindTexture(GL_TEXTURE_2D, mDepthTexture.get());
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, size, size);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gpuTrackResize(GpuResourceType::Texture, mDepthTexture.get(), gpuTextureBytes(GL_DEPTH_COMPONENT32F, size, size), GL_DEPTH_COMPONENT32F);
+
+	mFBO = genFramebuffer("ShadowAtlas");
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mDepthTexture.get(), 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Frame buffer is incomplete.\n");
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool ShadowAtlas::allocateOwner(AtlasAllocation& allocation, int size, int viewCount)
+{
+	for (int view = 0; view < viewCount; view++)
+	{
+		allocation.tiles[view] = mAllocator.allocate(size);
+		if (allocation.tiles[view].node < 0)
+		{
+			for (int i = 0; i < view; i++)
+			{
+				mAllocator.free(allocation.tiles[i]);
+				allocation.tiles[i] = AtlasTile();
+			}
+			return false;
+		}
+	}
+
+	allocation.size = size;
+	allocation.viewCount = viewCount;
+	allocation.changed = true;
+	return true;
+}
+
+void ShadowAtlas::freeOwner(AtlasAllocation& allocation)
+{
+	for (int view = 0; view < allocation.viewCount; view++)
+	{
+		mAllocator.free(allocation.tiles[view]);
+		allocation.tiles[view] = AtlasTile();
+	}
+	allocation.size = 0;
+	allocation.viewCount = 0;
+}
+
+void ShadowAtlas::update(const AtlasRequest* requests, int ownerCount)
+{
+	for (int owner = ownerCount; owner < (int)mAllocations.size(); owner++)
+	{
+		freeOwner(mAllocations[owner]);
+	}
+	mAllocations.resize(ownerCount);
+
+	// Hold each owner's size until a different one has been asked for long enough
+	FrameVector<int> targetSizes(ownerCount);
+	for (int owner = 0; owner < ownerCount; owner++)
+	{
+		AtlasAllocation& allocation = mAllocations[owner];
+		allocation.changed = false;
+
+		int desired = 0;
+		if (requests[owner].priority > 0.0f && requests[owner].desiredSize > 0)
+		{
+			desired = mMinTileSize;
+			while (desired * 2 <= requests[owner].desiredSize && desired < mMaxTileSize)
+			{
+				desired *= 2;
+			}
+		}
+
+		if (desired == allocation.heldSize || allocation.heldSize == 0)
+		{
+			allocation.heldSize = desired;
+			allocation.pendingFrames = 0;
+		}
+		else
+		{
+			if (desired != allocation.pendingSize)
+			{
+				allocation.pendingSize = desired;
+				allocation.pendingFrames = 0;
+			}
+			if (++allocation.pendingFrames >= hysteresisFrames)
+			{
+				allocation.heldSize = desired;
+				allocation.pendingFrames = 0;
+			}
+		}
+		targetSizes[owner] = allocation.heldSize;
+	}
+
+	// Shrink the lowest priority owners until the total fits
+	long long capacity = (long long)mSize * mSize;
+	long long total = 0;
+	for (int owner = 0; owner < ownerCount; owner++)
+	{
+		total += (long long)targetSizes[owner] * targetSizes[owner] * requests[owner].viewCount;
+	}
+	while (total > capacity)
+	{
+		int shrinkOwner = -1;
+		int dropOwner = -1;
+		for (int owner = 0; owner < ownerCount; owner++)
+		{
+			if (targetSizes[owner] == 0)
+				continue;
+
+			if (targetSizes[owner] > mMinTileSize && (shrinkOwner < 0 || requests[owner].priority < requests[shrinkOwner].priority))
+				shrinkOwner = owner;
+			if (dropOwner < 0 || requests[owner].priority < requests[dropOwner].priority)
+				dropOwner = owner;
+		}
+
+		int owner = shrinkOwner >= 0 ? shrinkOwner : dropOwner;
+		long long oldTexels = (long long)targetSizes[owner] * targetSizes[owner] * requests[owner].viewCount;
+		targetSizes[owner] = shrinkOwner >= 0 ? targetSizes[owner] / 2 : 0;
+		total -= oldTexels - (long long)targetSizes[owner] * targetSizes[owner] * requests[owner].viewCount;
+	}
+
+	// Tiles as last rendered, a repack compares against these since the passes below already move some
+	FrameVector<int> previousNodes(ownerCount * 6);
+	for (int owner = 0; owner < ownerCount; owner++)
+	{
+		for (int view = 0; view < 6; view++)
+		{
+			previousNodes[owner * 6 + view] = mAllocations[owner].tiles[view].node;
+		}
+	}
+
+	// Keep the tiles of owners whose size didn't change
+	FrameVector<int> pending;
+	pending.reserve(ownerCount);
+	for (int owner = 0; owner < ownerCount; owner++)
+	{
+		AtlasAllocation& allocation = mAllocations[owner];
+		if (allocation.size != targetSizes[owner] || allocation.viewCount != requests[owner].viewCount)
+		{
+			freeOwner(allocation);
+			if (targetSizes[owner] > 0)
+			{
+				pending.push_back(owner);
+			}
+		}
+	}
+
+	auto largestFirst = [&](int a, int b) { return targetSizes[a] > targetSizes[b]; };
+	std::sort(pending.begin(), pending.end(), largestFirst);
+
+	bool fits = true;
+	for (int owner : pending)
+	{
+		if (!allocateOwner(mAllocations[owner], targetSizes[owner], requests[owner].viewCount))
+		{
+			fits = false;
+			break;
+		}
+	}
+
+	if (!fits)
+	{
+		// Fragmented, start over largest first
+		pending.clear();
+		for (int owner = 0; owner < ownerCount; owner++)
+		{
+			freeOwner(mAllocations[owner]);
+			if (targetSizes[owner] > 0)
+			{
+				pending.push_back(owner);
+			}
+		}
+		mAllocator.clear();
+
+		std::sort(pending.begin(), pending.end(), largestFirst);
+		for (int owner : pending)
+		{
+			AtlasAllocation& allocation = mAllocations[owner];
+			allocateOwner(allocation, targetSizes[owner], requests[owner].viewCount);
+
+			bool moved = false;
+			for (int view = 0; view < allocation.viewCount; view++)
+			{
+				moved |= allocation.tiles[view].node != previousNodes[owner * 6 + view];
+			}
+			allocation.changed = moved;
+		}
+		mStats.fullRepacks++;
+	}
+
+	mStats.usedTexels = mAllocator.getUsedTexels();
+	mStats.totalTexels = mSize * mSize;
+	mStats.allocatedTiles = 0;
+	mStats.droppedOwners = 0;
+	mStats.shrunkOwners = 0;
+	for (int owner = 0; owner < ownerCount; owner++)
+	{
+		const AtlasAllocation& allocation = mAllocations[owner];
+		mStats.allocatedTiles += allocation.viewCount;
+		if (allocation.heldSize > 0 && allocation.size == 0)
+			mStats.droppedOwners++;
+		else if (allocation.size < allocation.heldSize)
+			mStats.shrunkOwners++;
+	}
+}
+
+void ShadowAtlas::beginRender()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+	glEnable(GL_SCISSOR_TEST);
+}
+
+void ShadowAtlas::beginTile(const AtlasTile& tile)
+{
+	glViewport(tile.x, tile.y, tile.size, tile.size);
+	glScissor(tile.x, tile.y, tile.size, tile.size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void ShadowAtlas::endRender()
+{
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
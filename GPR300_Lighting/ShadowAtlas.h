@@ -0,0 +1,135 @@
+#pragma once
+#include "GL/glew.h"
+#include <vector>
+
+#include "GlHandle.h"
+
+// Square region of the atlas in texels
+struct AtlasTile
+{
+	int x, y;
+	int size;
+	// Quadtree node backing the tile, -1 when unallocated
+	int node = -1;
+};
+
+/*
+* Buddy allocator over a square of power of two size.
+* Each node is free, split into four children, or allocated as a whole. Allocation prefers nodes
+* inside already split subtrees so large free regions stay intact, and freeing merges four free
+* siblings back into their parent.
+*/
+class QuadtreeAllocator
+{
+public:
+	QuadtreeAllocator(int size, int minTileSize);
+
+	// Returns an allocated tile, or a tile with node -1 when nothing of that size is free
+	AtlasTile allocate(int tileSize);
+	void free(const AtlasTile& tile);
+	void clear();
+
+	int getUsedTexels() const { return mUsedTexels; }
+
+private:
+	enum class NodeState : unsigned char
+	{
+		Free,
+		Split,
+		Allocated
+	};
+
+	int nodeIndex(int level, int x, int y) const { return mLevelOffsets[level] + y * (1 << level) + x; }
+	int findFree(int level, int x, int y, int targetLevel) const;
+
+	std::vector<NodeState> mNodes;
+	std::vector<int> mLevelOffsets;
+	int mSize;
+	int mLevelCount;
+	int mUsedTexels = 0;
+};
+
+// What a shadow owner (one light) asks of the atlas this frame
+struct AtlasRequest
+{
+	// Tile edge wanted for each view, 0 if no shadow is needed
+	int desiredSize;
+	// Views sharing that size, 1 for spot lights and 6 for point lights
+	int viewCount;
+	// Higher priority lights are shrunk last when the budget runs out
+	float priority;
+};
+
+struct AtlasAllocation
+{
+	int size = 0;
+	int viewCount = 0;
+	AtlasTile tiles[6];
+	// Tiles moved or resized this frame, the owner's views need rendering
+	bool changed = false;
+
+	// Size that has been requested for a while, survives short spikes in the request
+	int heldSize = 0;
+	int pendingSize = 0;
+	int pendingFrames = 0;
+};
+
+struct ShadowAtlasStats
+{
+	int usedTexels;
+	int totalTexels;
+	int allocatedTiles;
+	// Owners that wanted a shadow but didn't get a tile
+	int droppedOwners;
+	// Owners given a smaller tile than requested to stay in budget
+	int shrunkOwners;
+	int fullRepacks;
+};
+
+/*
+* One depth texture shared by every local light shadow.
+* Each frame the requested tile sizes are held against short term changes, shrunk by priority until
+* their total fits the atlas, and then only owners whose size changed are re-allocated.
+* If fragmentation stops a tile from fitting, everything is re-packed largest first, which
+* always succeeds for power of two tiles whose total fits.
+*/
+class ShadowAtlas
+{
+public:
+	ShadowAtlas(int size, int minTileSize, int maxTileSize);
+
+	// Requests are indexed by owner, owners keep their index between frames
+	void update(const AtlasRequest* requests, int ownerCount);
+
+	const AtlasAllocation& getAllocation(int owner) const { return mAllocations[owner]; }
+
+	// Binds the atlas for depth rendering with the scissor test enabled
+	void beginRender();
+	// Restricts rendering to the tile and clears it
+	void beginTile(const AtlasTile& tile);
+	void endRender();
+
+	unsigned int getTexture() const { return mDepthTexture.get(); }
+	int getSize() const { return mSize; }
+	int getMinTileSize() const { return mMinTileSize; }
+	int getMaxTileSize() const { return mMaxTileSize; }
+	const ShadowAtlasStats& getStats() const { return mStats; }
+
+	// Frames a new size has to be requested before the tile changes
+	int hysteresisFrames = 8;
+
+private:
+	bool allocateOwner(AtlasAllocation& allocation, int size, int viewCount);
+	void freeOwner(AtlasAllocation& allocation);
+
+	TextureHandle mDepthTexture;
+	FramebufferHandle mFBO;
+	QuadtreeAllocator mAllocator;
+	std::vector<AtlasAllocation> mAllocations;
+
+	int mSize;
+	int mMinTileSize;
+	int mMaxTileSize;
+
+	ShadowAtlasStats mStats = {};
+};
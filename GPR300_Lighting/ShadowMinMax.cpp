@@ -0,0 +1,71 @@
+#include "ShadowMinMax.h"
+
+#include <algorithm>
+
+#include "GpuMemory.h"
+
+// Texture units used by the reduction
+const int MIN_MAX_DEPTH_UNIT = 7;
+const int MIN_MAX_PREVIOUS_UNIT = 8;
+const int MIN_MAX_GROUP_SIZE = 8;
+
+ShadowMinMax::ShadowMinMax(int resolution, int layers)
+	: mReduceShader("shaders/shadowMinMax.comp")
+{
+	// Level 0 is already a 2x2 reduction of the depth map
+	mResolution = resolution / 2;
+	mLayers = layers;
+	mLevels = gpuMipLevelCount(mResolution, mResolution);
+
+	mPyramid = genTexture("ShadowMinMax");
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mPyramid.get());
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, mLevels, GL_RG32F, mResolution, mResolution, layers);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	gpuTrackResize(GpuResourceType::Texture, mPyramid.get(), gpuTextureBytes(GL_RG32F, mResolution, mResolution, layers, mLevels), GL_RG32F);
+
+	mRawDepthSampler = genSampler("ShadowMinMax depth");
+	glSamplerParameteri(mRawDepthSampler.get(), GL_TEXTURE_COMPARE_MODE, GL_NONE);
+	glSamplerParameteri(mRawDepthSampler.get(), GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glSamplerParameteri(mRawDepthSampler.get(), GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	mReduceShader.setInt("_DepthMap", MIN_MAX_DEPTH_UNIT);
+	mReduceShader.setInt("_PreviousLevel", MIN_MAX_PREVIOUS_UNIT);
+}
+
+void ShadowMinMax::generate(ShadowBuffer& depth, int layer)
+{
+	mReduceShader.use();
+	mReduceShader.setInt("_Layer", layer);
+
+	glActiveTexture(GL_TEXTURE0 + MIN_MAX_DEPTH_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depth.getTexture());
+	glBindSampler(MIN_MAX_DEPTH_UNIT, mRawDepthSampler.get());
+
+	glActiveTexture(GL_TEXTURE0 + MIN_MAX_PREVIOUS_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mPyramid.get());
+
+	for (int level = 0; level < mLevels; level++)
+	{
+		int size = std::max(mResolution >> level, 1);
+
+		mReduceShader.setInt("_FromDepth", level == 0);
+		mReduceShader.setInt("_PreviousLod", level - 1);
+		glBindImageTexture(0, mPyramid.get(), level, GL_FALSE, layer, GL_WRITE_ONLY, GL_RG32F);
+
+		int groups = (size + MIN_MAX_GROUP_SIZE - 1) / MIN_MAX_GROUP_SIZE;
+		glDispatchCompute(groups, groups, 1);
+
+		// The next level and the lit pass fetch what this one wrote
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glActiveTexture(GL_TEXTURE0 + MIN_MAX_DEPTH_UNIT);
+	glBindSampler(MIN_MAX_DEPTH_UNIT, 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
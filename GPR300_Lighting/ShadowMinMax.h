@@ -0,0 +1,33 @@
+#pragma once
+#include "GL/glew.h"
+
+#include "GlHandle.h"
+#include "RenderTargets.h"
+#include "EW/Shader.h"
+
+/*
+* Min/max depth pyramid of a shadow map array, stored in RG32F with one mip level per reduction.
+* Every texel is dilated by its own size, so the lit shader can classify a PCF kernel as fully lit,
+* fully shadowed or penumbra with a single fetch from the level whose texels are as wide as the kernel.
+*/
+class ShadowMinMax
+{
+public:
+	ShadowMinMax(int resolution, int layers);
+
+	// Rebuilds every level of one layer from the depth map
+	void generate(ShadowBuffer& depth, int layer);
+
+	unsigned int getTexture() const { return mPyramid.get(); }
+	int getLevelCount() const { return mLevels; }
+
+private:
+	TextureHandle mPyramid;
+	// The depth array compares in its texture state, the reduction reads raw depth
+	SamplerHandle mRawDepthSampler;
+	Shader mReduceShader;
+
+	int mResolution;
+	int mLayers;
+	int mLevels;
+};
@@ -0,0 +1,104 @@
+#include "ShadowMoments.h"
+
+#include "GpuMemory.h"
+
+// Texture units of the blur passes, the two samplers differ in type so they can't share one
+const int MOMENTS_DEPTH_UNIT = 7;
+const int MOMENTS_TEMP_UNIT = 8;
+
+ShadowMoments::ShadowMoments(int resolution, int layers)
+	: mBlurShader("shaders/fullscreen.vert", "shaders/evsmBlur.frag")
+{
+	mResolution = resolution;
+	mLayers = layers;
+	int levels = gpuMipLevelCount(resolution, resolution);
+
+	mMoments = genTexture("ShadowMoments");
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mMoments.get());
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA16F, resolution, resolution, layers);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if (GLEW_EXT_texture_filter_anisotropic)
+	{
+		glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, 8.0f);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	gpuTrackResize(GpuResourceType::Texture, mMoments.get(), gpuTextureBytes(GL_RGBA16F, resolution, resolution, layers, levels), GL_RGBA16F);
+
+	mTemp = genTexture("ShadowMoments blur");
+	glBindTexture(GL_TEXTURE_2D, mTemp.get());
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, resolution, resolution);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gpuTrackResize(GpuResourceType::Texture, mTemp.get(), gpuTextureBytes(GL_RGBA16F, resolution, resolution), GL_RGBA16F);
+
+	mFBO = genFramebuffer("ShadowMoments");
+	mEmptyVAO = genVertexArray("ShadowMoments fullscreen");
+
+	mRawDepthSampler = genSampler("ShadowMoments depth");
+	glSamplerParameteri(mRawDepthSampler.get(), GL_TEXTURE_COMPARE_MODE, GL_NONE);
+	glSamplerParameteri(mRawDepthSampler.get(), GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glSamplerParameteri(mRawDepthSampler.get(), GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+void ShadowMoments::beginGenerate()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+	glViewport(0, 0, mResolution, mResolution);
+
+	// Fullscreen triangle writing float moments, nothing may test, cull or blend it.
+	// Whatever the caller had is put back by endGenerate().
+	mDepthTestWasEnabled = glIsEnabled(GL_DEPTH_TEST);
+	mCullWasEnabled = glIsEnabled(GL_CULL_FACE);
+	mBlendWasEnabled = glIsEnabled(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
+
+	mBlurShader.use();
+	mBlurShader.setInt("_Radius", blurRadius);
+	mBlurShader.setVec2("_Exponents", exponents);
+	mBlurShader.setInt("_DepthMap", MOMENTS_DEPTH_UNIT);
+	mBlurShader.setInt("_Moments", MOMENTS_TEMP_UNIT);
+	glBindVertexArray(mEmptyVAO.get());
+	glBindSampler(MOMENTS_DEPTH_UNIT, mRawDepthSampler.get());
+}
+
+void ShadowMoments::generate(ShadowBuffer& depth, int layer)
+{
+	// Depth to moments, horizontal blur
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mTemp.get(), 0);
+	glActiveTexture(GL_TEXTURE0 + MOMENTS_DEPTH_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depth.getTexture());
+	mBlurShader.setInt("_FromDepth", 1);
+	mBlurShader.setInt("_Layer", layer);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// Vertical blur into the layer, the temp texture is only bound once it isn't the target
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mMoments.get(), 0, layer);
+	glActiveTexture(GL_TEXTURE0 + MOMENTS_TEMP_UNIT);
+	glBindTexture(GL_TEXTURE_2D, mTemp.get());
+	mBlurShader.setInt("_FromDepth", 0);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void ShadowMoments::endGenerate()
+{
+	glBindSampler(MOMENTS_DEPTH_UNIT, 0);
+	glBindVertexArray(0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mMoments.get());
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	if (mDepthTestWasEnabled) glEnable(GL_DEPTH_TEST);
+	if (mCullWasEnabled) glEnable(GL_CULL_FACE);
+	if (mBlendWasEnabled) glEnable(GL_BLEND);
+}
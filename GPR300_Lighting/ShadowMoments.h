@@ -0,0 +1,50 @@
+#pragma once
+#include "GL/glew.h"
+#include <glm/glm.hpp>
+
+#include "GlHandle.h"
+#include "RenderTargets.h"
+#include "EW/Shader.h"
+
+/*
+* Exponential variance shadow map (EVSM) built from a depth array.
+* Each layer stores the positive and negative exponential warp of depth and their squares in RGBA16F.
+* The moments are blurred with a separable gaussian and mipmapped, so one trilinear fetch in the
+* lit shader gives a filtered shadow whose width doesn't depend on the number of taps.
+*/
+class ShadowMoments
+{
+public:
+	ShadowMoments(int resolution, int layers);
+
+	// Sets the GL state for the blur passes, call generate() for each changed layer, then endGenerate()
+	void beginGenerate();
+	void generate(ShadowBuffer& depth, int layer);
+	// Restores the GL state beginGenerate() found and rebuilds the mip chain
+	void endGenerate();
+
+	unsigned int getTexture() const { return mMoments.get(); }
+
+	// Gaussian radius in texels
+	int blurRadius = 4;
+	// Warp exponents, RGBA16F overflows above ~5.5
+	glm::vec2 exponents = glm::vec2(5.0f, 5.0f);
+
+private:
+	TextureHandle mMoments;
+	// Horizontally blurred layer, input to the vertical pass
+	TextureHandle mTemp;
+	FramebufferHandle mFBO;
+	VertexArrayHandle mEmptyVAO;
+	// The depth array compares in its texture state, the blur reads raw depth
+	SamplerHandle mRawDepthSampler;
+	Shader mBlurShader;
+
+	int mResolution;
+	int mLayers;
+
+	// Capabilities beginGenerate() turned off
+	bool mDepthTestWasEnabled = true;
+	bool mCullWasEnabled = true;
+	bool mBlendWasEnabled = false;
+};
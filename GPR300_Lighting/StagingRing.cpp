@@ -0,0 +1,96 @@
+#include "StagingRing.h"
+
+// Keeps every upload source aligned for the driver's copy
+const size_t STAGING_ALIGNMENT = 256;
+
+StagingRing::StagingRing(size_t size)
+{
+	mSize = size;
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	mBuffer = genBuffer("StagingRing");
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer.get());
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+	mMapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	gpuTrackResize(GpuResourceType::Buffer, mBuffer.get(), size, GL_NONE);
+}
+
+StagingRing::~StagingRing()
+{
+	// The mapping goes away with the buffer once its deferred deletion runs
+	for (FencedRange& range : mInFlight)
+	{
+		glDeleteSync(range.fence);
+	}
+}
+
+bool StagingRing::overlapsInFlight(size_t begin, size_t end) const
+{
+	for (const FencedRange& range : mInFlight)
+	{
+		if (begin < range.end && range.begin < end)
+			return true;
+	}
+	return false;
+}
+
+void StagingRing::retireOldest()
+{
+	FencedRange& range = mInFlight.front();
+	GLenum status = glClientWaitSync(range.fence, 0, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+	{
+		mStallCount++;
+		do
+		{
+			status = glClientWaitSync(range.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		} while (status == GL_TIMEOUT_EXPIRED);
+	}
+	glDeleteSync(range.fence);
+	mInFlight.pop_front();
+}
+
+unsigned char* StagingRing::allocate(size_t bytes, size_t& offset)
+{
+	if (mMapped == nullptr || bytes > mSize)
+		return nullptr;
+
+	size_t begin = (mHead + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+	if (begin + bytes > mSize)
+	{
+		// The start of the ring may still hold allocations that were never fenced
+		release();
+		begin = 0;
+		mPendingBegin = 0;
+	}
+
+	while (overlapsInFlight(begin, begin + bytes))
+	{
+		retireOldest();
+	}
+
+	mHead = begin + bytes;
+	mBytesStaged += bytes;
+	offset = begin;
+	return mMapped + begin;
+}
+
+void StagingRing::release()
+{
+	// Frees ranges the GPU is already done with, without waiting
+	while (!mInFlight.empty())
+	{
+		GLenum status = glClientWaitSync(mInFlight.front().fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+		glDeleteSync(mInFlight.front().fence);
+		mInFlight.pop_front();
+	}
+
+	if (mHead != mPendingBegin)
+	{
+		mInFlight.push_back({ mPendingBegin, mHead, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+		mPendingBegin = mHead;
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "GL/glew.h"
+#include <deque>
+
+#include "GlHandle.h"
+
+/*
+* Upload staging memory in one persistently and coherently mapped pixel unpack buffer.
+* Data is written straight into the mapping and uploaded with the buffer bound to
+* GL_PIXEL_UNPACK_BUFFER, so the driver reads it without another CPU copy. Space is handed out
+* as a ring and every release fences what was handed out since, an allocation only waits on
+* the GPU when it would overwrite a range whose fence hasn't signaled.
+*/
+class StagingRing
+{
+public:
+	explicit StagingRing(size_t size);
+	~StagingRing();
+
+	StagingRing(const StagingRing&) = delete;
+	StagingRing& operator=(const StagingRing&) = delete;
+
+	// Mapped memory for bytes at offset into the buffer, NULL if bytes is larger than the ring.
+	// The GL commands reading earlier allocations have to be issued before the next allocate.
+	unsigned char* allocate(size_t bytes, size_t& offset);
+	// Fences everything allocated since the last release, call once the commands reading it are issued
+	void release();
+
+	GLuint getBuffer() const { return mBuffer.get(); }
+	size_t getSize() const { return mSize; }
+	size_t getBytesStaged() const { return mBytesStaged; }
+	// Allocations that had to block on a fence
+	int getStallCount() const { return mStallCount; }
+
+private:
+	struct FencedRange
+	{
+		size_t begin;
+		size_t end;
+		GLsync fence;
+	};
+
+	bool overlapsInFlight(size_t begin, size_t end) const;
+	// Waits for the oldest fence and frees its range
+	void retireOldest();
+
+	BufferHandle mBuffer;
+	unsigned char* mMapped = nullptr;
+	size_t mSize;
+	// Next free byte and the start of the allocations not fenced yet
+	size_t mHead = 0;
+	size_t mPendingBegin = 0;
+	// Oldest first
+	std::deque<FencedRange> mInFlight;
+
+	size_t mBytesStaged = 0;
+	int mStallCount = 0;
+};
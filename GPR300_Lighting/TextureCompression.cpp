@@ -0,0 +1,765 @@
+#include "TextureCompression.h"
+
+#include <emmintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include "AllocTracker.h"
+
+// The 16 pixels of a block as separate channels, so SSE works on four pixels at once
+struct alignas(16) BlockPixels
+{
+	float channels[4][16];
+};
+
+// Packs bits from the least significant end of a 128 bit block
+struct BlockBits
+{
+	uint64_t words[2] = {};
+	int position = 0;
+
+	void write(uint32_t value, int bits)
+	{
+		for (int i = 0; i < bits; i++, position++)
+		{
+			if ((value >> i) & 1)
+			{
+				words[position >> 6] |= 1ull << (position & 63);
+			}
+		}
+	}
+};
+
+static int blockBytes(BlockFormat format)
+{
+	return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+GLenum blockFormatGL(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BlockFormat::BC5: return GL_COMPRESSED_RG_RGTC2;
+	case BlockFormat::BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+	return GL_NONE;
+}
+
+const char* blockFormatName(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1: return "bc1";
+	case BlockFormat::BC5: return "bc5";
+	case BlockFormat::BC7: return "bc7";
+	}
+	return "";
+}
+
+size_t compressedLevelBytes(BlockFormat format, int width, int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+// Splits [0, count) into one contiguous range per hardware thread, small counts stay on this thread
+static void parallelFor(int count, const std::function<void(int, int)>& work)
+{
+	int threadCount = (int)std::max(1u, std::thread::hardware_concurrency());
+	if (count < 16 || threadCount == 1)
+	{
+		work(0, count);
+		return;
+	}
+
+	int chunk = (count + threadCount - 1) / threadCount;
+	std::vector<std::thread> threads;
+	for (int first = chunk; first < count; first += chunk)
+	{
+		int last = std::min(count, first + chunk);
+		threads.emplace_back([&work, first, last]()
+		{
+			allocTrackerMarkWorkerThread();
+			work(first, last);
+		});
+	}
+	work(0, std::min(count, chunk));
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+// Pixels past the image edge repeat the last row or column
+static void gatherBlock(const unsigned char* rgba, int width, int height, int blockX, int blockY, BlockPixels& pixels)
+{
+	for (int y = 0; y < 4; y++)
+	{
+		int sourceY = std::min(blockY * 4 + y, height - 1);
+		for (int x = 0; x < 4; x++)
+		{
+			int sourceX = std::min(blockX * 4 + x, width - 1);
+			const unsigned char* texel = rgba + ((size_t)sourceY * width + sourceX) * 4;
+			for (int c = 0; c < 4; c++)
+			{
+				pixels.channels[c][y * 4 + x] = texel[c];
+			}
+		}
+	}
+}
+
+// Endpoints of the RGB colors projected on their principal axis
+static void fitEndpoints(const BlockPixels& pixels, float e0[3], float e1[3])
+{
+	float mean[3] = {};
+	float minimum[3] = { 255.0f, 255.0f, 255.0f };
+	float maximum[3] = {};
+	for (int c = 0; c < 3; c++)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			float value = pixels.channels[c][i];
+			mean[c] += value;
+			minimum[c] = std::min(minimum[c], value);
+			maximum[c] = std::max(maximum[c], value);
+		}
+		mean[c] /= 16.0f;
+	}
+
+	// xx, xy, xz, yy, yz, zz
+	float covariance[6] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		float r = pixels.channels[0][i] - mean[0];
+		float g = pixels.channels[1][i] - mean[1];
+		float b = pixels.channels[2][i] - mean[2];
+		covariance[0] += r * r;
+		covariance[1] += r * g;
+		covariance[2] += r * b;
+		covariance[3] += g * g;
+		covariance[4] += g * b;
+		covariance[5] += b * b;
+	}
+
+	// Power iteration from the bounding box diagonal
+	float axis[3] = { maximum[0] - minimum[0], maximum[1] - minimum[1], maximum[2] - minimum[2] };
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[3] = {
+			covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+			covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+			covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2] };
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (length < 1e-6f)
+			break;
+		axis[0] = next[0] / length;
+		axis[1] = next[1] / length;
+		axis[2] = next[2] / length;
+	}
+
+	float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	float minT = 0.0f;
+	float maxT = 0.0f;
+	if (axisLength > 1e-6f)
+	{
+		minT = FLT_MAX;
+		maxT = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < 3; c++)
+			{
+				t += (pixels.channels[c][i] - mean[c]) * axis[c] / axisLength;
+			}
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+	}
+
+	for (int c = 0; c < 3; c++)
+	{
+		float direction = axisLength > 1e-6f ? axis[c] / axisLength : 0.0f;
+		e0[c] = std::clamp(mean[c] + direction * minT, 0.0f, 255.0f);
+		e1[c] = std::clamp(mean[c] + direction * maxT, 0.0f, 255.0f);
+	}
+}
+
+// Nearest of levels evenly spaced points from e0 to e1 for every pixel, 0 at e0
+static void fitPositions(const BlockPixels& pixels, int firstChannel, int channelCount,
+	const float* e0, const float* e1, int levels, int positions[16])
+{
+	float lengthSquared = 0.0f;
+	for (int c = 0; c < channelCount; c++)
+	{
+		float d = e1[c] - e0[c];
+		lengthSquared += d * d;
+	}
+	if (lengthSquared < 1e-6f)
+	{
+		std::fill(positions, positions + 16, 0);
+		return;
+	}
+
+	float scale = (levels - 1) / lengthSquared;
+	__m128 maxPosition = _mm_set1_ps((float)(levels - 1));
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 t = _mm_setzero_ps();
+		for (int c = 0; c < channelCount; c++)
+		{
+			__m128 value = _mm_sub_ps(_mm_load_ps(&pixels.channels[firstChannel + c][i]), _mm_set1_ps(e0[c]));
+			t = _mm_add_ps(t, _mm_mul_ps(value, _mm_set1_ps((e1[c] - e0[c]) * scale)));
+		}
+		t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), maxPosition);
+		// Rounds to nearest
+		_mm_storeu_si128((__m128i*)&positions[i], _mm_cvtps_epi32(t));
+	}
+}
+
+// Least squares RGB endpoints for fixed positions, false if every pixel has the same weight
+static bool refitEndpoints(const BlockPixels& pixels, const int positions[16], int levels, float e0[3], float e1[3])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float x[3] = {}, y[3] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		float w = (float)positions[i] / (levels - 1);
+		float a = 1.0f - w;
+		aa += a * a;
+		ab += a * w;
+		bb += w * w;
+		for (int c = 0; c < 3; c++)
+		{
+			x[c] += a * pixels.channels[c][i];
+			y[c] += w * pixels.channels[c][i];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (std::abs(determinant) < 1e-6f)
+		return false;
+
+	for (int c = 0; c < 3; c++)
+	{
+		e0[c] = std::clamp((bb * x[c] - ab * y[c]) / determinant, 0.0f, 255.0f);
+		e1[c] = std::clamp((aa * y[c] - ab * x[c]) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+static uint16_t pack565(const float color[3])
+{
+	int r = (int)std::lround(color[0] * 31.0f / 255.0f);
+	int g = (int)std::lround(color[1] * 63.0f / 255.0f);
+	int b = (int)std::lround(color[2] * 31.0f / 255.0f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpack565(uint16_t packed, float color[3])
+{
+	int r = (packed >> 11) & 31;
+	int g = (packed >> 5) & 63;
+	int b = packed & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+}
+
+static void encodeBC1(const BlockPixels& pixels, unsigned char* out)
+{
+	float e0[3], e1[3];
+	fitEndpoints(pixels, e0, e1);
+
+	// Fit to the quantized endpoints, refit once and fit again
+	uint16_t c0 = 0, c1 = 0;
+	int positions[16];
+	for (int pass = 0; pass < 2; pass++)
+	{
+		float q0[3], q1[3];
+		c0 = pack565(e0);
+		c1 = pack565(e1);
+		unpack565(c0, q0);
+		unpack565(c1, q1);
+		fitPositions(pixels, 0, 3, q0, q1, 4, positions);
+		if (pass == 1 || !refitEndpoints(pixels, positions, 4, e0, e1))
+			break;
+	}
+
+	// Four color mode needs c0 > c1
+	if (c0 < c1)
+	{
+		std::swap(c0, c1);
+		for (int& position : positions)
+		{
+			position = 3 - position;
+		}
+	}
+
+	// Positions along the line to the palette order c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+	static const uint32_t BC1_INDEX[4] = { 0, 2, 3, 1 };
+	uint32_t indices = 0;
+	if (c0 != c1)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			indices |= BC1_INDEX[positions[i]] << (2 * i);
+		}
+	}
+
+	out[0] = (unsigned char)(c0 & 0xFF);
+	out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xFF);
+	out[3] = (unsigned char)(c1 >> 8);
+	for (int i = 0; i < 4; i++)
+	{
+		out[4 + i] = (unsigned char)(indices >> (8 * i));
+	}
+}
+
+// 7 bit channels and the shared p-bit that decode closest to the endpoint
+static void quantizeBC7Endpoint(const float endpoint[3], int quantized[3], int& pBit)
+{
+	float bestError = FLT_MAX;
+	for (int p = 0; p < 2; p++)
+	{
+		int candidate[3];
+		float error = 0.0f;
+		for (int c = 0; c < 3; c++)
+		{
+			candidate[c] = std::clamp((int)std::lround((endpoint[c] - p) * 0.5f), 0, 127);
+			float difference = (float)(candidate[c] * 2 + p) - endpoint[c];
+			error += difference * difference;
+		}
+		if (error < bestError)
+		{
+			bestError = error;
+			pBit = p;
+			std::copy(candidate, candidate + 3, quantized);
+		}
+	}
+}
+
+static void encodeBC7(const BlockPixels& pixels, unsigned char* out)
+{
+	float e0[3], e1[3];
+	fitEndpoints(pixels, e0, e1);
+
+	int q0[3], q1[3];
+	int p0 = 0, p1 = 0;
+	int positions[16];
+	for (int pass = 0; pass < 2; pass++)
+	{
+		quantizeBC7Endpoint(e0, q0, p0);
+		quantizeBC7Endpoint(e1, q1, p1);
+		float d0[3], d1[3];
+		for (int c = 0; c < 3; c++)
+		{
+			d0[c] = (float)(q0[c] * 2 + p0);
+			d1[c] = (float)(q1[c] * 2 + p1);
+		}
+		// The 4 bit interpolation weights round to evenly spaced positions
+		fitPositions(pixels, 0, 3, d0, d1, 16, positions);
+		if (pass == 1 || !refitEndpoints(pixels, positions, 16, e0, e1))
+			break;
+	}
+
+	// The first index is stored without its top bit, which has to be 0
+	if (positions[0] >= 8)
+	{
+		std::swap(q0, q1);
+		std::swap(p0, p1);
+		for (int& position : positions)
+		{
+			position = 15 - position;
+		}
+	}
+
+	BlockBits bits;
+	// Mode 6
+	bits.write(1 << 6, 7);
+	for (int c = 0; c < 3; c++)
+	{
+		bits.write(q0[c], 7);
+		bits.write(q1[c], 7);
+	}
+	// Opaque alpha, 254 or 255 depending on the p-bit
+	bits.write(127, 7);
+	bits.write(127, 7);
+	bits.write(p0, 1);
+	bits.write(p1, 1);
+	bits.write(positions[0], 3);
+	for (int i = 1; i < 16; i++)
+	{
+		bits.write(positions[i], 4);
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		out[i] = (unsigned char)(bits.words[i / 8] >> (8 * (i % 8)));
+	}
+}
+
+// One channel from its min and max in the eight value mode
+static void encodeBC4(const BlockPixels& pixels, int channel, unsigned char* out)
+{
+	const float* values = pixels.channels[channel];
+	float minimum = *std::min_element(values, values + 16);
+	float maximum = *std::max_element(values, values + 16);
+	int r0 = (int)std::lround(maximum);
+	int r1 = (int)std::lround(minimum);
+
+	uint64_t indices = 0;
+	if (r0 > r1)
+	{
+		int positions[16];
+		float e0 = (float)r0;
+		float e1 = (float)r1;
+		fitPositions(pixels, channel, 1, &e0, &e1, 8, positions);
+
+		// Positions from r0 to r1 to the palette order r0, r1, then the six in between
+		for (int i = 0; i < 16; i++)
+		{
+			int position = positions[i];
+			uint64_t index = position == 0 ? 0 : position == 7 ? 1 : position + 1;
+			indices |= index << (3 * i);
+		}
+	}
+
+	out[0] = (unsigned char)r0;
+	out[1] = (unsigned char)r1;
+	for (int i = 0; i < 6; i++)
+	{
+		out[2 + i] = (unsigned char)(indices >> (8 * i));
+	}
+}
+
+// Encodes block rows [firstRow, lastRow) of one RGBA8 level into its slot of the output
+static void encodeBlockRows(const unsigned char* rgba, int width, int height, BlockFormat format,
+	int firstRow, int lastRow, unsigned char* encoded)
+{
+	int blocksX = (width + 3) / 4;
+	int bytes = blockBytes(format);
+
+	BlockPixels pixels;
+	for (int blockY = firstRow; blockY < lastRow; blockY++)
+	{
+		for (int blockX = 0; blockX < blocksX; blockX++)
+		{
+			gatherBlock(rgba, width, height, blockX, blockY, pixels);
+			unsigned char* out = encoded + ((size_t)blockY * blocksX + blockX) * bytes;
+			switch (format)
+			{
+			case BlockFormat::BC1:
+				encodeBC1(pixels, out);
+				break;
+			case BlockFormat::BC5:
+				encodeBC4(pixels, 0, out);
+				encodeBC4(pixels, 1, out + 8);
+				break;
+			case BlockFormat::BC7:
+				encodeBC7(pixels, out);
+				break;
+			}
+		}
+	}
+}
+
+// Steps of the linear to sRGB table, fine enough that dark values still land on every byte
+const int LINEAR_TO_SRGB_STEPS = 4096;
+
+struct ColorTables
+{
+	float toLinear[256];
+	unsigned char toSRGB[LINEAR_TO_SRGB_STEPS];
+
+	ColorTables()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			float value = i / 255.0f;
+			toLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < LINEAR_TO_SRGB_STEPS; i++)
+		{
+			float value = (float)i / (LINEAR_TO_SRGB_STEPS - 1);
+			float encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+			toSRGB[i] = (unsigned char)std::lround(std::clamp(encoded, 0.0f, 1.0f) * 255.0f);
+		}
+	}
+};
+
+static const ColorTables& colorTables()
+{
+	static const ColorTables tables;
+	return tables;
+}
+
+// RGBA8 to RGBA floats the filter can average, alpha is always linear
+static std::vector<float> decodeTexels(const unsigned char* rgba, int width, int height, MipFilter filter)
+{
+	const ColorTables& tables = colorTables();
+	std::vector<float> texels((size_t)width * height * 4);
+
+	parallelFor(height, [&](int firstRow, int lastRow)
+	{
+		for (size_t i = (size_t)firstRow * width; i < (size_t)lastRow * width; i++)
+		{
+			const unsigned char* source = rgba + i * 4;
+			float* texel = &texels[i * 4];
+			for (int c = 0; c < 4; c++)
+			{
+				float value = source[c] / 255.0f;
+				if (c < 3 && filter == MipFilter::SRGB)
+				{
+					value = tables.toLinear[source[c]];
+				}
+				else if (c < 3 && filter == MipFilter::Normal)
+				{
+					value = value * 2.0f - 1.0f;
+				}
+				texel[c] = value;
+			}
+		}
+	});
+	return texels;
+}
+
+// Back to RGBA8, the sRGB channels are scaled to the table steps instead of bytes
+static std::vector<unsigned char> encodeTexels(const std::vector<float>& texels, int width, int height, MipFilter filter)
+{
+	const ColorTables& tables = colorTables();
+	std::vector<unsigned char> rgba((size_t)width * height * 4);
+
+	float colorScale = filter == MipFilter::SRGB ? (float)(LINEAR_TO_SRGB_STEPS - 1) : filter == MipFilter::Normal ? 127.5f : 255.0f;
+	float colorBias = filter == MipFilter::Normal ? 127.5f : 0.0f;
+	float colorMax = filter == MipFilter::SRGB ? (float)(LINEAR_TO_SRGB_STEPS - 1) : 255.0f;
+	__m128 scale = _mm_setr_ps(colorScale, colorScale, colorScale, 255.0f);
+	__m128 bias = _mm_setr_ps(colorBias, colorBias, colorBias, 0.0f);
+	__m128 maximum = _mm_setr_ps(colorMax, colorMax, colorMax, 255.0f);
+
+	parallelFor(height, [&](int firstRow, int lastRow)
+	{
+		for (size_t i = (size_t)firstRow * width; i < (size_t)lastRow * width; i++)
+		{
+			__m128 value = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&texels[i * 4]), scale), bias);
+			value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), maximum);
+			alignas(16) int quantized[4];
+			_mm_store_si128((__m128i*)quantized, _mm_cvtps_epi32(value));
+
+			unsigned char* out = &rgba[i * 4];
+			for (int c = 0; c < 3; c++)
+			{
+				out[c] = filter == MipFilter::SRGB ? tables.toSRGB[quantized[c]] : (unsigned char)quantized[c];
+			}
+			out[3] = (unsigned char)quantized[3];
+		}
+	});
+	return rgba;
+}
+
+// Next mip level, every texel averages a 2x2 footprint clamped to the image
+static std::vector<float> downsample(const std::vector<float>& texels, int width, int height, MipFilter filter, int& outWidth, int& outHeight)
+{
+	outWidth = std::max(1, width / 2);
+	outHeight = std::max(1, height / 2);
+	std::vector<float> result((size_t)outWidth * outHeight * 4);
+	int resultWidth = outWidth;
+
+	parallelFor(outHeight, [&](int firstRow, int lastRow)
+	{
+		__m128 quarter = _mm_set1_ps(0.25f);
+		for (int y = firstRow; y < lastRow; y++)
+		{
+			const float* row0 = &texels[(size_t)std::min(y * 2, height - 1) * width * 4];
+			const float* row1 = &texels[(size_t)std::min(y * 2 + 1, height - 1) * width * 4];
+			for (int x = 0; x < resultWidth; x++)
+			{
+				int x0 = std::min(x * 2, width - 1) * 4;
+				int x1 = std::min(x * 2 + 1, width - 1) * 4;
+				__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+					_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+				__m128 average = _mm_mul_ps(sum, quarter);
+
+				// Averaged normals get shorter, they are brought back to unit length
+				if (filter == MipFilter::Normal)
+				{
+					alignas(16) float squared[4];
+					_mm_store_ps(squared, _mm_mul_ps(average, average));
+					float lengthSquared = squared[0] + squared[1] + squared[2];
+					if (lengthSquared > 1e-8f)
+					{
+						float inverse = 1.0f / std::sqrt(lengthSquared);
+						average = _mm_mul_ps(average, _mm_setr_ps(inverse, inverse, inverse, 1.0f));
+					}
+				}
+				_mm_storeu_ps(&result[((size_t)y * resultWidth + x) * 4], average);
+			}
+		}
+	});
+	return result;
+}
+
+std::vector<ImageLevel> buildMipChain(const unsigned char* rgba, int width, int height, MipFilter filter)
+{
+	// The chain is filtered in float so no level rounds twice, each level is only quantized for output
+	std::vector<ImageLevel> levels;
+	std::vector<float> texels = decodeTexels(rgba, width, height, filter);
+	int levelWidth = width;
+	int levelHeight = height;
+	while (levelWidth > 1 || levelHeight > 1)
+	{
+		int nextWidth, nextHeight;
+		std::vector<float> next = downsample(texels, levelWidth, levelHeight, filter, nextWidth, nextHeight);
+		texels.swap(next);
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+		levels.push_back({ levelWidth, levelHeight, encodeTexels(texels, levelWidth, levelHeight, filter) });
+	}
+	return levels;
+}
+
+std::vector<unsigned char> compressLevel(const unsigned char* rgba, int width, int height, BlockFormat format)
+{
+	std::vector<unsigned char> encoded(compressedLevelBytes(format, width, height));
+	parallelFor((height + 3) / 4, [&](int firstRow, int lastRow)
+	{
+		encodeBlockRows(rgba, width, height, format, firstRow, lastRow, encoded.data());
+	});
+	return encoded;
+}
+
+CompressedImage compressImage(const unsigned char* rgba, int width, int height, BlockFormat format, MipFilter filter)
+{
+	ALLOC_SCOPE("Texture compression");
+
+	CompressedImage image;
+	image.format = format;
+	image.width = width;
+	image.height = height;
+	std::vector<ImageLevel> levels = buildMipChain(rgba, width, height, filter);
+
+	// Block rows of every level go to the threads together, so the small levels don't run alone
+	struct RowJob
+	{
+		int level;
+		int blockRow;
+	};
+	std::vector<RowJob> jobs;
+	image.levels.resize(levels.size() + 1);
+	for (int level = 0; level <= (int)levels.size(); level++)
+	{
+		int w = level == 0 ? width : levels[level - 1].width;
+		int h = level == 0 ? height : levels[level - 1].height;
+		image.levels[level].resize(compressedLevelBytes(format, w, h));
+		for (int row = 0; row < (h + 3) / 4; row++)
+		{
+			jobs.push_back({ level, row });
+		}
+	}
+
+	parallelFor((int)jobs.size(), [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			const RowJob& job = jobs[i];
+			// The base level is encoded from the source as is
+			if (job.level == 0)
+			{
+				encodeBlockRows(rgba, width, height, format, job.blockRow, job.blockRow + 1, image.levels[0].data());
+			}
+			else
+			{
+				const ImageLevel& level = levels[job.level - 1];
+				encodeBlockRows(level.rgba.data(), level.width, level.height, format, job.blockRow, job.blockRow + 1, image.levels[job.level].data());
+			}
+		}
+	});
+	return image;
+}
+
+const uint32_t DDS_MAGIC = 0x20534444;
+const uint32_t DDS_FOURCC_DX10 = 0x30315844;
+const uint32_t DDS_PIXEL_FORMAT_FOURCC = 0x4;
+// Caps, height, width, pixel format, mip count and linear size
+const uint32_t DDS_HEADER_FLAGS = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+// Complex, texture, mipmap
+const uint32_t DDS_CAPS = 0x8 | 0x1000 | 0x400000;
+const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+static uint32_t dxgiFormat(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1: return 71;
+	case BlockFormat::BC5: return 83;
+	case BlockFormat::BC7: return 98;
+	}
+	return 0;
+}
+
+bool writeDDS(const char* path, const CompressedImage& image)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	// Magic followed by the 124 byte DDS_HEADER
+	uint32_t header[32] = {};
+	header[0] = DDS_MAGIC;
+	header[1] = 124;
+	header[2] = DDS_HEADER_FLAGS;
+	header[3] = image.height;
+	header[4] = image.width;
+	header[5] = (uint32_t)image.levels[0].size();
+	header[7] = (uint32_t)image.levels.size();
+	// First reserved field
+	header[8] = TEXTURE_CACHE_VERSION;
+	header[19] = 32;
+	header[20] = DDS_PIXEL_FORMAT_FOURCC;
+	header[21] = DDS_FOURCC_DX10;
+	header[27] = DDS_CAPS;
+
+	// Format, dimension, misc flags, array size, misc flags 2
+	uint32_t dx10[5] = { dxgiFormat(image.format), DDS_DIMENSION_TEXTURE2D, 0, 1, 0 };
+
+	file.write((const char*)header, sizeof(header));
+	file.write((const char*)dx10, sizeof(dx10));
+	for (const std::vector<unsigned char>& level : image.levels)
+	{
+		file.write((const char*)level.data(), level.size());
+	}
+	return (bool)file;
+}
+
+bool openDDS(std::ifstream& file, const char* path, BlockFormat format, CompressedImage& image, int& levelCount)
+{
+	file.open(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	uint32_t header[32];
+	uint32_t dx10[5];
+	file.read((char*)header, sizeof(header));
+	file.read((char*)dx10, sizeof(dx10));
+	if (!file || header[0] != DDS_MAGIC || header[21] != DDS_FOURCC_DX10 || dx10[0] != dxgiFormat(format)
+		|| header[8] != TEXTURE_CACHE_VERSION)
+		return false;
+
+	int width = (int)header[4];
+	int height = (int)header[3];
+	levelCount = std::max(1, (int)header[7]);
+	if (width <= 0 || height <= 0 || levelCount > 16)
+		return false;
+
+	image.format = format;
+	image.width = width;
+	image.height = height;
+	image.levels.clear();
+	return true;
+}
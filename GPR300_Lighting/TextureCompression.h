@@ -0,0 +1,71 @@
+#pragma once
+#include "GL/glew.h"
+#include <fstream>
+#include <vector>
+
+enum class BlockFormat
+{
+	// 5:6:5 endpoints and 2 bit indices, 8 bytes per block
+	BC1,
+	// Two BC4 channels for normal map xy, 16 bytes per block
+	BC5,
+	// Mode 6 only: 7 bit RGBA endpoints with p-bits and 4 bit indices, 16 bytes per block
+	BC7
+};
+
+// How the mips average texels
+enum class MipFilter
+{
+	// Every channel as stored
+	Linear,
+	// Color converted from sRGB to linear before averaging and back after, alpha linear
+	SRGB,
+	// Color as a [-1, 1] vector, renormalized after averaging
+	Normal
+};
+
+// Mip chain of one image, each level is a tightly packed grid of 4x4 blocks
+struct CompressedImage
+{
+	BlockFormat format = BlockFormat::BC1;
+	int width = 0;
+	int height = 0;
+	std::vector<std::vector<unsigned char>> levels;
+};
+
+// One RGBA8 level of a mip chain
+struct ImageLevel
+{
+	int width;
+	int height;
+	std::vector<unsigned char> rgba;
+};
+
+GLenum blockFormatGL(BlockFormat format);
+const char* blockFormatName(BlockFormat format);
+size_t compressedLevelBytes(BlockFormat format, int width, int height);
+
+/*
+* Builds the mip chain of an RGBA8 image and block compresses every level.
+* Mips are 2x2 box filtered in float with SSE2, in linear space for sRGB color, each level from the
+* unrounded level above. Blocks are fit along the principal axis of their colors, indices are found
+* with SSE2 four pixels at a time and the endpoints refit by least squares once. Block rows of all
+* levels are split over every hardware thread.
+*/
+CompressedImage compressImage(const unsigned char* rgba, int width, int height, BlockFormat format, MipFilter filter);
+
+// Every level below the RGBA8 image down to 1x1, filtered the way compressImage filters them
+std::vector<ImageLevel> buildMipChain(const unsigned char* rgba, int width, int height, MipFilter filter);
+// Block compresses one RGBA8 image without mips, rows split over every hardware thread
+std::vector<unsigned char> compressLevel(const unsigned char* rgba, int width, int height, BlockFormat format);
+
+// Bumped whenever the encoder or mip filter changes, older cache files no longer load
+const unsigned int TEXTURE_CACHE_VERSION = 2;
+
+// DDS with a DX10 header, the same layout compressonator and texconv write, tagged with the cache version
+bool writeDDS(const char* path, const CompressedImage& image);
+// Reads only the header and fails unless the file holds the expected format and cache version.
+// The file is left at the first level for reading the levels in place.
+// The size and format of image are set and its levels left empty.
+bool openDDS(std::ifstream& file, const char* path, BlockFormat format, CompressedImage& image, int& levelCount);
+
@@ -0,0 +1,719 @@
+#include "TextureManager.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include "stb_image.h"
+
+#include "AllocTracker.h"
+#include "GpuMemory.h"
+
+// Comfortably holds a full mip chain of one layer, the ring grows to fit at least one base level
+const size_t STAGING_RING_BYTES = 4 * 1024 * 1024;
+// Level uploads per frame stop here, a single larger level still goes through
+const size_t STREAMING_BYTES_PER_FRAME = 2 * 1024 * 1024;
+// Levels each streaming layer has read ahead of the finest one on the GPU
+const int READ_AHEAD_LEVELS = 2;
+// A level that just arrived blends in over 1 / this many frames
+const float MIN_LOD_FADE_PER_FRAME = 0.05f;
+// Dropping top levels stops before the base level gets smaller than this
+const int MIN_RESIDENT_SIZE = 64;
+// Mid grey albedo and a flat normal until the real levels arrive
+const unsigned char ALBEDO_PLACEHOLDER[4] = { 128, 128, 128, 255 };
+const unsigned char NORMAL_PLACEHOLDER[4] = { 128, 128, 255, 255 };
+
+static const char* SET_NAMES[(int)TextureSet::Count] = { "TextureManager albedo", "TextureManager normal" };
+
+TextureManager::TextureManager(int width, int height, BlockFormat albedoFormat)
+	: mStaging(std::max(STAGING_RING_BYTES, compressedLevelBytes(BlockFormat::BC7, width, height)))
+{
+	mWidth = width;
+	mHeight = height;
+	mLevels = gpuMipLevelCount(width, height);
+	mSets[(int)TextureSet::Albedo].format = albedoFormat;
+	mSets[(int)TextureSet::Normal].format = BlockFormat::BC5;
+	// Albedo is authored in sRGB, the normal set only holds tangent space normals
+	mSets[(int)TextureSet::Albedo].filter = MipFilter::SRGB;
+	mSets[(int)TextureSet::Normal].filter = MipFilter::Normal;
+
+	// A 1x1 image compresses to the single block every placeholder level repeats
+	const unsigned char* placeholders[(int)TextureSet::Count] = { ALBEDO_PLACEHOLDER, NORMAL_PLACEHOLDER };
+	for (int i = 0; i < (int)TextureSet::Count; i++)
+	{
+		mSets[i].placeholder = compressImage(placeholders[i], 1, 1, mSets[i].format, MipFilter::Linear).levels[0];
+		mSets[i].baseLevel = mLevels - 1;
+	}
+
+	mLevelReader = std::thread(&TextureManager::readLevelsMain, this);
+}
+
+TextureManager::LoadResult TextureManager::loadCompressed(const char* path, BlockFormat format, MipFilter filter)
+{
+	LoadResult result;
+	std::string cachePath = std::string(path) + "." + blockFormatName(format) + ".dds";
+	result.cachePath = cachePath;
+
+	// The cache is stale once the source image is saved again
+	std::error_code error;
+	std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(path, error);
+	if (error)
+	{
+		printf("Failed to load %s.\n", path);
+		return result;
+	}
+	std::filesystem::file_time_type cacheTime = std::filesystem::last_write_time(cachePath, error);
+	std::ifstream cacheFile;
+	if (!error && cacheTime >= sourceTime && openDDS(cacheFile, cachePath.c_str(), format, result.image, result.levelCount))
+	{
+		result.loaded = true;
+		result.cacheHit = true;
+		return result;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int width, height, numComponents = 4;
+	unsigned char* data = stbi_load(path, &width, &height, &numComponents, 4);
+	if (data == NULL)
+	{
+		printf("Failed to load %s.\n", path);
+		return result;
+	}
+	std::chrono::steady_clock::time_point decoded = std::chrono::steady_clock::now();
+	result.decodeMs = std::chrono::duration<double, std::milli>(decoded - start).count();
+
+	result.image = compressImage(data, width, height, format, filter);
+	result.levelCount = (int)result.image.levels.size();
+	result.encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decoded).count();
+	stbi_image_free(data);
+
+	if (!writeDDS(cachePath.c_str(), result.image))
+	{
+		printf("Failed to write %s.\n", cachePath.c_str());
+	}
+	result.loaded = true;
+	return result;
+}
+
+// Hands out jobs by index to every hardware thread, the calling thread included, until all ran
+static void runOnThreads(int jobCount, const std::function<void(int)>& job)
+{
+	std::atomic<int> nextJob = 0;
+	auto work = [&]()
+	{
+		for (int i = nextJob++; i < jobCount; i = nextJob++)
+		{
+			job(i);
+		}
+	};
+
+	int threadCount = std::min(std::max(1, (int)std::thread::hardware_concurrency()), jobCount);
+	std::vector<std::thread> threads;
+	for (int i = 1; i < threadCount; i++)
+	{
+		threads.emplace_back([&]()
+		{
+			allocTrackerMarkWorkerThread();
+			work();
+		});
+	}
+	work();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+TextureManager::DecodeBenchmark TextureManager::benchmarkDecode(const std::vector<const char*>& paths)
+{
+	ALLOC_SCOPE("Textures");
+
+	DecodeBenchmark benchmark;
+	auto decode = [&](int i)
+	{
+		int width, height, numComponents;
+		unsigned char* data = stbi_load(paths[i], &width, &height, &numComponents, 4);
+		if (data == NULL)
+		{
+			printf("Failed to load %s.\n", paths[i]);
+			return;
+		}
+		stbi_image_free(data);
+	};
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < (int)paths.size(); i++)
+	{
+		decode(i);
+	}
+	std::chrono::steady_clock::time_point serialEnd = std::chrono::steady_clock::now();
+	runOnThreads((int)paths.size(), [&](int i)
+	{
+		ALLOC_SCOPE("Textures");
+		decode(i);
+	});
+	std::chrono::steady_clock::time_point threadedEnd = std::chrono::steady_clock::now();
+
+	benchmark.images = (int)paths.size();
+	benchmark.serialMs = std::chrono::duration<double, std::milli>(serialEnd - start).count();
+	benchmark.threadedMs = std::chrono::duration<double, std::milli>(threadedEnd - serialEnd).count();
+	return benchmark;
+}
+
+TextureManager::~TextureManager()
+{
+	for (std::thread& loader : mLoaders)
+	{
+		loader.join();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mLevelMutex);
+		mQuit = true;
+	}
+	mLevelWake.notify_one();
+	mLevelReader.join();
+}
+
+void TextureManager::readLevelsMain()
+{
+	allocTrackerMarkWorkerThread();
+	ALLOC_SCOPE("Textures");
+	std::vector<LevelRead> batch;
+	std::string cachePath;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mLevelMutex);
+			mLevelWake.wait(lock, [this]() { return mQuit || !mLevelRequests.empty(); });
+			if (mQuit)
+				return;
+			batch.clear();
+			batch.swap(mLevelRequests);
+		}
+
+		for (LevelRead& read : batch)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mLevelMutex);
+				cachePath = mSets[(int)read.set].cachePaths[read.layer];
+			}
+			readLevel(read, cachePath);
+
+			std::lock_guard<std::mutex> lock(mLevelMutex);
+			if (mQuit)
+				return;
+			mReadLevels.push_back(std::move(read));
+		}
+	}
+}
+
+void TextureManager::readLevel(LevelRead& read, const std::string& cachePath)
+{
+	const ArraySet& arraySet = mSets[(int)read.set];
+	BlockFormat format = arraySet.format;
+
+	// Levels are stored from the largest down
+	size_t levelOffset = 0;
+	for (int i = 0; i < read.level; i++)
+	{
+		levelOffset += compressedLevelBytes(format, std::max(1, mWidth >> i), std::max(1, mHeight >> i));
+	}
+	size_t bytes = compressedLevelBytes(format, std::max(1, mWidth >> read.level), std::max(1, mHeight >> read.level));
+	read.blocks.resize(bytes);
+
+	std::ifstream cacheFile;
+	CompressedImage header;
+	int levelCount;
+	bool readable = openDDS(cacheFile, cachePath.c_str(), format, header, levelCount);
+	if (readable)
+	{
+		cacheFile.seekg(levelOffset, std::ios::cur);
+		cacheFile.read((char*)read.blocks.data(), bytes);
+	}
+	if (!readable || !cacheFile)
+	{
+		printf("Failed to read level %d of %s.\n", read.level, cachePath.c_str());
+		for (size_t block = 0; block < bytes; block += arraySet.placeholder.size())
+		{
+			memcpy(&read.blocks[block], arraySet.placeholder.data(), arraySet.placeholder.size());
+		}
+	}
+}
+
+void TextureManager::requestLevels()
+{
+	// Only taken once there is something to ask for
+	std::unique_lock<std::mutex> lock(mLevelMutex, std::defer_lock);
+	for (int set = 0; set < (int)TextureSet::Count; set++)
+	{
+		ArraySet& arraySet = mSets[set];
+		for (int i = 0; i < (int)arraySet.layers.size(); i++)
+		{
+			Layer& layer = arraySet.layers[i];
+			if (!layer.ready || layer.failed || !layer.image.levels.empty())
+				continue;
+
+			// Levels at and above residentLevel are on the GPU already
+			layer.requestedLevel = std::min(layer.requestedLevel, layer.residentLevel);
+			int lastLevel = std::max(arraySet.droppedLevels, layer.residentLevel - READ_AHEAD_LEVELS);
+			while (layer.requestedLevel > lastLevel)
+			{
+				if (!lock.owns_lock())
+					lock.lock();
+				layer.requestedLevel--;
+				mLevelRequests.push_back({ (TextureSet)set, i, layer.requestedLevel, {} });
+			}
+		}
+	}
+
+	if (!lock.owns_lock())
+		return;
+	lock.unlock();
+	mLevelWake.notify_one();
+}
+
+void TextureManager::collectReadLevels()
+{
+	std::vector<LevelRead> readLevels;
+	{
+		std::lock_guard<std::mutex> lock(mLevelMutex);
+		readLevels.swap(mReadLevels);
+	}
+
+	for (LevelRead& read : readLevels)
+	{
+		ArraySet& arraySet = mSets[(int)read.set];
+		Layer& layer = arraySet.layers[read.layer];
+		// The level may have been dropped while it was read
+		if (read.level < arraySet.droppedLevels || read.level >= layer.residentLevel)
+			continue;
+
+		layer.readLevels.resize(mLevels);
+		layer.readLevels[read.level] = std::move(read.blocks);
+	}
+}
+
+bool TextureManager::hasLevel(const Layer& layer, int level) const
+{
+	return !layer.image.levels.empty() || (level < (int)layer.readLevels.size() && !layer.readLevels[level].empty());
+}
+
+std::vector<int> TextureManager::load(const std::vector<Request>& requests)
+{
+	struct Job
+	{
+		TextureSet set;
+		int layer;
+		std::string path;
+		BlockFormat format;
+		MipFilter filter;
+	};
+
+	// Layers exist right away so materials can point at them, in request order
+	std::vector<Job> jobs;
+	std::vector<int> layers;
+	for (const Request& request : requests)
+	{
+		ArraySet& arraySet = mSets[(int)request.set];
+		Layer layer;
+		layer.name = request.path;
+		layer.residentLevel = mLevels;
+		layer.requestedLevel = mLevels;
+		arraySet.layers.push_back(std::move(layer));
+
+		int index = (int)arraySet.layers.size() - 1;
+		jobs.push_back({ request.set, index, request.path, arraySet.format, arraySet.filter });
+		layers.push_back(index);
+	}
+
+	if (mStreamTimed)
+	{
+		mStreamStart = std::chrono::steady_clock::now();
+		mStreamTimed = false;
+	}
+
+	// One image per worker, each encode also splits its blocks over every core.
+	// Images are handed over as soon as they finish, so the first ones stream while the rest load.
+	mLoaders.emplace_back([this, jobs]()
+	{
+		allocTrackerMarkWorkerThread();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		runOnThreads((int)jobs.size(), [&](int i)
+		{
+			ALLOC_SCOPE("Textures");
+			const Job& job = jobs[i];
+			FinishedLoad finished = { job.set, job.layer, loadCompressed(job.path.c_str(), job.format, job.filter) };
+			std::lock_guard<std::mutex> lock(mFinishedMutex);
+			mFinished.push_back(std::move(finished));
+		});
+
+		std::lock_guard<std::mutex> lock(mFinishedMutex);
+		mFinishedLoadMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	});
+	return layers;
+}
+
+int TextureManager::load(TextureSet set, const char* path)
+{
+	return load({ { set, path } })[0];
+}
+
+int TextureManager::getStreamingLayerCount() const
+{
+	int count = 0;
+	for (const ArraySet& arraySet : mSets)
+	{
+		for (const Layer& layer : arraySet.layers)
+		{
+			count += !layer.failed && layer.residentLevel > arraySet.droppedLevels ? 1 : 0;
+		}
+	}
+	return count;
+}
+
+void TextureManager::collectFinished()
+{
+	std::vector<FinishedLoad> finished;
+	{
+		std::lock_guard<std::mutex> lock(mFinishedMutex);
+		finished.swap(mFinished);
+		mStats.loadMs += mFinishedLoadMs;
+		mFinishedLoadMs = 0.0;
+	}
+
+	for (FinishedLoad& load : finished)
+	{
+		Layer& layer = mSets[(int)load.set].layers[load.layer];
+		LoadResult& result = load.result;
+		layer.ready = true;
+
+		// Layers can't differ in size, there is no resampling here
+		CompressedImage& image = result.image;
+		if (result.loaded && (image.width != mWidth || image.height != mHeight || result.levelCount != mLevels))
+		{
+			printf("%s is %dx%d, the texture arrays are %dx%d.\n", layer.name.c_str(), image.width, image.height, mWidth, mHeight);
+			result.loaded = false;
+		}
+
+		// Finer levels of a failed layer would be sampled once the rest of the array streams in
+		if (!result.loaded)
+		{
+			int droppedLevels = mSets[(int)load.set].droppedLevels;
+			layer.failed = true;
+			for (int level = droppedLevels; level < mLevels; level++)
+			{
+				uploadPlaceholder(load.set, load.layer, level);
+			}
+			layer.residentLevel = droppedLevels;
+			continue;
+		}
+
+		mStats.cacheHits += result.cacheHit ? 1 : 0;
+		mStats.encodedLayers += result.cacheHit ? 0 : 1;
+		mStats.decodeMs += result.decodeMs;
+		mStats.encodeMs += result.encodeMs;
+		for (int level = 0; level < mLevels; level++)
+		{
+			mStats.compressedBytes += compressedLevelBytes(image.format, std::max(1, mWidth >> level), std::max(1, mHeight >> level));
+		}
+		mStats.uncompressedBytes += gpuTextureBytes(GL_RGB8, mWidth, mHeight, 1, mLevels);
+
+		layer.image = std::move(image);
+		layer.cachePath = std::move(result.cachePath);
+		if (layer.image.levels.empty())
+		{
+			// Once per layer, the level reader looks it up by index from then on
+			std::lock_guard<std::mutex> lock(mLevelMutex);
+			std::vector<std::string>& cachePaths = mSets[(int)load.set].cachePaths;
+			cachePaths.resize(std::max(cachePaths.size(), mSets[(int)load.set].layers.size()));
+			cachePaths[load.layer] = layer.cachePath;
+		}
+	}
+}
+
+void TextureManager::reallocate(TextureSet set, int layerCount, int droppedLevels)
+{
+	ArraySet& arraySet = mSets[(int)set];
+	GLenum format = blockFormatGL(arraySet.format);
+	int levels = mLevels - droppedLevels;
+	int width = std::max(1, mWidth >> droppedLevels);
+	int height = std::max(1, mHeight >> droppedLevels);
+
+	TextureHandle texture = genTexture(SET_NAMES[(int)set]);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture.get());
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, format, width, height, layerCount);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// BC7 mode 6 alpha shares the p-bits with the color and can decode to 254
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_A, GL_ONE);
+	gpuTrackResize(GpuResourceType::Texture, texture.get(), gpuTextureBytes(format, width, height, layerCount, levels), format);
+
+	// Copies the levels both storages hold, the ones no layer has streamed yet included
+	int copyLayers = std::min(arraySet.capacity, layerCount);
+	if (copyLayers > 0)
+	{
+		for (int level = std::max(arraySet.droppedLevels, droppedLevels); level < mLevels; level++)
+		{
+			glCopyImageSubData(arraySet.texture.get(), GL_TEXTURE_2D_ARRAY, level - arraySet.droppedLevels, 0, 0, 0,
+				texture.get(), GL_TEXTURE_2D_ARRAY, level - droppedLevels, 0, 0, 0,
+				std::max(1, mWidth >> level), std::max(1, mHeight >> level), copyLayers);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	arraySet.texture = std::move(texture);
+	arraySet.capacity = layerCount;
+	arraySet.droppedLevels = droppedLevels;
+}
+
+void TextureManager::allocate(TextureSet set)
+{
+	// Immutable storage can't grow, the old layers are copied into a larger array
+	ArraySet& arraySet = mSets[(int)set];
+	int oldCapacity = arraySet.capacity;
+	int layerCount = (int)arraySet.layers.size();
+	if (layerCount <= oldCapacity)
+		return;
+
+	reallocate(set, layerCount, arraySet.droppedLevels);
+	for (int i = oldCapacity; i < layerCount; i++)
+	{
+		if (arraySet.layers[i].residentLevel == mLevels)
+		{
+			uploadPlaceholder(set, i, mLevels - 1);
+		}
+	}
+}
+
+size_t TextureManager::storageBytes(TextureSet set, int droppedLevels) const
+{
+	const ArraySet& arraySet = mSets[(int)set];
+	if (arraySet.capacity == 0)
+		return 0;
+	return gpuTextureBytes(blockFormatGL(arraySet.format), std::max(1, mWidth >> droppedLevels), std::max(1, mHeight >> droppedLevels),
+		arraySet.capacity, mLevels - droppedLevels);
+}
+
+bool TextureManager::canDropLevel(TextureSet set) const
+{
+	const ArraySet& arraySet = mSets[(int)set];
+	return arraySet.capacity > 0 && (std::min(mWidth, mHeight) >> (arraySet.droppedLevels + 1)) >= MIN_RESIDENT_SIZE;
+}
+
+size_t TextureManager::dropTopLevel(TextureSet set)
+{
+	if (!canDropLevel(set))
+		return 0;
+
+	ArraySet& arraySet = mSets[(int)set];
+	size_t before = getBytes(set);
+	reallocate(set, arraySet.capacity, arraySet.droppedLevels + 1);
+	for (Layer& layer : arraySet.layers)
+	{
+		layer.residentLevel = std::max(layer.residentLevel, arraySet.droppedLevels);
+		layer.requestedLevel = std::max(layer.requestedLevel, arraySet.droppedLevels);
+		for (int level = 0; level < arraySet.droppedLevels && level < (int)layer.readLevels.size(); level++)
+		{
+			layer.readLevels[level] = std::vector<unsigned char>();
+		}
+	}
+	return before - getBytes(set);
+}
+
+size_t TextureManager::getRestoreBytes(TextureSet set) const
+{
+	const ArraySet& arraySet = mSets[(int)set];
+	if (arraySet.droppedLevels == 0)
+		return 0;
+	return storageBytes(set, arraySet.droppedLevels - 1) - storageBytes(set, arraySet.droppedLevels);
+}
+
+size_t TextureManager::restoreTopLevel(TextureSet set)
+{
+	ArraySet& arraySet = mSets[(int)set];
+	if (arraySet.droppedLevels == 0)
+		return 0;
+
+	// Loaded layers stream the new level in like any other, failed ones get the placeholder again
+	size_t before = getBytes(set);
+	int level = arraySet.droppedLevels - 1;
+	reallocate(set, arraySet.capacity, level);
+	for (int i = 0; i < arraySet.capacity; i++)
+	{
+		if (arraySet.layers[i].failed)
+		{
+			uploadPlaceholder(set, i, level);
+			arraySet.layers[i].residentLevel = level;
+		}
+	}
+	return getBytes(set) - before;
+}
+
+bool TextureManager::takeUsed()
+{
+	bool used = mUsed;
+	mUsed = false;
+	return used;
+}
+
+size_t TextureManager::uploadLevel(TextureSet set, int layerIndex, int level)
+{
+	ArraySet& arraySet = mSets[(int)set];
+	Layer& layer = arraySet.layers[layerIndex];
+	int width = std::max(1, mWidth >> level);
+	int height = std::max(1, mHeight >> level);
+	size_t bytes = compressedLevelBytes(arraySet.format, width, height);
+
+	// From a freshly encoded image, or a level the reader thread loaded from the cache file
+	bool encoded = !layer.image.levels.empty();
+	std::vector<unsigned char>& blocks = encoded ? layer.image.levels[level] : layer.readLevels[level];
+	size_t offset;
+	unsigned char* staging = mStaging.allocate(bytes, offset);
+	memcpy(staging, blocks.data(), bytes);
+	if (!encoded)
+	{
+		blocks = std::vector<unsigned char>();
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mStaging.getBuffer());
+	glBindTexture(GL_TEXTURE_2D_ARRAY, arraySet.texture.get());
+	glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level - arraySet.droppedLevels, 0, 0, layerIndex,
+		width, height, 1, blockFormatGL(arraySet.format), (GLsizei)bytes, (const void*)offset);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	mStaging.release();
+	return bytes;
+}
+
+void TextureManager::uploadPlaceholder(TextureSet set, int layer, int level)
+{
+	ArraySet& arraySet = mSets[(int)set];
+	int width = std::max(1, mWidth >> level);
+	int height = std::max(1, mHeight >> level);
+	size_t bytes = compressedLevelBytes(arraySet.format, width, height);
+
+	size_t offset;
+	unsigned char* staging = mStaging.allocate(bytes, offset);
+	for (size_t block = 0; block < bytes; block += arraySet.placeholder.size())
+	{
+		memcpy(staging + block, arraySet.placeholder.data(), arraySet.placeholder.size());
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mStaging.getBuffer());
+	glBindTexture(GL_TEXTURE_2D_ARRAY, arraySet.texture.get());
+	glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level - arraySet.droppedLevels, 0, 0, layer,
+		width, height, 1, blockFormatGL(arraySet.format), (GLsizei)bytes, (const void*)offset);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	mStaging.release();
+}
+
+void TextureManager::stream()
+{
+	collectReadLevels();
+	requestLevels();
+
+	size_t budget = STREAMING_BYTES_PER_FRAME;
+	while (true)
+	{
+		// The coarsest layer holds its whole array back, so it goes first once its next level is in memory
+		int bestSet = -1;
+		int bestLayer = -1;
+		int bestLevel = 0;
+		for (int set = 0; set < (int)TextureSet::Count; set++)
+		{
+			std::vector<Layer>& layers = mSets[set].layers;
+			for (int i = 0; i < (int)layers.size(); i++)
+			{
+				if (layers[i].ready && !layers[i].failed && layers[i].residentLevel > mSets[set].droppedLevels && layers[i].residentLevel > bestLevel
+					&& hasLevel(layers[i], layers[i].residentLevel - 1))
+				{
+					bestSet = set;
+					bestLayer = i;
+					bestLevel = layers[i].residentLevel;
+				}
+			}
+		}
+		if (bestSet < 0)
+			break;
+
+		// At least one level goes up every frame, even if it's larger than the budget
+		int level = bestLevel - 1;
+		size_t bytes = compressedLevelBytes(mSets[bestSet].format, std::max(1, mWidth >> level), std::max(1, mHeight >> level));
+		if (bytes > budget && budget < STREAMING_BYTES_PER_FRAME)
+			break;
+
+		uploadLevel((TextureSet)bestSet, bestLayer, level);
+		Layer& layer = mSets[bestSet].layers[bestLayer];
+		layer.residentLevel = level;
+		mStats.streamedLevels++;
+		budget -= std::min(budget, bytes);
+
+		// Fully resident layers don't need the encoded copy anymore, dropped levels come back from the cache file
+		if (level == 0)
+		{
+			layer.image.levels.clear();
+			layer.image.levels.shrink_to_fit();
+		}
+	}
+
+	if (!mStreamTimed && getStreamingLayerCount() == 0)
+	{
+		mStats.streamMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mStreamStart).count();
+		mStreamTimed = true;
+	}
+}
+
+void TextureManager::updateClamp(TextureSet set)
+{
+	ArraySet& arraySet = mSets[(int)set];
+	int baseLevel = 0;
+	for (const Layer& layer : arraySet.layers)
+	{
+		baseLevel = std::max(baseLevel, layer.residentLevel);
+	}
+	baseLevel = std::min(baseLevel, mLevels - 1);
+
+	// MIN_LOD is relative to the base level, it starts at the old base and fades to the new one
+	if (baseLevel < arraySet.baseLevel)
+	{
+		arraySet.minLod += (float)(arraySet.baseLevel - baseLevel);
+	}
+	arraySet.baseLevel = baseLevel;
+	arraySet.minLod = std::max(0.0f, arraySet.minLod - MIN_LOD_FADE_PER_FRAME);
+
+	// The storage starts at the first level that wasn't dropped
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, arraySet.baseLevel - arraySet.droppedLevels);
+	glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_LOD, arraySet.minLod);
+}
+
+void TextureManager::bind(int albedoUnit, int normalUnit)
+{
+	for (int i = 0; i < (int)TextureSet::Count; i++)
+	{
+		allocate((TextureSet)i);
+	}
+	collectFinished();
+	stream();
+	mUsed = true;
+
+	const int units[(int)TextureSet::Count] = { albedoUnit, normalUnit };
+	for (int i = 0; i < (int)TextureSet::Count; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + units[i]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, mSets[i].texture.get());
+		if (mSets[i].texture)
+		{
+			updateClamp((TextureSet)i);
+		}
+	}
+}
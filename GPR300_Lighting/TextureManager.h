@@ -0,0 +1,224 @@
+#pragma once
+#include "GL/glew.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GlHandle.h"
+#include "StagingRing.h"
+#include "TextureCompression.h"
+
+// Each set is one texture array, materials pick a layer of every set
+enum class TextureSet
+{
+	Albedo,
+	Normal,
+	Count
+};
+
+/*
+* Material textures packed into one GL_TEXTURE_2D_ARRAY per set.
+* Every layer of a set has the same size and format, so the whole scene draws with the arrays
+* bound once per frame and each material only stores its layer indices.
+* Albedo is stored as BC7 or BC1 and normals as BC5 with z rebuilt in the shader. Every image is
+* encoded with its mips once and cached next to the source as a DDS, later runs load the cache
+* unless the source is newer. Uploads go through a persistently mapped staging ring.
+* Loading never blocks: a new layer shows a 1x1 placeholder while a background thread reads or
+* encodes its image, then its levels stream in from the smallest to the largest under a per frame
+* byte budget. Cached levels are read a few levels ahead on a level reader thread, the render
+* thread only uploads levels that are already in memory. Each array is clamped with
+* GL_TEXTURE_BASE_LEVEL to the finest level every layer has, and GL_TEXTURE_MIN_LOD fades over
+* every level that arrives.
+*/
+class TextureManager
+{
+public:
+	struct Stats
+	{
+		int cacheHits = 0;
+		int encodedLayers = 0;
+		// Summed over the images as timed on their workers, contention inflates it, see benchmarkDecode
+		double decodeMs = 0.0;
+		double encodeMs = 0.0;
+		// Wall time of the loads with the images spread over threads
+		double loadMs = 0.0;
+		// Block compressed mip chains against the same layers as RGB8
+		size_t compressedBytes = 0;
+		size_t uncompressedBytes = 0;
+		int streamedLevels = 0;
+		// From the first load until every layer was fully resident
+		double streamMs = 0.0;
+	};
+
+	// Decode time of the same images one after another and spread over threads
+	struct DecodeBenchmark
+	{
+		int images = 0;
+		double serialMs = 0.0;
+		double threadedMs = 0.0;
+	};
+
+	struct Request
+	{
+		TextureSet set;
+		const char* path;
+	};
+
+	// Every image has to be width x height
+	TextureManager(int width, int height, BlockFormat albedoFormat = BlockFormat::BC7);
+	// Waits for the loader and level reader threads
+	~TextureManager();
+
+	// Returns the layer right away, it shows a placeholder until it streams in and keeps it if the image can't be used
+	int load(TextureSet set, const char* path);
+	// Reads or encodes the images concurrently on a background thread, layers are assigned in request order
+	std::vector<int> load(const std::vector<Request>& requests);
+
+	// Decodes the images with stbi_load serially, then over threads like load does, ignoring the cache. Blocks until done.
+	static DecodeBenchmark benchmarkDecode(const std::vector<const char*>& paths);
+
+	// Streams the next levels and binds the albedo and normal arrays
+	void bind(int albedoUnit, int normalUnit);
+
+	int getLayerCount(TextureSet set) const { return (int)mSets[(int)set].layers.size(); }
+	const char* getLayerName(TextureSet set, int layer) const { return mSets[(int)set].layers[layer].name.c_str(); }
+	BlockFormat getFormat(TextureSet set) const { return mSets[(int)set].format; }
+	// Finest level every layer of the set has on the GPU
+	int getBaseLevel(TextureSet set) const { return mSets[(int)set].baseLevel; }
+	int getStreamingLayerCount() const;
+
+	// Memory of the array storage of a set, for residency decisions
+	size_t getBytes(TextureSet set) const { return storageBytes(set, mSets[(int)set].droppedLevels); }
+	int getDroppedLevels(TextureSet set) const { return mSets[(int)set].droppedLevels; }
+	bool canDropLevel(TextureSet set) const;
+	// Reallocates the array without its finest level, returns the bytes freed
+	size_t dropTopLevel(TextureSet set);
+	// Bytes restoreTopLevel would add
+	size_t getRestoreBytes(TextureSet set) const;
+	// Reallocates the array with its finest dropped level, which then streams in again. Returns the bytes added.
+	size_t restoreTopLevel(TextureSet set);
+	// True if the arrays were bound since the last call
+	bool takeUsed();
+	const Stats& getStats() const { return mStats; }
+	const StagingRing& getStaging() const { return mStaging; }
+
+private:
+	struct Layer
+	{
+		std::string name;
+		// Finest level on the GPU, the level count while only the placeholder is there
+		int residentLevel;
+		// Set once the loader thread is done, the levels stream in from then on
+		bool ready = false;
+		// Images that can't be used keep the placeholder in every level
+		bool failed = false;
+		// Levels are read from the cache file when the image holds none
+		CompressedImage image;
+		std::string cachePath;
+		// Finest level asked of the level reader, the levels it read wait in readLevels until uploaded
+		int requestedLevel;
+		std::vector<std::vector<unsigned char>> readLevels;
+	};
+
+	struct ArraySet
+	{
+		TextureHandle texture;
+		// Format and placeholder are set before the level reader starts and read by it without locking
+		BlockFormat format;
+		MipFilter filter;
+		// Layers the storage was allocated with
+		int capacity = 0;
+		std::vector<Layer> layers;
+		// The level reader's copy of every layer's cache path, guarded by mLevelMutex
+		std::vector<std::string> cachePaths;
+		// One block of the placeholder color
+		std::vector<unsigned char> placeholder;
+		// Storage level i holds level i + droppedLevels, the finer ones were dropped to save memory
+		int droppedLevels = 0;
+		// Finer levels aren't resident in every layer, minLod fades over the levels that just arrived
+		int baseLevel;
+		float minLod = 0.0f;
+	};
+
+	struct LoadResult
+	{
+		bool loaded = false;
+		bool cacheHit = false;
+		double decodeMs = 0.0;
+		double encodeMs = 0.0;
+		// Cache hits only read the header, their levels stay in the file
+		CompressedImage image;
+		int levelCount = 0;
+		std::string cachePath;
+	};
+
+	struct FinishedLoad
+	{
+		TextureSet set;
+		int layer;
+		LoadResult result;
+	};
+
+	// A request to the level reader, which returns it with the level's blocks
+	struct LevelRead
+	{
+		TextureSet set;
+		int layer;
+		int level;
+		std::vector<unsigned char> blocks;
+	};
+
+	// Reads the DDS cache of the image or decodes, encodes and writes it, safe to run on any thread
+	static LoadResult loadCompressed(const char* path, BlockFormat format, MipFilter filter);
+	// Hands the images the loader threads finished to their layers
+	void collectFinished();
+	// Reads requested levels from the cache files until destruction, runs on the level reader thread
+	void readLevelsMain();
+	// Reads one level from the cache file into read.blocks, the placeholder if it can't be read
+	void readLevel(LevelRead& read, const std::string& cachePath);
+	// Asks for the next levels of every layer streaming from its cache file
+	void requestLevels();
+	// Hands the levels the reader finished to their layers
+	void collectReadLevels();
+	// True if the level is in memory, in the encoded image or read from the cache
+	bool hasLevel(const Layer& layer, int level) const;
+	// New storage for the layers without the dropped levels, copying what both storages hold
+	void reallocate(TextureSet set, int layerCount, int droppedLevels);
+	// Grows the storage to every layer, new layers get the placeholder in their 1x1 level
+	void allocate(TextureSet set);
+	size_t storageBytes(TextureSet set, int droppedLevels) const;
+	// Uploads one level of a layer that is in memory, returns the bytes uploaded
+	size_t uploadLevel(TextureSet set, int layer, int level);
+	void uploadPlaceholder(TextureSet set, int layer, int level);
+	// Uploads levels of the coarsest layers first until the frame's budget is spent
+	void stream();
+	void updateClamp(TextureSet set);
+
+	ArraySet mSets[(int)TextureSet::Count];
+	StagingRing mStaging;
+	Stats mStats;
+	int mWidth;
+	int mHeight;
+	int mLevels;
+	bool mUsed = false;
+
+	std::vector<std::thread> mLoaders;
+	// Written by the loader threads
+	std::mutex mFinishedMutex;
+	std::vector<FinishedLoad> mFinished;
+	double mFinishedLoadMs = 0.0;
+	std::chrono::steady_clock::time_point mStreamStart;
+	bool mStreamTimed = true;
+
+	std::thread mLevelReader;
+	// Guards the level requests, the read levels, the sets' cachePaths and mQuit
+	std::mutex mLevelMutex;
+	std::condition_variable mLevelWake;
+	// Swapped with the reader's batch, so both keep their capacity and requesting doesn't allocate once warm
+	std::vector<LevelRead> mLevelRequests;
+	std::vector<LevelRead> mReadLevels;
+	bool mQuit = false;
+};
@@ -0,0 +1,440 @@
+#include "VirtualShadowMap.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "Memory.h"
+
+// The depth range only grows, in steps of this many units so a moving caster doesn't keep widening it
+const float DEPTH_RANGE_STEP = 4.0f;
+
+// Pages requested within this many frames are still worth rendering when invalidated
+const int RECENT_REQUEST_FRAMES = 4;
+
+VirtualShadowMap::VirtualShadowMap(int poolSize, int pageResolution, int pagesPerLevel, int levelCount, float firstLevelSize)
+{
+	mPoolSize = poolSize;
+	mPageResolution = pageResolution;
+	mPoolPagesPerRow = poolSize / pageResolution;
+	mPagesPerLevel = pagesPerLevel;
+	mLevelCount = std::min(levelCount, MAX_VIRTUAL_SHADOW_LEVELS);
+	mFirstPageSize = firstLevelSize / pagesPerLevel;
+
+	int pageCount = mPoolPagesPerRow * mPoolPagesPerRow;
+	mPages.resize(pageCount);
+	mFreePages.reserve(pageCount);
+	for (int i = pageCount - 1; i >= 0; i--)
+	{
+		mFreePages.push_back(i);
+	}
+	mEvictionOrder.reserve(pageCount);
+	mDirtyPages.reserve(pageCount);
+
+	int cellCount = mLevelCount * pagesPerLevel * pagesPerLevel;
+	mCellPages.assign(cellCount, -1);
+	mRequests.resize(cellCount);
+	mPageTable.resize(cellCount);
+
+	for (int i = 0; i < MAX_VIRTUAL_SHADOW_LEVELS; i++)
+	{
+		mLevelOrigins[i] = glm::ivec2(0);
+		mRequestOrigins[0][i] = glm::ivec2(0);
+		mRequestOrigins[1][i] = glm::ivec2(0);
+	}
+
+	mPoolTexture = genTexture("VirtualShadowMap pool");
+	glBindTexture(GL_TEXTURE_2D, mPoolTexture.get());
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, poolSize, poolSize);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gpuTrackResize(GpuResourceType::Texture, mPoolTexture.get(), gpuTextureBytes(GL_DEPTH_COMPONENT32F, poolSize, poolSize), GL_DEPTH_COMPONENT32F);
+
+	// One layer per level, each texel holds the physical page + 1 or 0 when unmapped
+	mPageTableTexture = genTexture("VirtualShadowMap page table");
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mPageTableTexture.get());
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32UI, pagesPerLevel, pagesPerLevel, mLevelCount);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	gpuTrackResize(GpuResourceType::Texture, mPageTableTexture.get(), gpuTextureBytes(GL_R32UI, pagesPerLevel, pagesPerLevel, mLevelCount), GL_R32UI);
+
+	size_t requestBytes = cellCount * sizeof(unsigned int);
+	for (int i = 0; i < 2; i++)
+	{
+		mRequestBuffers[i] = genBuffer("VirtualShadowMap requests");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRequestBuffers[i].get());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, requestBytes, nullptr, GL_DYNAMIC_READ);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		gpuTrackResize(GpuResourceType::Buffer, mRequestBuffers[i].get(), requestBytes, GL_NONE);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	mFBO = genFramebuffer("VirtualShadowMap");
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mPoolTexture.get(), 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Frame buffer is incomplete.\n");
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+VirtualShadowMap::~VirtualShadowMap()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		if (mRequestFences[i])
+		{
+			glDeleteSync(mRequestFences[i]);
+		}
+	}
+}
+
+int VirtualShadowMap::windowCell(int level, int x, int y) const
+{
+	int cellX = x - mLevelOrigins[level].x;
+	int cellY = y - mLevelOrigins[level].y;
+	if (cellX < 0 || cellY < 0 || cellX >= mPagesPerLevel || cellY >= mPagesPerLevel)
+	{
+		return -1;
+	}
+	return (level * mPagesPerLevel + cellY) * mPagesPerLevel + cellX;
+}
+
+void VirtualShadowMap::invalidate()
+{
+	mFreePages.clear();
+	for (int i = (int)mPages.size() - 1; i >= 0; i--)
+	{
+		mPages[i] = VirtualShadowPage();
+		mFreePages.push_back(i);
+	}
+	std::fill(mCellPages.begin(), mCellPages.end(), -1);
+	mStats.fullInvalidations++;
+}
+
+void VirtualShadowMap::update(Camera& camera, glm::vec3 lightDirection, const AABB* objectBounds, int objectCount)
+{
+	mStats.renderedPages = 0;
+	mStats.evictedPages = 0;
+	mStats.invalidatedPages = 0;
+	mStats.droppedRequests = 0;
+
+	// Same light space rotation as the cascades
+	glm::vec3 towardLight = glm::normalize(lightDirection);
+	glm::vec3 up = std::abs(towardLight.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -towardLight, up);
+
+	// Every page depends on the rotation
+	bool invalidateAll = lightView != mLightView || objectCount != mObjectCount;
+	mLightView = lightView;
+
+	mLightBounds.resize(objectCount);
+	mPreviousBounds.resize(objectCount);
+	AABB lightSceneBounds;
+	for (int i = 0; i < objectCount; i++)
+	{
+		AABB lightBounds = transformAABB(objectBounds[i], lightView);
+		lightSceneBounds.expand(lightBounds);
+
+		// Pages under the old and the new position of a moved caster are stale
+		bool moved = objectBounds[i].min != mPreviousBounds[i].min || objectBounds[i].max != mPreviousBounds[i].max;
+		if (moved && !invalidateAll)
+		{
+			AABB dirtyBounds = mLightBounds[i];
+			dirtyBounds.expand(lightBounds);
+			for (VirtualShadowPage& page : mPages)
+			{
+				if (page.level < 0 || !page.rendered)
+					continue;
+
+				float pageSize = mFirstPageSize * (float)(1 << page.level);
+				float minX = page.x * pageSize;
+				float minY = page.y * pageSize;
+				if (dirtyBounds.min.x <= minX + pageSize && dirtyBounds.max.x >= minX
+					&& dirtyBounds.min.y <= minY + pageSize && dirtyBounds.max.y >= minY)
+				{
+					page.rendered = false;
+					mStats.invalidatedPages++;
+				}
+			}
+		}
+
+		mLightBounds[i] = lightBounds;
+		mPreviousBounds[i] = objectBounds[i];
+	}
+	mObjectCount = objectCount;
+
+	// Depth range of every page, a changed range changes every page's projection
+	if (!lightSceneBounds.isEmpty()
+		&& (lightSceneBounds.min.z < mDepthRange.x || lightSceneBounds.max.z > mDepthRange.y || invalidateAll))
+	{
+		mDepthRange.x = std::floor(lightSceneBounds.min.z / DEPTH_RANGE_STEP - 1.0f) * DEPTH_RANGE_STEP;
+		mDepthRange.y = std::ceil(lightSceneBounds.max.z / DEPTH_RANGE_STEP + 1.0f) * DEPTH_RANGE_STEP;
+		invalidateAll = true;
+	}
+
+	if (invalidateAll)
+	{
+		invalidate();
+	}
+
+	// Windows centered on the camera, moving in whole pages
+	glm::vec3 lightCamera = glm::vec3(lightView * glm::vec4(camera.getPosition(), 1.0f));
+	for (int level = 0; level < mLevelCount; level++)
+	{
+		float pageSize = mFirstPageSize * (float)(1 << level);
+		mLevelOrigins[level] = glm::ivec2(glm::floor(glm::vec2(lightCamera) / pageSize)) - mPagesPerLevel / 2;
+	}
+
+	std::fill(mCellPages.begin(), mCellPages.end(), -1);
+	int residentPages = 0;
+	for (int i = 0; i < (int)mPages.size(); i++)
+	{
+		const VirtualShadowPage& page = mPages[i];
+		if (page.level < 0)
+			continue;
+
+		residentPages++;
+		int cell = windowCell(page.level, page.x, page.y);
+		if (cell >= 0)
+		{
+			mCellPages[cell] = i;
+		}
+	}
+	mStats.residentPages = residentPages;
+
+	// Requests written two frames ago into the buffer this frame will reuse
+	int slot = mFrame % 2;
+	if (mRequestFences[slot])
+	{
+		GLenum status = glClientWaitSync(mRequestFences[slot], 0, 0);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+		{
+			readRequests(slot);
+		}
+		else
+		{
+			mStats.missedReadbacks++;
+		}
+		glDeleteSync(mRequestFences[slot]);
+		mRequestFences[slot] = nullptr;
+	}
+
+	// Pages waiting for depth that are still in use, coarse levels first
+	mDirtyPages.clear();
+	for (int i = 0; i < (int)mPages.size(); i++)
+	{
+		const VirtualShadowPage& page = mPages[i];
+		if (page.level >= 0 && !page.rendered && mFrame - page.lastRequestedFrame <= RECENT_REQUEST_FRAMES
+			&& windowCell(page.level, page.x, page.y) >= 0)
+		{
+			mDirtyPages.push_back(i);
+		}
+	}
+	std::sort(mDirtyPages.begin(), mDirtyPages.end(), [this](int a, int b)
+		{
+			if (mPages[a].level != mPages[b].level)
+				return mPages[a].level > mPages[b].level;
+			return mPages[a].lastRequestedFrame > mPages[b].lastRequestedFrame;
+		});
+
+	int renderCount = std::min((int)mDirtyPages.size(), pageRenderBudget);
+	mStats.pendingPages = (int)mDirtyPages.size() - renderCount;
+	mRenders.resize(renderCount);
+	mRenderCasters.resize(renderCount * objectCount);
+	for (int r = 0; r < renderCount; r++)
+	{
+		VirtualShadowPage& page = mPages[mDirtyPages[r]];
+		float pageSize = mFirstPageSize * (float)(1 << page.level);
+		glm::vec2 pageMin = glm::vec2(page.x, page.y) * pageSize;
+		glm::vec2 pageMax = pageMin + pageSize;
+
+		VirtualPageRender& render = mRenders[r];
+		render.page = mDirtyPages[r];
+		render.projection = glm::ortho(pageMin.x, pageMax.x, pageMin.y, pageMax.y, -mDepthRange.y, -mDepthRange.x);
+
+		unsigned char* casters = &mRenderCasters[r * objectCount];
+		for (int o = 0; o < objectCount; o++)
+		{
+			const AABB& bounds = mLightBounds[o];
+			casters[o] = !bounds.isEmpty()
+				&& bounds.min.x <= pageMax.x && bounds.max.x >= pageMin.x
+				&& bounds.min.y <= pageMax.y && bounds.max.y >= pageMin.y;
+		}
+
+		// Rendered before the lit pass samples it this frame
+		page.rendered = true;
+	}
+	mStats.renderedPages = renderCount;
+
+	for (int i = 0; i < (int)mCellPages.size(); i++)
+	{
+		int page = mCellPages[i];
+		mPageTable[i] = page >= 0 && mPages[page].rendered ? page + 1 : 0;
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mPageTableTexture.get());
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, mPagesPerLevel, mPagesPerLevel, mLevelCount,
+		GL_RED_INTEGER, GL_UNSIGNED_INT, mPageTable.data());
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void VirtualShadowMap::readRequests(int slot)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRequestBuffers[slot].get());
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mRequests.size() * sizeof(unsigned int), mRequests.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	mEvictionSorted = false;
+	int requestedPages = 0;
+	int cellsPerLevel = mPagesPerLevel * mPagesPerLevel;
+	// Coarse levels first, if the pool runs out the fine pages are the ones that miss out
+	for (int i = (int)mRequests.size() - 1; i >= 0; i--)
+	{
+		if (mRequests[i] == 0)
+			continue;
+
+		// Back to absolute coordinates with the windows the request was written against
+		int level = i / cellsPerLevel;
+		int x = mRequestOrigins[slot][level].x + i % mPagesPerLevel;
+		int y = mRequestOrigins[slot][level].y + (i % cellsPerLevel) / mPagesPerLevel;
+		int cell = windowCell(level, x, y);
+		if (cell < 0)
+			continue;
+
+		requestedPages++;
+		int pageIndex = mCellPages[cell];
+		if (pageIndex < 0)
+		{
+			pageIndex = allocatePage();
+			if (pageIndex < 0)
+			{
+				mStats.droppedRequests++;
+				continue;
+			}
+
+			VirtualShadowPage& page = mPages[pageIndex];
+			page.level = level;
+			page.x = x;
+			page.y = y;
+			page.rendered = false;
+			mCellPages[cell] = pageIndex;
+		}
+		mPages[pageIndex].lastRequestedFrame = mFrame;
+	}
+	mStats.requestedPages = requestedPages;
+}
+
+int VirtualShadowMap::allocatePage()
+{
+	if (!mFreePages.empty())
+	{
+		int page = mFreePages.back();
+		mFreePages.pop_back();
+		return page;
+	}
+
+	// Least recently requested pages last, built once per read back
+	if (!mEvictionSorted)
+	{
+		mEvictionOrder.clear();
+		for (int i = 0; i < (int)mPages.size(); i++)
+		{
+			if (mPages[i].level >= 0 && mPages[i].lastRequestedFrame < mFrame)
+			{
+				mEvictionOrder.push_back(i);
+			}
+		}
+		std::sort(mEvictionOrder.begin(), mEvictionOrder.end(), [this](int a, int b)
+			{
+				return mPages[a].lastRequestedFrame > mPages[b].lastRequestedFrame;
+			});
+		mEvictionSorted = true;
+	}
+
+	while (!mEvictionOrder.empty())
+	{
+		int page = mEvictionOrder.back();
+		mEvictionOrder.pop_back();
+
+		VirtualShadowPage& evicted = mPages[page];
+		if (evicted.level < 0 || evicted.lastRequestedFrame >= mFrame)
+			continue;
+
+		int cell = windowCell(evicted.level, evicted.x, evicted.y);
+		if (cell >= 0)
+		{
+			mCellPages[cell] = -1;
+		}
+		evicted = VirtualShadowPage();
+		mStats.evictedPages++;
+		return page;
+	}
+
+	return -1;
+}
+
+void VirtualShadowMap::beginRender()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mFBO.get());
+	glEnable(GL_SCISSOR_TEST);
+}
+
+void VirtualShadowMap::beginPage(int render)
+{
+	int page = mRenders[render].page;
+	int x = (page % mPoolPagesPerRow) * mPageResolution;
+	int y = (page / mPoolPagesPerRow) * mPageResolution;
+	glViewport(x, y, mPageResolution, mPageResolution);
+	glScissor(x, y, mPageResolution, mPageResolution);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualShadowMap::endRender()
+{
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void VirtualShadowMap::bindForLighting(int poolUnit, int pageTableUnit)
+{
+	int slot = mFrame % 2;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRequestBuffers[slot].get());
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mRequestBuffers[slot].get());
+
+	for (int i = 0; i < mLevelCount; i++)
+	{
+		mRequestOrigins[slot][i] = mLevelOrigins[i];
+	}
+
+	glActiveTexture(GL_TEXTURE0 + poolUnit);
+	glBindTexture(GL_TEXTURE_2D, mPoolTexture.get());
+	glActiveTexture(GL_TEXTURE0 + pageTableUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mPageTableTexture.get());
+}
+
+void VirtualShadowMap::endFrame()
+{
+	int slot = mFrame % 2;
+	if (mRequestFences[slot])
+	{
+		glDeleteSync(mRequestFences[slot]);
+	}
+	// Makes the shader's writes visible to the read back
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	mRequestFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	mFrame++;
+}
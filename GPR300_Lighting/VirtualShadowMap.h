@@ -0,0 +1,154 @@
+#pragma once
+#include "GL/glew.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "GlHandle.h"
+#include "Bounds.h"
+#include "EW/Camera.h"
+
+const int MAX_VIRTUAL_SHADOW_LEVELS = 12;
+
+// One page of the physical pool
+struct VirtualShadowPage
+{
+	// Clipmap level and absolute light space page coordinates, level -1 while the page is free
+	int level = -1;
+	int x = 0, y = 0;
+	int lastRequestedFrame = 0;
+	// Only rendered pages are mapped in the page table
+	bool rendered = false;
+};
+
+// A page to render this frame
+struct VirtualPageRender
+{
+	int page;
+	glm::mat4 projection;
+};
+
+struct VirtualShadowStats
+{
+	int residentPages;
+	// Distinct pages the lit pass asked for in the last read back frame
+	int requestedPages;
+	int renderedPages;
+	// Allocated pages waiting for the render budget
+	int pendingPages;
+	int evictedPages;
+	int invalidatedPages;
+	// Requests that found every page of the pool in use by the same frame
+	int droppedRequests;
+	// Frames whose requests weren't ready to read back in time
+	int missedReadbacks;
+	int fullInvalidations;
+};
+
+/*
+* Paged shadow map for the directional light.
+* Light space is covered by a clipmap of levels that each double the area of the previous one,
+* every level is a window of pagesPerLevel x pagesPerLevel pages centered on the camera. Only
+* pages the lit pass actually samples get memory: it flags the page it wants in a request buffer,
+* which is read back a couple of frames later and backed by pages of one fixed size depth pool.
+*
+* Pages are keyed by their absolute light space coordinates, so they stay valid as the windows
+* follow the camera and are only re-rendered when a caster moves over them. When the pool is full
+* the least recently requested pages are evicted. Pixels whose page isn't rendered yet fall back to
+* the next coarser resident level.
+*/
+class VirtualShadowMap
+{
+public:
+	// firstLevelSize is the world space width of the finest level
+	VirtualShadowMap(int poolSize, int pageResolution, int pagesPerLevel, int levelCount, float firstLevelSize);
+	~VirtualShadowMap();
+
+	VirtualShadowMap(const VirtualShadowMap&) = delete;
+	VirtualShadowMap& operator=(const VirtualShadowMap&) = delete;
+
+	// Reads back old requests, invalidates pages under moved casters and picks the pages to render
+	void update(Camera& camera, glm::vec3 lightDirection, const AABB* objectBounds, int objectCount);
+
+	// Drops every page, they are rendered again as they get requested
+	void invalidate();
+
+	const glm::mat4& getLightView() const { return mLightView; }
+	int getRenderCount() const { return (int)mRenders.size(); }
+	const VirtualPageRender& getRender(int index) const { return mRenders[index]; }
+	// One flag per object, nonzero if it overlaps the page
+	const unsigned char* getRenderCasters(int index) const { return &mRenderCasters[index * mObjectCount]; }
+
+	// Binds the pool for depth rendering with the scissor test enabled
+	void beginRender();
+	// Restricts rendering to the page and clears it
+	void beginPage(int render);
+	void endRender();
+
+	// Binds the pool, page table and a cleared request buffer for the lit pass
+	void bindForLighting(int poolUnit, int pageTableUnit);
+	// Call after the lit pass so its requests can be read back later
+	void endFrame();
+
+	// Absolute page coordinates of each level's window corner
+	const glm::ivec2* getLevelOrigins() const { return mLevelOrigins; }
+	// Light space z range covered by every page, (min, max)
+	glm::vec2 getDepthRange() const { return mDepthRange; }
+	float getFirstPageSize() const { return mFirstPageSize; }
+	int getLevelCount() const { return mLevelCount; }
+	int getPagesPerLevel() const { return mPagesPerLevel; }
+	int getPageResolution() const { return mPageResolution; }
+	int getPoolPagesPerRow() const { return mPoolPagesPerRow; }
+	int getPoolPageCount() const { return (int)mPages.size(); }
+	unsigned int getPoolTexture() const { return mPoolTexture.get(); }
+	const VirtualShadowStats& getStats() const { return mStats; }
+
+	// Most pages rendered in one frame, coarse levels go first so fallbacks exist early
+	int pageRenderBudget = 64;
+
+private:
+	// Index of a page's cell in the current windows, -1 if it is outside of them
+	int windowCell(int level, int x, int y) const;
+	void readRequests(int slot);
+	int allocatePage();
+
+	TextureHandle mPoolTexture;
+	TextureHandle mPageTableTexture;
+	FramebufferHandle mFBO;
+	BufferHandle mRequestBuffers[2];
+	GLsync mRequestFences[2] = {};
+	// Window origins the requests in each buffer were written with
+	glm::ivec2 mRequestOrigins[2][MAX_VIRTUAL_SHADOW_LEVELS];
+
+	std::vector<VirtualShadowPage> mPages;
+	std::vector<int> mFreePages;
+	std::vector<int> mEvictionOrder;
+	bool mEvictionSorted = false;
+
+	// Page held by every cell of the current windows, -1 when unmapped
+	std::vector<int> mCellPages;
+	std::vector<unsigned int> mRequests;
+	std::vector<unsigned int> mPageTable;
+
+	std::vector<VirtualPageRender> mRenders;
+	std::vector<unsigned char> mRenderCasters;
+	std::vector<int> mDirtyPages;
+
+	// Light space bounds of every object, and the world bounds they were computed from
+	std::vector<AABB> mLightBounds;
+	std::vector<AABB> mPreviousBounds;
+	int mObjectCount = 0;
+
+	glm::mat4 mLightView = glm::mat4(0.0f);
+	glm::vec2 mDepthRange = glm::vec2(0.0f);
+	glm::ivec2 mLevelOrigins[MAX_VIRTUAL_SHADOW_LEVELS];
+
+	int mPoolSize;
+	int mPageResolution;
+	int mPoolPagesPerRow;
+	int mPagesPerLevel;
+	int mLevelCount;
+	float mFirstPageSize;
+	int mFrame = 1;
+
+	VirtualShadowStats mStats = {};
+};
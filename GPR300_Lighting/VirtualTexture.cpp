@@ -0,0 +1,537 @@
+#include "VirtualTexture.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+
+#include "stb_image.h"
+
+#include "AllocTracker.h"
+#include "GpuMemory.h"
+#include "Memory.h"
+#include "TextureCompression.h"
+
+const unsigned int VT_PAGE_FILE_MAGIC = 0x47505456; // "VTPG"
+const int VT_HEADER_WORDS = 8;
+// Holds several frames of page uploads before the ring has to wrap
+const size_t VT_STAGING_BYTES = 1024 * 1024;
+// Pages uploaded per frame, the rest wait for the next frames
+const int VT_UPLOADS_PER_FRAME = 8;
+const GLuint VT_NO_PAGE = 0xFFFFFFFFu;
+
+static bool isPowerOfTwo(int value)
+{
+	return value > 0 && (value & (value - 1)) == 0;
+}
+
+VirtualTexture::VirtualTexture(const char* path, int screenWidth, int screenHeight, int slotsPerSide)
+	: mStaging(VT_STAGING_BYTES)
+	, mFeedback(std::vector<GLenum>{ GL_R32UI }, std::max(1, screenWidth / VT_FEEDBACK_SCALE), std::max(1, screenHeight / VT_FEEDBACK_SCALE))
+{
+	mSourcePath = path;
+	mPagePath = mSourcePath + ".vt";
+	mSlotsPerSide = slotsPerSide;
+	mPageBytes = compressedLevelBytes(BlockFormat::BC7, VT_PAGE_SIZE + 2 * VT_PAGE_BORDER, VT_PAGE_SIZE + 2 * VT_PAGE_BORDER);
+
+	// Only the header is read here, the pixels are decoded on the loader thread if the page file has to be built
+	int width = 0, height = 0, numComponents = 0;
+	bool usable = stbi_info(path, &width, &height, &numComponents) && width == height
+		&& isPowerOfTwo(width) && width >= VT_PAGE_SIZE;
+	if (!usable)
+	{
+		printf("%s can't be used as a virtual texture, it has to be square with a power of two size of at least %d.\n", path, VT_PAGE_SIZE);
+		width = VT_PAGE_SIZE;
+	}
+	mSize = width;
+	mPagesAcross = mSize / VT_PAGE_SIZE;
+	mMipCount = 1;
+	while ((mPagesAcross >> mMipCount) > 0)
+	{
+		mMipCount++;
+	}
+
+	int pageCount = 0;
+	for (int mip = 0; mip < mMipCount; mip++)
+	{
+		int across = mPagesAcross >> mip;
+		mMipOffsets.push_back(pageCount);
+		mTableMirror.push_back(std::vector<unsigned char>(across * across * 4, 0));
+		pageCount += across * across;
+	}
+	mPageSlots.assign(pageCount, -1);
+	mPageQueued.assign(pageCount, false);
+	mPageSeenFrames.assign(pageCount, -1);
+	mSlots.resize(mSlotsPerSide * mSlotsPerSide);
+	// At most one page per slot is queued at a time, so neither the queues nor the page buffers grow past this
+	mRequests.reserve(mSlots.size());
+	mLoaded.reserve(mSlots.size());
+	mUploads.reserve(mSlots.size());
+	mFreeBlocks.reserve(mSlots.size());
+	mPinnedPage = pageIndex(mMipCount - 1, 0, 0);
+
+	mPageTable = genTexture("VirtualTexture page table");
+	glBindTexture(GL_TEXTURE_2D, mPageTable.get());
+	glTexStorage2D(GL_TEXTURE_2D, mMipCount, GL_RGBA8UI, mPagesAcross, mPagesAcross);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	gpuTrackResize(GpuResourceType::Texture, mPageTable.get(), gpuTextureBytes(GL_RGBA8UI, mPagesAcross, mPagesAcross, 1, mMipCount), GL_RGBA8UI);
+
+	int physicalSize = mSlotsPerSide * (VT_PAGE_SIZE + 2 * VT_PAGE_BORDER);
+	mPhysical = genTexture("VirtualTexture physical cache");
+	glBindTexture(GL_TEXTURE_2D, mPhysical.get());
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_COMPRESSED_RGBA_BPTC_UNORM, physicalSize, physicalSize);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	gpuTrackResize(GpuResourceType::Texture, mPhysical.get(),
+		gpuTextureBytes(GL_COMPRESSED_RGBA_BPTC_UNORM, physicalSize, physicalSize, 1, 1), GL_COMPRESSED_RGBA_BPTC_UNORM);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	size_t feedbackBytes = (size_t)mFeedback.getWidth() * mFeedback.getHeight() * sizeof(GLuint);
+	mFeedbackData.resize(mFeedback.getWidth() * mFeedback.getHeight());
+	for (int i = 0; i < 2; i++)
+	{
+		mReadback[i] = genBuffer("VirtualTexture feedback");
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, mReadback[i].get());
+		glBufferData(GL_PIXEL_PACK_BUFFER, feedbackBytes, nullptr, GL_STREAM_READ);
+		gpuTrackResize(GpuResourceType::Buffer, mReadback[i].get(), feedbackBytes, GL_NONE);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	updatePageTable();
+	if (usable)
+	{
+		// The coarsest page is what every pixel falls back to, it goes first and is never evicted
+		mPageQueued[mPinnedPage] = true;
+		mRequests.push_back(mPinnedPage);
+		mQueuedCount = 1;
+		mStats.requestedPages = 1;
+		mLoader = std::thread(&VirtualTexture::loaderMain, this);
+	}
+}
+
+VirtualTexture::~VirtualTexture()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWake.notify_one();
+	if (mLoader.joinable())
+	{
+		mLoader.join();
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (mReadbackFences[i])
+		{
+			glDeleteSync(mReadbackFences[i]);
+		}
+	}
+}
+
+bool VirtualTexture::openPageFile(std::ifstream& file)
+{
+	std::error_code error;
+	std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(mSourcePath, error);
+	if (error)
+		return false;
+	std::filesystem::file_time_type pageTime = std::filesystem::last_write_time(mPagePath, error);
+	if (error || pageTime < sourceTime)
+		return false;
+
+	file.open(mPagePath, std::ios::binary);
+	unsigned int header[VT_HEADER_WORDS] = {};
+	file.read((char*)header, sizeof(header));
+	size_t expectedBytes = sizeof(header) + mPageSlots.size() * mPageBytes;
+	bool matches = file && header[0] == VT_PAGE_FILE_MAGIC && header[1] == TEXTURE_CACHE_VERSION
+		&& header[2] == (unsigned int)BlockFormat::BC7 && header[3] == (unsigned int)mSize
+		&& header[4] == (unsigned int)VT_PAGE_SIZE && header[5] == (unsigned int)VT_PAGE_BORDER
+		&& header[6] == (unsigned int)mMipCount && std::filesystem::file_size(mPagePath, error) == expectedBytes;
+	if (!matches)
+	{
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+bool VirtualTexture::buildPageFile()
+{
+	int width, height, numComponents = 4;
+	unsigned char* data = stbi_load(mSourcePath.c_str(), &width, &height, &numComponents, 4);
+	if (data == NULL || width != mSize || height != mSize)
+	{
+		printf("Failed to load %s.\n", mSourcePath.c_str());
+		stbi_image_free(data);
+		return false;
+	}
+	std::vector<ImageLevel> levels = buildMipChain(data, width, height, MipFilter::SRGB);
+	levels.insert(levels.begin(), ImageLevel{ width, height, std::vector<unsigned char>(data, data + (size_t)width * height * 4) });
+	stbi_image_free(data);
+
+	std::ofstream file(mPagePath, std::ios::binary);
+	const unsigned int header[VT_HEADER_WORDS] = { VT_PAGE_FILE_MAGIC, TEXTURE_CACHE_VERSION, (unsigned int)BlockFormat::BC7,
+		(unsigned int)mSize, (unsigned int)VT_PAGE_SIZE, (unsigned int)VT_PAGE_BORDER, (unsigned int)mMipCount, 0 };
+	file.write((const char*)header, sizeof(header));
+
+	const int paddedSize = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+	std::vector<unsigned char> page((size_t)paddedSize * paddedSize * 4);
+	for (int mip = 0; mip < mMipCount; mip++)
+	{
+		const ImageLevel& level = levels[mip];
+		int across = mPagesAcross >> mip;
+		for (int pageY = 0; pageY < across; pageY++)
+		{
+			for (int pageX = 0; pageX < across; pageX++)
+			{
+				// The border wraps around the level like GL_REPEAT would
+				for (int y = 0; y < paddedSize; y++)
+				{
+					int sourceY = (pageY * VT_PAGE_SIZE - VT_PAGE_BORDER + y) & (level.height - 1);
+					for (int x = 0; x < paddedSize; x++)
+					{
+						int sourceX = (pageX * VT_PAGE_SIZE - VT_PAGE_BORDER + x) & (level.width - 1);
+						memcpy(&page[((size_t)y * paddedSize + x) * 4], &level.rgba[((size_t)sourceY * level.width + sourceX) * 4], 4);
+					}
+				}
+				std::vector<unsigned char> blocks = compressLevel(page.data(), paddedSize, paddedSize, BlockFormat::BC7);
+				file.write((const char*)blocks.data(), blocks.size());
+			}
+		}
+	}
+
+	if (!file)
+	{
+		printf("Failed to write %s.\n", mPagePath.c_str());
+		return false;
+	}
+	return true;
+}
+
+void VirtualTexture::loaderMain()
+{
+	allocTrackerMarkWorkerThread();
+	std::ifstream file;
+	if (!openPageFile(file) && !(buildPageFile() && openPageFile(file)))
+	{
+		// Requests stay queued, the page table keeps pointing nowhere
+		printf("Virtual texture %s has no pages.\n", mSourcePath.c_str());
+		return;
+	}
+
+	while (true)
+	{
+		LoadedPage loaded;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this]() { return mQuit || !mRequests.empty(); });
+			if (mQuit)
+				return;
+			loaded.page = mRequests.front();
+			mRequests.erase(mRequests.begin());
+			if (!mFreeBlocks.empty())
+			{
+				loaded.blocks = std::move(mFreeBlocks.back());
+				mFreeBlocks.pop_back();
+			}
+		}
+
+		// Only allocates until there is a buffer for every page in flight
+		loaded.blocks.resize(mPageBytes);
+		file.seekg(sizeof(unsigned int) * VT_HEADER_WORDS + loaded.page * mPageBytes);
+		file.read((char*)loaded.blocks.data(), mPageBytes);
+		if (!file)
+		{
+			printf("%s ended early.\n", mPagePath.c_str());
+			file.clear();
+		}
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mLoaded.push_back(std::move(loaded));
+	}
+}
+
+void VirtualTexture::beginFeedback(Shader& shader)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mFeedback.getFBO());
+	glViewport(0, 0, mFeedback.getWidth(), mFeedback.getHeight());
+	glEnable(GL_DEPTH_TEST);
+
+	const GLuint noPage[4] = { VT_NO_PAGE, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, noPage);
+	glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+
+	shader.use();
+	shader.setInt("_VTPagesAcross", mPagesAcross);
+	shader.setInt("_VTPageSize", VT_PAGE_SIZE);
+	shader.setInt("_VTMaxMip", mMipCount - 1);
+	// Derivatives at the feedback resolution are that many times larger than on screen
+	shader.setFloat("_VTFeedbackBias", -std::log2((float)VT_FEEDBACK_SCALE));
+}
+
+void VirtualTexture::endFeedback()
+{
+	int slot = mFrame % 2;
+	if (mReadbackFences[slot])
+	{
+		glDeleteSync(mReadbackFences[slot]);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, mReadback[slot].get());
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, mFeedback.getWidth(), mFeedback.getHeight(), GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	mReadbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void VirtualTexture::update()
+{
+	// Feedback of the previous frame, the slot this frame wrote is read on the next one
+	int slot = (mFrame + 1) % 2;
+	if (mReadbackFences[slot])
+	{
+		GLenum status = glClientWaitSync(mReadbackFences[slot], 0, 0);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, mReadback[slot].get());
+			glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, mFeedbackData.size() * sizeof(GLuint), mFeedbackData.data());
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			readFeedback();
+		}
+		else
+		{
+			mStats.missedReadbacks++;
+		}
+		glDeleteSync(mReadbackFences[slot]);
+		mReadbackFences[slot] = nullptr;
+	}
+
+	uploadLoaded();
+	if (mTableDirty)
+	{
+		updatePageTable();
+	}
+	mFrame++;
+}
+
+void VirtualTexture::readFeedback()
+{
+	mFeedbackFrame = mFrame;
+	mStats.visiblePages = 0;
+	mStats.missingPages = 0;
+	FrameVector<int> missing;
+	for (GLuint value : mFeedbackData)
+	{
+		if (value == VT_NO_PAGE)
+			continue;
+
+		int x = value & 0xFFF;
+		int y = (value >> 12) & 0xFFF;
+		int mip = value >> 24;
+		if (mip >= mMipCount || x >= (mPagesAcross >> mip) || y >= (mPagesAcross >> mip))
+			continue;
+
+		int page = pageIndex(mip, x, y);
+		if (mPageSeenFrames[page] == mFrame)
+			continue;
+		mStats.visiblePages++;
+		if (mPageSlots[page] < 0)
+		{
+			mStats.missingPages++;
+		}
+
+		// Ancestors are what the page falls back to until it arrives, they stay too
+		for (; mip < mMipCount; mip++, x /= 2, y /= 2)
+		{
+			page = pageIndex(mip, x, y);
+			if (mPageSeenFrames[page] == mFrame)
+				break;
+			mPageSeenFrames[page] = mFrame;
+			if (mPageSlots[page] >= 0)
+			{
+				mSlots[mPageSlots[page]].lastSeenFrame = mFrame;
+			}
+			else if (!mPageQueued[page])
+			{
+				missing.push_back(page);
+			}
+		}
+	}
+
+	// Coarser mips have larger indices, they cover more and go first
+	std::sort(missing.begin(), missing.end(), std::greater<int>());
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (int page : missing)
+	{
+		// More queued than fits in the cache would only evict pages that are in view
+		if (mQueuedCount >= (int)mSlots.size())
+			break;
+		mPageQueued[page] = true;
+		mRequests.push_back(page);
+		mQueuedCount++;
+		mStats.requestedPages++;
+	}
+	mWake.notify_one();
+}
+
+int VirtualTexture::findSlot()
+{
+	int best = -1;
+	for (int i = 0; i < (int)mSlots.size(); i++)
+	{
+		const Slot& slot = mSlots[i];
+		if (slot.page < 0)
+			return i;
+		if (slot.page == mPinnedPage || slot.lastSeenFrame >= mFeedbackFrame)
+			continue;
+		if (best < 0 || slot.lastSeenFrame < mSlots[best].lastSeenFrame)
+		{
+			best = i;
+		}
+	}
+	return best;
+}
+
+void VirtualTexture::uploadLoaded()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (LoadedPage& loaded : mLoaded)
+		{
+			mUploads.push_back(std::move(loaded));
+		}
+		mLoaded.clear();
+	}
+
+	const int paddedSize = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+	int uploaded = 0;
+	glBindTexture(GL_TEXTURE_2D, mPhysical.get());
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mStaging.getBuffer());
+	int taken = 0;
+	while (taken < (int)mUploads.size() && uploaded < VT_UPLOADS_PER_FRAME)
+	{
+		LoadedPage& loaded = mUploads[taken++];
+		mPageQueued[loaded.page] = false;
+		mQueuedCount--;
+
+		int slotIndex = findSlot();
+		if (slotIndex < 0)
+			continue;
+		Slot& slot = mSlots[slotIndex];
+		if (slot.page >= 0)
+		{
+			mPageSlots[slot.page] = -1;
+			mStats.evictedPages++;
+		}
+		slot.page = loaded.page;
+		slot.lastSeenFrame = mPageSeenFrames[loaded.page];
+		mPageSlots[loaded.page] = slotIndex;
+
+		size_t offset;
+		unsigned char* staging = mStaging.allocate(mPageBytes, offset);
+		memcpy(staging, loaded.blocks.data(), mPageBytes);
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, (slotIndex % mSlotsPerSide) * paddedSize, (slotIndex / mSlotsPerSide) * paddedSize,
+			paddedSize, paddedSize, GL_COMPRESSED_RGBA_BPTC_UNORM, (GLsizei)mPageBytes, (const void*)offset);
+		uploaded++;
+		mStats.uploadedPages++;
+		mTableDirty = true;
+	}
+	mStaging.release();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (int i = 0; i < taken; i++)
+		{
+			mFreeBlocks.push_back(std::move(mUploads[i].blocks));
+		}
+	}
+	mUploads.erase(mUploads.begin(), mUploads.begin() + taken);
+
+	mReady = mPageSlots[mPinnedPage] >= 0;
+}
+
+void VirtualTexture::updatePageTable()
+{
+	glBindTexture(GL_TEXTURE_2D, mPageTable.get());
+	for (int mip = mMipCount - 1; mip >= 0; mip--)
+	{
+		int across = mPagesAcross >> mip;
+		std::vector<unsigned char>& entries = mTableMirror[mip];
+		for (int y = 0; y < across; y++)
+		{
+			for (int x = 0; x < across; x++)
+			{
+				unsigned char* entry = &entries[(y * across + x) * 4];
+				int slot = mPageSlots[pageIndex(mip, x, y)];
+				if (slot >= 0)
+				{
+					entry[0] = (unsigned char)(slot % mSlotsPerSide);
+					entry[1] = (unsigned char)(slot / mSlotsPerSide);
+					entry[2] = (unsigned char)mip;
+					entry[3] = 1;
+				}
+				else if (mip + 1 < mMipCount)
+				{
+					// The parent entry is already final, coarser mips are done first
+					memcpy(entry, &mTableMirror[mip + 1][((y / 2) * (across / 2) + x / 2) * 4], 4);
+				}
+				else
+				{
+					memset(entry, 0, 4);
+				}
+			}
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, mip, 0, 0, across, across, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	mTableDirty = false;
+}
+
+void VirtualTexture::bind(Shader& shader, int pageTableUnit, int physicalUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + pageTableUnit);
+	glBindTexture(GL_TEXTURE_2D, mPageTable.get());
+	glActiveTexture(GL_TEXTURE0 + physicalUnit);
+	glBindTexture(GL_TEXTURE_2D, mPhysical.get());
+
+	shader.setInt("_VTPageTable", pageTableUnit);
+	shader.setInt("_VTPhysical", physicalUnit);
+	shader.setInt("_VTPagesAcross", mPagesAcross);
+	shader.setInt("_VTPageSize", VT_PAGE_SIZE);
+	shader.setInt("_VTPageBorder", VT_PAGE_BORDER);
+	shader.setInt("_VTMaxMip", mMipCount - 1);
+	shader.setFloat("_VTPhysicalSize", (float)(mSlotsPerSide * (VT_PAGE_SIZE + 2 * VT_PAGE_BORDER)));
+}
+
+int VirtualTexture::getResidentPageCount() const
+{
+	int count = 0;
+	for (const Slot& slot : mSlots)
+	{
+		if (slot.page >= 0)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+size_t VirtualTexture::getBytes() const
+{
+	int physicalSize = mSlotsPerSide * (VT_PAGE_SIZE + 2 * VT_PAGE_BORDER);
+	return gpuTextureBytes(GL_COMPRESSED_RGBA_BPTC_UNORM, physicalSize, physicalSize, 1, 1)
+		+ gpuTextureBytes(GL_RGBA8UI, mPagesAcross, mPagesAcross, 1, mMipCount);
+}
+
+size_t VirtualTexture::getSourceBytes() const
+{
+	return gpuTextureBytes(GL_COMPRESSED_RGBA_BPTC_UNORM, mSize, mSize, 1, gpuMipLevelCount(mSize, mSize));
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include "GL/glew.h"
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GlHandle.h"
+#include "RenderTargets.h"
+#include "StagingRing.h"
+#include "EW/Shader.h"
+
+// Texels of a page without its border
+const int VT_PAGE_SIZE = 128;
+// Copied from the neighbouring pages on every side so bilinear filtering never reads another slot
+const int VT_PAGE_BORDER = 4;
+// The feedback pass renders at 1 / VT_FEEDBACK_SCALE of the screen in each direction
+const int VT_FEEDBACK_SCALE = 8;
+
+/*
+* One large albedo texture of which only the pages the camera sees are on the GPU.
+* The source is cut into 128x128 pages at every mip level, each BC7 encoded with a border and
+* stored in a page file next to the source, which is built on a background thread the first time
+* and whenever the source is newer.
+* A physical cache texture holds a fixed number of page slots and a page table texture with one
+* texel per page and mip points each page at the finest resident page covering it, so memory
+* stays the same however large the source is.
+* A feedback pass renders the page and mip every pixel wants into a small integer target. Its
+* readback is picked up a frame or two later without waiting, missing pages are read from the
+* page file on a loader thread, coarsest first, and uploaded under a per frame budget into the
+* least recently seen slot. The coarsest page is always resident, so every pixel has something.
+*/
+class VirtualTexture
+{
+public:
+	struct Stats
+	{
+		int requestedPages = 0;
+		int uploadedPages = 0;
+		int evictedPages = 0;
+		// Feedback that wasn't ready when it was checked, it is read on a later frame
+		int missedReadbacks = 0;
+		// Pages the last feedback asked for
+		int visiblePages = 0;
+		// Of those, pages drawn with a coarser ancestor
+		int missingPages = 0;
+	};
+
+	// The source has to be square with a power of two size of at least one page
+	VirtualTexture(const char* path, int screenWidth, int screenHeight, int slotsPerSide = 8);
+	// Waits for the loader thread
+	~VirtualTexture();
+
+	VirtualTexture(const VirtualTexture&) = delete;
+	VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+	// Binds and clears the feedback target and sets the feedback uniforms, draw the virtually textured objects after
+	void beginFeedback(Shader& shader);
+	// Starts the readback of the feedback, the viewport is left for the caller to restore
+	void endFeedback();
+
+	// Reads finished feedback, requests the missing pages and uploads the ones that were loaded. Once per frame.
+	void update();
+	// Binds the page table and physical cache and sets the sampling uniforms
+	void bind(Shader& shader, int pageTableUnit, int physicalUnit);
+
+	bool isReady() const { return mReady; }
+	int getSize() const { return mSize; }
+	int getMipCount() const { return mMipCount; }
+	int getPageCount() const { return (int)mPageSlots.size(); }
+	int getSlotCount() const { return (int)mSlots.size(); }
+	int getResidentPageCount() const;
+	// Physical cache and page table, the only texture memory the virtual texture has
+	size_t getBytes() const;
+	size_t getSourceBytes() const;
+	const Stats& getStats() const { return mStats; }
+
+private:
+	struct Slot
+	{
+		int page = -1;
+		int lastSeenFrame = -1;
+	};
+
+	struct LoadedPage
+	{
+		int page;
+		std::vector<unsigned char> blocks;
+	};
+
+	// Page index of a page of a mip, mip 0 first and every mip row-major
+	int pageIndex(int mip, int x, int y) const { return mMipOffsets[mip] + y * (mPagesAcross >> mip) + x; }
+	// Checks the page file or builds it, then reads requested pages until destruction. Runs on the loader thread.
+	void loaderMain();
+	bool buildPageFile();
+	bool openPageFile(std::ifstream& file);
+	// Marks the pages in the finished feedback and their ancestors as seen, queues the missing ones
+	void readFeedback();
+	void uploadLoaded();
+	// Free slot or the least recently seen one not seen by the last feedback, -1 if every slot is in view
+	int findSlot();
+	// Points every page at its finest resident ancestor and uploads the table
+	void updatePageTable();
+
+	std::string mSourcePath;
+	std::string mPagePath;
+	int mSize = 0;
+	int mPagesAcross = 0;
+	int mMipCount = 0;
+	std::vector<int> mMipOffsets;
+	size_t mPageBytes;
+
+	TextureHandle mPageTable;
+	TextureHandle mPhysical;
+	int mSlotsPerSide;
+	StagingRing mStaging;
+	bool mReady = false;
+	bool mTableDirty = true;
+
+	// Slot of every page, -1 if not resident
+	std::vector<int> mPageSlots;
+	// Queued for or being read by the loader thread, or waiting for upload
+	std::vector<bool> mPageQueued;
+	int mQueuedCount = 0;
+	// Frame of the last feedback that wanted the page or one it covers
+	std::vector<int> mPageSeenFrames;
+	std::vector<Slot> mSlots;
+	int mPinnedPage;
+	// Per mip RGBA8UI entries: slot x, slot y, resident mip, 1 once anything is resident
+	std::vector<std::vector<unsigned char>> mTableMirror;
+	// Loaded pages beyond the frame's upload budget, oldest first
+	std::vector<LoadedPage> mUploads;
+
+	FrameBuffer mFeedback;
+	std::vector<GLuint> mFeedbackData;
+	BufferHandle mReadback[2];
+	GLsync mReadbackFences[2] = {};
+	int mFrame = 0;
+	// Slots seen by the feedback read on this frame are never evicted
+	int mFeedbackFrame = -1;
+
+	std::thread mLoader;
+	// Guards the requests, the loaded pages, the free page buffers and mQuit
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	// These queues never hold more than one page per slot, they are reserved for that and don't allocate
+	std::vector<int> mRequests;
+	std::vector<LoadedPage> mLoaded;
+	// Blocks of uploaded pages, handed back to the loader to read the next pages into
+	std::vector<std::vector<unsigned char>> mFreeBlocks;
+	bool mQuit = false;
+
+	Stats mStats;
+};
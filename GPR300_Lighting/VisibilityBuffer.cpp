@@ -0,0 +1,153 @@
+#include "VisibilityBuffer.h"
+
+#include <stdio.h>
+
+#include "GpuMemory.h"
+
+VisibilityBuffer::VisibilityBuffer(int width, int height, unsigned int outputTexture)
+	: mIdBuffer(std::vector<GLenum>{ GL_R32UI }, width, height)
+{
+	// The resolve writes the output while keeping the visibility depth for later forward draws
+	mResolveFBO = genFramebuffer("VisibilityBuffer resolve");
+	glBindFramebuffer(GL_FRAMEBUFFER, mResolveFBO.get());
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outputTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, mIdBuffer.getDepthTexture(), 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Visibility resolve frame buffer is incomplete.\n");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	mEmptyVAO = genVertexArray("VisibilityBuffer resolve");
+	mVertexBuffer = genBuffer("VisibilityBuffer vertices");
+	mIndexBuffer = genBuffer("VisibilityBuffer indices");
+	mObjectBuffer = genBuffer("VisibilityBuffer objects");
+}
+
+int VisibilityBuffer::addMesh(const ew::MeshData& meshData)
+{
+	MeshRange range;
+	range.firstIndex = (int)mIndices.size();
+	range.firstVertex = (int)mVertices.size();
+	mMeshes.push_back(range);
+
+	mVertices.insert(mVertices.end(), meshData.vertices.begin(), meshData.vertices.end());
+	mIndices.insert(mIndices.end(), meshData.indices.begin(), meshData.indices.end());
+	mGeometryDirty = true;
+	return (int)mMeshes.size() - 1;
+}
+
+void VisibilityBuffer::setObjects(const glm::mat4* models, const int* meshes, const int* materials, int objectCount)
+{
+	if (objectCount > MAX_VISIBILITY_OBJECTS)
+	{
+		printf("Visibility buffer ids only fit %d objects.\n", MAX_VISIBILITY_OBJECTS);
+		objectCount = MAX_VISIBILITY_OBJECTS;
+	}
+
+	mObjects.resize(objectCount);
+	for (int i = 0; i < objectCount; i++)
+	{
+		const MeshRange& range = mMeshes[meshes[i]];
+		mObjects[i].model = models[i];
+		mObjects[i].normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(models[i]))));
+		mObjects[i].mesh = glm::ivec4(range.firstIndex, range.firstVertex, materials[i], 0);
+	}
+
+	size_t bytes = mObjects.size() * sizeof(GpuObject);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mObjectBuffer.get());
+	if (bytes > mObjectBufferSize)
+	{
+		glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, mObjects.data(), GL_DYNAMIC_DRAW);
+		gpuTrackResize(GpuResourceType::Buffer, mObjectBuffer.get(), bytes, GL_NONE);
+		mObjectBufferSize = bytes;
+	}
+	else if (bytes > 0)
+	{
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, mObjects.data());
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+size_t VisibilityBuffer::getTargetBytes() const
+{
+	return (size_t)getBytesPerPixel() * mIdBuffer.getWidth() * mIdBuffer.getHeight();
+}
+
+int VisibilityBuffer::getBytesPerPixel() const
+{
+	return (int)(gpuTextureBytes(GL_R32UI, 1, 1) + gpuTextureBytes(GL_DEPTH24_STENCIL8, 1, 1));
+}
+
+size_t VisibilityBuffer::getGeometryBytes() const
+{
+	return mVertices.size() * sizeof(ew::Vertex) + mIndices.size() * sizeof(unsigned int);
+}
+
+void VisibilityBuffer::beginGeometry()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mIdBuffer.getFBO());
+	glViewport(0, 0, mIdBuffer.getWidth(), mIdBuffer.getHeight());
+	glEnable(GL_DEPTH_TEST);
+
+	const GLuint emptyId[4] = { 0xFFFFFFFFu, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, emptyId);
+	glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+}
+
+void VisibilityBuffer::endGeometry()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void VisibilityBuffer::beginResolve()
+{
+	if (mGeometryDirty)
+	{
+		size_t vertexBytes = mVertices.size() * sizeof(ew::Vertex);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mVertexBuffer.get());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, vertexBytes, mVertices.data(), GL_STATIC_DRAW);
+		gpuTrackResize(GpuResourceType::Buffer, mVertexBuffer.get(), vertexBytes, GL_NONE);
+
+		size_t indexBytes = mIndices.size() * sizeof(unsigned int);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mIndexBuffer.get());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, indexBytes, mIndices.data(), GL_STATIC_DRAW);
+		gpuTrackResize(GpuResourceType::Buffer, mIndexBuffer.get(), indexBytes, GL_NONE);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		mGeometryDirty = false;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mResolveFBO.get());
+	glViewport(0, 0, mIdBuffer.getWidth(), mIdBuffer.getHeight());
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void VisibilityBuffer::bindForResolve(Shader& shader, Camera& camera, int idUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + idUnit);
+	glBindTexture(GL_TEXTURE_2D, mIdBuffer.getTexture(0));
+	shader.setInt("_VisibilityIds", idUnit);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, mVertexBuffer.get());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, mIndexBuffer.get());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, mObjectBuffer.get());
+
+	glm::mat4 view = camera.getViewMatrix();
+	shader.setMat4("_View", view);
+	shader.setMat4("_ViewProjection", camera.getProjectionMatrix() * view);
+}
+
+void VisibilityBuffer::drawResolve()
+{
+	// Every covered pixel is shaded once, depth is only read
+	glDisable(GL_DEPTH_TEST);
+	glBindVertexArray(mEmptyVAO.get());
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+}
+
+void VisibilityBuffer::endResolve()
+{
+	glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "GL/glew.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "GlHandle.h"
+#include "RenderTargets.h"
+#include "EW/Camera.h"
+#include "EW/Mesh.h"
+#include "EW/Shader.h"
+
+// Visibility ids pack the object index above the triangle index, all bits set where nothing was drawn
+const int VISIBILITY_TRIANGLE_BITS = 24;
+const int MAX_VISIBILITY_OBJECTS = 1 << (32 - VISIBILITY_TRIANGLE_BITS);
+
+/*
+* Visibility buffer renderer.
+* The geometry pass only writes a 32 bit object and triangle id next to depth, so overdraw costs
+* a depth test and one integer write. A fullscreen resolve then looks the triangle up in shared
+* vertex and index buffers, rebuilds perspective correct barycentrics and their screen space
+* derivatives from the pixel position, and lights every pixel exactly once.
+*/
+class VisibilityBuffer
+{
+public:
+	// Lighting is written to outputTexture, which has to be width x height
+	VisibilityBuffer(int width, int height, unsigned int outputTexture);
+
+	VisibilityBuffer(const VisibilityBuffer&) = delete;
+	VisibilityBuffer& operator=(const VisibilityBuffer&) = delete;
+
+	// Copies the mesh into the shared buffers the resolve pass reads, returns its mesh index
+	int addMesh(const ew::MeshData& meshData);
+
+	// Model matrix, mesh and material index of every object id the geometry pass writes
+	void setObjects(const glm::mat4* models, const int* meshes, const int* materials, int objectCount);
+
+	// Binds and clears the id buffer, draw each object with its index in _ObjectIndex
+	void beginGeometry();
+	void endGeometry();
+
+	// Binds the output with the visibility depth and clears its color
+	void beginResolve();
+	// Binds the ids to the texture unit, the geometry to storage bindings 5 to 7 and sets the camera uniforms
+	void bindForResolve(Shader& shader, Camera& camera, int idUnit);
+	void drawResolve();
+	// The output stays bound with the visibility depth for forward drawing
+	void endResolve();
+
+	unsigned int getIdTexture() const { return mIdBuffer.getTexture(0); }
+	size_t getTargetBytes() const;
+	int getBytesPerPixel() const;
+	size_t getGeometryBytes() const;
+
+private:
+	// std430 layout matching defaultLit.frag
+	struct GpuObject
+	{
+		glm::mat4 model;
+		// mat3 columns padded to vec4
+		glm::mat4 normalMatrix;
+		// x first index, y first vertex, z material
+		glm::ivec4 mesh;
+	};
+
+	struct MeshRange
+	{
+		int firstIndex;
+		int firstVertex;
+	};
+
+	FrameBuffer mIdBuffer;
+	FramebufferHandle mResolveFBO;
+	VertexArrayHandle mEmptyVAO;
+
+	BufferHandle mVertexBuffer;
+	BufferHandle mIndexBuffer;
+	BufferHandle mObjectBuffer;
+	size_t mObjectBufferSize = 0;
+
+	std::vector<ew::Vertex> mVertices;
+	std::vector<unsigned int> mIndices;
+	std::vector<MeshRange> mMeshes;
+	std::vector<GpuObject> mObjects;
+	// The shared buffers are uploaded again before the next resolve after a mesh is added
+	bool mGeometryDirty = false;
+};
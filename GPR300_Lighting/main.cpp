@@ -9,7 +9,15 @@
 #include <stdio.h>
 
 #include <iostream>
+#include <algorithm>
+#include <random>
 
+#include "AllocTracker.h"
+
+// Route stb_image's buffers through the allocation tracker
+#define STBI_MALLOC(size) trackedMalloc(size)
+#define STBI_REALLOC(ptr, size) trackedRealloc(ptr, size)
+#define STBI_FREE(ptr) trackedFree(ptr)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -24,6 +32,26 @@
 #include "EW/Transform.h"
 #include "EW/ShapeGen.h"
 
+#include "Memory.h"
+#include "GpuMemory.h"
+#include "GlHandle.h"
+#include "RenderTargets.h"
+#include "GpuTimer.h"
+#include "CascadedShadows.h"
+#include "Bounds.h"
+#include "ShadowMoments.h"
+#include "ShadowMinMax.h"
+#include "PointShadows.h"
+#include "LocalLights.h"
+#include "VirtualShadowMap.h"
+#include "LightClusters.h"
+#include "DeferredShading.h"
+#include "VisibilityBuffer.h"
+#include "MaterialTable.h"
+#include "TextureManager.h"
+#include "ResidencyManager.h"
+#include "VirtualTexture.h"
+
 void processInput(GLFWwindow* window);
 void resizeFrameBufferCallback(GLFWwindow* window, int width, int height);
 void keyboardCallback(GLFWwindow* window, int keycode, int scancode, int action, int mods);
@@ -91,13 +119,6 @@ struct SpotLight
 	float angleFalloff;
 };
 
-struct Material
-{
-	glm::vec3 color;
-	float ambientK, diffuseK, specularK; // (0-1 range)
-	float shininess = 1; // (1-512 range)
-};
-
 int numPointLights = 0;
 glm::vec3 pointLightOrbitCenter;
 float pointLightOrbitRange;
@@ -106,255 +127,175 @@ float pointLightOrbitSpeed;
 DirectionalLight _DirectionalLight;
 PointLight _PointLight;
 SpotLight _SpotLight;
-Material _Material;
-
-// Not sure if this is the best spot to be putting this
-GLuint getTexture(const char* texturePath)
-{
-	// Generate a new texture and bind its location
-	GLuint texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-
-	// Have the loaded texture wrap on the s and t axes
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	// Generate mipmaps for minification of a texture and linearly filter between them
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	// Linearly filter textures when magnifying
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	// Load image data from path
-	int width, height, numComponents = 3;
-	unsigned char* data = stbi_load(texturePath, &width, &height, &numComponents, 0);
-
-	if (data != NULL)
-	{
-		// Generate a texture and mipmap from the given image data
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-	}
+// Models
+// Global for the sake of convenience
+ew::Transform cubeTransform;
+ew::Transform rectangleTransform;
+ew::Transform sphereTransform;
+ew::Transform planeTransform;
+ew::Transform cylinderTransform;
+ew::Transform quadTransform;
+ew::Transform depthQuadTransform;
+ew::Transform atlasQuadTransform;
+ew::Transform lightTransform;
 
-	else
-	{
-		std::cout << "Failed." << std::endl;
-	}
+ew::MeshData cubeMeshData;
+ew::MeshData sphereMeshData;
+ew::MeshData rectangleMeshData;
+ew::MeshData planeMeshData;
+ew::MeshData cylinderMeshData;
+ew::MeshData quadMeshData;
+ew::MeshData depthQuadMeshData;
 
-	stbi_image_free(data);
-	// Return the generated texture
-	return texture;
-}
+ew::Mesh cubeMesh;
+ew::Mesh sphereMesh;
+ew::Mesh rectangleMesh;
+ew::Mesh planeMesh;
+ew::Mesh cylinderMesh;
+ew::Mesh quadMesh;
+ew::Mesh depthQuadMesh;
 
-// Going fullscreen messes this up because it isn't being properly
-// resized to fit the new dimensions of the fullscreen viewport. (I think)
-class FrameBuffer
+struct SceneObject
 {
-public:
-	/* 
-	* Init frame buffer
-	* Limitation of this implementation is that it messes with glSetActiveTexture
-	* by overwriting the active texture with the texture being created here.
-	*/
-	FrameBuffer(int colorBuffers, int width, int height)
-	{
-		mWidth = width;
-		mHeight = height;
-		mTexturesLength = colorBuffers;
-		textures = new unsigned int[mTexturesLength];
-
-		// Create frame buffer object
-		glGenFramebuffers(1, &fbo);
+	const char* name;
+	ew::Transform* transform;
+	ew::Mesh* mesh;
+	ew::MeshData* meshData;
 
-		// Bind frame buffer to GL_FRAMEBUFFER target
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	// Static objects stay in the cached shadow layer until they move
+	bool isStatic;
 
-		// Create texture color buffers
-		glGenTextures(mTexturesLength, textures);
+	// Model matrix the shadow cache last saw
+	glm::mat4 cachedModel;
 
-		// Stores attachments to be passed into glDrawBuffers
-		// This implementation doesn't feel right
-		unsigned int* attachments = new unsigned int[mTexturesLength];
-
-		// Create textures for each generate color buffer
-		for (int i = 0; i < mTexturesLength; i++)
-		{
-			glBindTexture(GL_TEXTURE_2D, textures[i]);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glBindTexture(GL_TEXTURE_2D, 0);
-
-			// Attach the texture to the corresponding frame buffer slot
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textures[i], 0);
-
-			// Add the attachment to the attachment array
-			attachments[i] = GL_COLOR_ATTACHMENT0 + i;
-		}
+	// Bounds of the mesh data, filled in once the meshes are created
+	AABB localBounds;
 
-		// Create render buffer object
-		glGenRenderbuffers(1, &rbo);
-		glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-
-		// Allocate space for the depth component
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
-		glBindRenderbuffer(GL_RENDERBUFFER, 0);
-
-		// Attach render buffer object to the frame buffer
-		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo);
-
-		// Specify how many attachments are being used in drawing
-		glDrawBuffers(mTexturesLength, attachments);
-
-		// Deallocate attachments array
-		delete[] attachments;
+	// Index into the material table, every object gets its own
+	int material;
+};
 
-		// Check for completeness
-		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		{
-			printf("Frame buffer is incomplete.\n");
-		}
+SceneObject sceneObjects[] =
+{
+	{ "Cube", &cubeTransform, &cubeMesh, &cubeMeshData, true },
+	{ "Rectangle", &rectangleTransform, &rectangleMesh, &rectangleMeshData, true },
+	{ "Sphere", &sphereTransform, &sphereMesh, &sphereMeshData, false },
+	{ "Cylinder", &cylinderTransform, &cylinderMesh, &cylinderMeshData, true },
+	{ "Plane", &planeTransform, &planeMesh, &planeMeshData, true },
+};
+const int SCENE_OBJECT_COUNT = sizeof(sceneObjects) / sizeof(sceneObjects[0]);
 
-		else
-		{
-			printf("Successfully created frame buffer.\n");
-		}
+enum class DrawFilter
+{
+	All,
+	Static,
+	Dynamic
+};
 
-		// Unbind framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	}
+// visible optionally holds one flag per scene object, objects with a zero flag are skipped
+void drawScene(Shader& targetShader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix, DrawFilter filter = DrawFilter::All, const unsigned char* visible = nullptr)
+{
+	targetShader.setMat4("_View", viewMatrix);
+	targetShader.setMat4("_Projection", projectionMatrix);
 
-	// Delete the frame buffer and its components
-	// Not sure if memory with textures is cleaned up properly.
-	~FrameBuffer()
+	for (int i = 0; i < SCENE_OBJECT_COUNT; i++)
 	{
-		glDeleteRenderbuffers(1, &rbo);
-		glDeleteTextures(mTexturesLength, textures);
-		glDeleteFramebuffers(1, &fbo);
-
-		delete[] textures;
-		textures = nullptr;
-		printf("Unloaded buffer.\n");
+		const SceneObject& object = sceneObjects[i];
+		if ((filter == DrawFilter::Static && !object.isStatic) || (filter == DrawFilter::Dynamic && object.isStatic))
+			continue;
+		if (visible && !visible[i])
+			continue;
+
+		targetShader.setMat4("_Model", object.transform->getModelMatrix());
+		// Written into the visibility buffer ids
+		targetShader.setInt("_ObjectIndex", i);
+		targetShader.setInt("_MaterialIndex", object.material);
+		object.mesh->draw();
 	}
+}
 
-	// Getter for the current frame buffer
-	unsigned int getFBO() { return fbo; }
-
-	// Gett for the buffer's texture
-	unsigned int getTexture(int texNum) { return textures[texNum]; }
-
-private:
-	unsigned int fbo;
-	unsigned int* textures;
-	unsigned int depth;
-	unsigned int rbo;
-
-	int mWidth, mHeight;
-	int mTexturesLength;
-};
-
-class ShadowBuffer
+// Returns true if any static (or dynamic) object moved since the last call
+bool updateCachedModels(bool isStatic)
 {
-public:
-	ShadowBuffer(int width, int height)
+	bool changed = false;
+	for (SceneObject& object : sceneObjects)
 	{
-		mWidth = width;
-		mHeight = height;
-
-		glGenFramebuffers(1, &fbo);
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		if (object.isStatic != isStatic)
+			continue;
 
-		glGenTextures(1, &depthTexture);
-		glBindTexture(GL_TEXTURE_2D, depthTexture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, mWidth, mHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
-
-		glDrawBuffer(GL_NONE);
-		glReadBuffer(GL_NONE);
-
-		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		glm::mat4 model = object.transform->getModelMatrix();
+		if (model != object.cachedModel)
 		{
-			printf("Frame buffer is incomplete.\n");
+			object.cachedModel = model;
+			changed = true;
 		}
+	}
+	return changed;
+}
 
-		else
-		{
-			printf("Successfully created frame buffer.\n");
-		}
+// Fully saturated color for a hue in [0, 1)
+glm::vec3 hueColor(float hue)
+{
+	glm::vec3 channels = glm::abs(glm::fract(glm::vec3(hue) + glm::vec3(0.0f, 2.0f / 3.0f, 1.0f / 3.0f)) * 6.0f - 3.0f) - 1.0f;
+	return glm::clamp(channels, 0.0f, 1.0f);
+}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	}
+// Ring of spot lights aimed at the middle of the scene and a smaller ring of point lights
+void buildLocalLights(std::vector<LocalLight>& lights, int spotCount, int pointCount, float ringAngle)
+{
+	// Reuses the vector's storage, the lights are rebuilt every frame
+	lights.clear();
 
-	~ShadowBuffer()
+	for (int i = 0; i < spotCount; i++)
 	{
-		
+		float angle = ringAngle + glm::two_pi<float>() * i / spotCount;
+
+		LocalLight light;
+		light.position = glm::vec3(cos(angle) * 4.5f, 3.0f, sin(angle) * 4.5f);
+		light.direction = glm::normalize(glm::vec3(0.0f, -1.0f, 0.0f) - light.position);
+		light.color = glm::mix(hueColor((float)i / spotCount), glm::vec3(1.0f), 0.4f);
+		light.intensity = 3.0f;
+		light.range = 9.0f;
+		light.innerAngle = 15.0f;
+		light.outerAngle = 25.0f;
+		lights.push_back(light);
 	}
 
-	unsigned int getFBO() { return fbo; }
-	unsigned int getTexture() { return depthTexture; }
-
-private:
-	unsigned int fbo;
-	unsigned int depthTexture;
-
-	int mWidth, mHeight;
-};
-
-// Models
-// Global for the sake of convenience
-ew::Transform cubeTransform;
-ew::Transform rectangleTransform;
-ew::Transform sphereTransform;
-ew::Transform planeTransform;
-ew::Transform cylinderTransform;
-ew::Transform quadTransform;
-ew::Transform depthQuadTransform;
-ew::Transform lightTransform;
-
-ew::MeshData cubeMeshData;
-ew::MeshData sphereMeshData;
-ew::MeshData rectangleMeshData;
-ew::MeshData planeMeshData;
-ew::MeshData cylinderMeshData;
-ew::MeshData quadMeshData;
-ew::MeshData depthQuadMeshData;
-
-ew::Mesh* cubeMesh;
-ew::Mesh* sphereMesh;
-ew::Mesh* rectangleMesh;
-ew::Mesh* planeMesh;
-ew::Mesh* cylinderMesh;
-ew::Mesh* quadMesh;
-ew::Mesh* depthQuadMesh;
+	for (int i = 0; i < pointCount; i++)
+	{
+		float angle = -ringAngle + glm::two_pi<float>() * i / pointCount;
+
+		LocalLight light;
+		light.position = glm::vec3(cos(angle) * 2.5f, 1.5f, sin(angle) * 2.5f);
+		light.color = glm::mix(hueColor(0.5f + (float)i / pointCount), glm::vec3(1.0f), 0.4f);
+		light.intensity = 2.0f;
+		light.range = 6.0f;
+		light.isPoint = true;
+		lights.push_back(light);
+	}
+}
 
-void drawScene(Shader& targetShader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+// Small unshadowed lights spread through the scene, the same seed always gives the same lights
+void scatterLights(std::vector<LocalLight>& lights, int count)
 {
-	targetShader.setMat4("_View", viewMatrix);
-	targetShader.setMat4("_Projection", projectionMatrix);
-
-	//Draw cube
-	targetShader.setMat4("_Model", cubeTransform.getModelMatrix());
-	cubeMesh->draw();
-
-	//Draw rectangle
-	targetShader.setMat4("_Model", rectangleTransform.getModelMatrix());
-	rectangleMesh->draw();
-
-	//Draw sphere
-	targetShader.setMat4("_Model", sphereTransform.getModelMatrix());
-	sphereMesh->draw();
-
-	//Draw cylinder
-	targetShader.setMat4("_Model", cylinderTransform.getModelMatrix());
-	cylinderMesh->draw();
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
 
-	//Draw plane
-	targetShader.setMat4("_Model", planeTransform.getModelMatrix());
-	planeMesh->draw();
+	lights.clear();
+	for (int i = 0; i < count; i++)
+	{
+		LocalLight light;
+		light.position = glm::vec3(unit(random) * 10.0f - 5.0f, unit(random) * 3.0f - 0.9f, unit(random) * 10.0f - 5.0f);
+		light.color = glm::mix(hueColor(unit(random)), glm::vec3(1.0f), 0.2f);
+		light.intensity = 1.5f;
+		light.range = 0.5f + unit(random) * 0.7f;
+		light.isPoint = unit(random) < 0.75f;
+		light.innerAngle = 25.0f;
+		light.outerAngle = 35.0f;
+		light.castsShadows = false;
+		lights.push_back(light);
+	}
 }
 
 int main() {
@@ -382,6 +323,7 @@ int main() {
 
 	// Setup UI Platform/Renderer backends
 	IMGUI_CHECKVERSION();
+	allocTrackerHookImGui();
 	ImGui::CreateContext();
 	ImGui_ImplGlfw_InitForOpenGL(window, true);
 	ImGui_ImplOpenGL3_Init();
@@ -389,224 +331,1066 @@ int main() {
 	//Dark UI theme.
 	ImGui::StyleColorsDark();
 
-	//Used to draw shapes. This is the shader you will be completing.
-	Shader litShader("shaders/defaultLit.vert", "shaders/defaultLit.frag");
-
-	//Used to draw light sphere
-	Shader unlitShader("shaders/defaultLit.vert", "shaders/unlit.frag");
-
-	// Used to draw to the depth buffer only
-	Shader depthOnly("shaders/depthOnly.vert", "shaders/depthOnly.frag");
-
-	// Used to draw post processing effects
-	Shader postProc("shaders/postProcessing.vert", "shaders/postProcessing.frag");
-
-	// Create frame buffer instance with two frame buffers
-	FrameBuffer screenBuffer = FrameBuffer(1, SCREEN_WIDTH, SCREEN_HEIGHT);
-
-	// Create frame buffer to manage shadow depth buffer
-	ShadowBuffer depthBuffer = ShadowBuffer(2048, 2048);
-
-	ew::createCube(1.0f, 1.0f, 1.0f, cubeMeshData);
-	ew::createCube(1.0f, 2.0f, 1.0f, rectangleMeshData);
-	ew::createSphere(0.5f, 64, sphereMeshData);
-	ew::createPlane(1.0f, 1.0f, planeMeshData);
-	ew::createCylinder(1.0f, 0.5f, 64, cylinderMeshData);
-	ew::createQuad(2.0f, 2.0f, quadMeshData);
-	ew::createQuad(0.5f, 0.5f, depthQuadMeshData);
-
-	cubeMesh = new ew::Mesh(&cubeMeshData);
-	rectangleMesh = new ew::Mesh(&rectangleMeshData);
-	sphereMesh = new ew::Mesh(&sphereMeshData);
-	planeMesh = new ew::Mesh(&planeMeshData);
-	cylinderMesh = new ew::Mesh(&cylinderMeshData);
-	quadMesh = new ew::Mesh(&quadMeshData);
-	depthQuadMesh = new ew::Mesh(&depthQuadMeshData);
-
-	//Enable back face culling
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
+	// GL objects live in this scope so they are released before the context is destroyed
+	{
+		//Used to draw shapes. This is the shader you will be completing.
+		Shader litShader("shaders/defaultLit.vert", "shaders/defaultLit.frag");
 
-	//Enable blending
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		//Used to draw light sphere
+		Shader unlitShader("shaders/defaultLit.vert", "shaders/unlit.frag");
 
-	//Enable depth testing
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LESS);
+		// Used to draw to the depth buffer only
+		Shader depthOnly("shaders/depthOnly.vert", "shaders/depthOnly.frag");
 
-	quadTransform.position = glm::vec3(0.0f, 0.0f, 0.0f);
-	depthQuadTransform.position = glm::vec3(0.5f, 0.5f, 0.0f);
+		// Used to draw post processing effects
+		Shader postProc("shaders/postProcessing.vert", "shaders/postProcessing.frag");
 
-	cubeTransform.position = glm::vec3(-2.0f, 0.0f, 0.0f);
-	rectangleTransform.position = glm::vec3(0.0f, 0.0f, -2.0f);
-	sphereTransform.position = glm::vec3(0.0f, 0.0f, 0.0f);
+		// Used to preview one layer of the shadow map
+		Shader shadowPreview("shaders/postProcessing.vert", "shaders/shadowPreview.frag");
 
-	planeTransform.position = glm::vec3(0.0f, -1.0f, 0.0f);
-	planeTransform.scale = glm::vec3(10.0f);
+		// Deferred path, the lighting shaders are defaultLit.frag reading the G-buffer instead of varyings
+		Shader gbufferShader("shaders/defaultLit.vert", "shaders/gbuffer.frag");
+		Shader deferredShader("shaders/fullscreen.vert", "shaders/defaultLit.frag", "#define DEFERRED_LIGHTING\n");
+		Shader volumeShader("shaders/lightVolume.vert", "shaders/defaultLit.frag", "#define DEFERRED_LIGHTING\n#define LIGHT_VOLUME\n");
+		Shader volumeStencilShader("shaders/lightVolume.vert", "shaders/depthOnly.frag");
 
-	cylinderTransform.position = glm::vec3(2.0f, 0.0f, 0.0f);
+		// Visibility buffer path, the resolve rebuilds the surface from the ids and the mesh data
+		Shader visibilityShader("shaders/depthOnly.vert", "shaders/visibility.frag");
+		Shader resolveShader("shaders/fullscreen.vert", "shaders/defaultLit.frag", "#define VISIBILITY_BUFFER\n");
 
-	lightTransform.scale = glm::vec3(0.5f);
-	lightTransform.position = glm::vec3(0.0f, 5.0f, 0.0f);
+		// Writes the virtual texture pages each pixel needs
+		Shader feedbackShader("shaders/defaultLit.vert", "shaders/vtFeedback.frag");
 
-	_Material.color = glm::vec3(1, 1, 1);
-	_Material.ambientK = 1;
-	_Material.diffuseK = 1;
-	_Material.specularK = 1;
-	_Material.shininess = 1;
+		// Create frame buffer instance with one color buffer
+		FrameBuffer screenBuffer(1, SCREEN_WIDTH, SCREEN_HEIGHT);
 
-	_DirectionalLight.direction = glm::vec3(2, 2, 2);
-	_DirectionalLight.light.intensity = 0.5f;
-	_DirectionalLight.light.color = glm::vec3(1, 1, 1);
+		// Lights into the screen buffer's color texture
+		DeferredRenderer deferredRenderer(SCREEN_WIDTH, SCREEN_HEIGHT, screenBuffer.getTexture(0));
 
-	float minBias = 0.000f;
-	float maxBias = 0.001f;
-	bool showShadowMap = false;
+		// Low poly unit sphere the light volumes are scaled from
+		ew::MeshData lightVolumeData;
+		ew::createSphere(1.0f, 12, lightVolumeData);
+		ew::Mesh lightVolumeMesh(&lightVolumeData);
 
-	const char* effectNames[5] = { "None", "Invert", "Red Overlay", "Zooming Out", "Wave"};
-	int effectIndex = 0;
+		// Also resolves into the screen buffer
+		VisibilityBuffer visibilityBuffer(SCREEN_WIDTH, SCREEN_HEIGHT, screenBuffer.getTexture(0));
+		int visibilityMeshes[SCENE_OBJECT_COUNT];
 
-	GLuint brickTexture = getTexture("Bricks.jpg");
-	GLuint tileTexture = getTexture("Tiles.jpg");
-	GLuint brickNormal = getTexture("BricksNormal.jpg");
+		// Four 1024 cascades take the same memory as the old single 2048 map
+		CascadedShadowMap shadowMap(1024, 4);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, brickTexture);
-	litShader.setInt("_Texture1", 0);
+		// Filtered moments of the cascades, only updated while EVSM is selected
+		ShadowMoments shadowMoments(shadowMap.getResolution(), shadowMap.getCascadeCount());
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, tileTexture);
-	litShader.setInt("_Texture2", 1);
+		// Min/max depth pyramid of the cascades, only updated while PCF uses it
+		ShadowMinMax shadowMinMax(shadowMap.getResolution(), shadowMap.getCascadeCount());
 
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, brickNormal);
-	litShader.setInt("_Normal", 2);
+		// All six faces rendered in one layered pass
+		PointShadowMap pointShadowMap(512);
 
-	while (!glfwWindowShouldClose(window)) {
+		// Spot and extra point lights share one 4096 atlas, 64 MB no matter how many there are
+		LocalLightSystem localLights(4096, 64, 1024);
 
-		processInput(window);
-		glClearColor(bgColor.r,bgColor.g,bgColor.b, 1.0f);
+		// 16x9 tiles of 80x80 pixels at 720p and 24 depth slices
+		LightClusterGrid lightClusters(16, 9, 24, 128);
+		std::vector<LocalLight> scatteredLights;
 
-		ImGui_ImplOpenGL3_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
-		ImGui::NewFrame();
+		// 9 levels of 32x32 pages from 8 m to 2 km wide, backed by 1024 pages of 128x128
+		VirtualShadowMap virtualShadowMap(4096, 128, 32, 9, 8.0f);
 
-		float time = (float)glfwGetTime();
-		deltaTime = time - lastFrameTime;
-		lastFrameTime = time;
+		ew::createCube(1.0f, 1.0f, 1.0f, cubeMeshData);
+		ew::createCube(1.0f, 2.0f, 1.0f, rectangleMeshData);
+		ew::createSphere(0.5f, 64, sphereMeshData);
+		ew::createPlane(1.0f, 1.0f, planeMeshData);
+		ew::createCylinder(1.0f, 0.5f, 64, cylinderMeshData);
+		ew::createQuad(2.0f, 2.0f, quadMeshData);
+		ew::createQuad(0.5f, 0.5f, depthQuadMeshData);
 
-		depthOnly.use();
+		cubeMesh = ew::Mesh(&cubeMeshData);
+		rectangleMesh = ew::Mesh(&rectangleMeshData);
+		sphereMesh = ew::Mesh(&sphereMeshData);
+		planeMesh = ew::Mesh(&planeMeshData);
+		cylinderMesh = ew::Mesh(&cylinderMeshData);
+		quadMesh = ew::Mesh(&quadMeshData);
+		depthQuadMesh = ew::Mesh(&depthQuadMeshData);
 
-		glViewport(0, 0, 2048, 2048);
-		glBindFramebuffer(GL_FRAMEBUFFER, depthBuffer.getFBO());
+		for (SceneObject& object : sceneObjects)
+		{
+			object.localBounds = computeMeshBounds(*object.meshData);
+		}
 
-		glEnable(GL_DEPTH_TEST);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		for (int i = 0; i < SCENE_OBJECT_COUNT; i++)
+		{
+			visibilityMeshes[i] = visibilityBuffer.addMesh(*sceneObjects[i].meshData);
+		}
 
-		glm::mat4 lightView = glm::lookAt(_DirectionalLight.direction, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		glm::mat4 lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 1.0f, 200.0f);
+		// Drawn with storage binding 8, every shader that shades a surface reads it
+		MaterialTable materials;
+		int objectMaterials[SCENE_OBJECT_COUNT];
+		for (int i = 0; i < SCENE_OBJECT_COUNT; i++)
+		{
+			sceneObjects[i].material = materials.add(sceneObjects[i].name, Material());
+			objectMaterials[i] = sceneObjects[i].material;
+		}
 
-		glCullFace(GL_FRONT);
-		drawScene(depthOnly, lightView, lightProjection);
+		//Enable back face culling
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_BACK);
 
-		// Set active frame buffer to screenBuffer
-		glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
-		glBindFramebuffer(GL_FRAMEBUFFER, screenBuffer.getFBO());
+		//Enable blending
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-		// Enable depth testing for 3D sorting
+		//Enable depth testing
 		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_LESS);
+
+		quadTransform.position = glm::vec3(0.0f, 0.0f, 0.0f);
+		depthQuadTransform.position = glm::vec3(0.5f, 0.5f, 0.0f);
+		atlasQuadTransform.position = glm::vec3(-0.5f, 0.5f, 0.0f);
+
+		cubeTransform.position = glm::vec3(-2.0f, 0.0f, 0.0f);
+		rectangleTransform.position = glm::vec3(0.0f, 0.0f, -2.0f);
+		sphereTransform.position = glm::vec3(0.0f, 0.0f, 0.0f);
+
+		planeTransform.position = glm::vec3(0.0f, -1.0f, 0.0f);
+		planeTransform.scale = glm::vec3(10.0f);
+
+		cylinderTransform.position = glm::vec3(2.0f, 0.0f, 0.0f);
+
+		lightTransform.scale = glm::vec3(0.5f);
+		lightTransform.position = glm::vec3(0.0f, 5.0f, 0.0f);
+
+
+		_DirectionalLight.direction = glm::vec3(2, 2, 2);
+		_DirectionalLight.light.intensity = 0.5f;
+		_DirectionalLight.light.color = glm::vec3(1, 1, 1);
+
+		_PointLight.light.intensity = 1.0f;
+		_PointLight.light.color = glm::vec3(1.0f, 0.8f, 0.6f);
+		_PointLight.constK = 1.0f;
+		_PointLight.linearK = 0.09f;
+		_PointLight.quadraticK = 0.032f;
+
+		pointLightOrbitCenter = glm::vec3(0.0f, 2.0f, 0.0f);
+		pointLightOrbitRange = 3.0f;
+		pointLightOrbitSpeed = 0.5f;
+
+		int spotLightCount = 12;
+		int atlasPointLightCount = 2;
+		bool animateLocalLights = false;
+		float localLightAngle = 0.0f;
+		bool showAtlas = false;
+		int scatteredLightCount = 0;
+		bool clusteredLighting = true;
+		bool showClusterHeat = false;
+
+		const char* renderModeNames[3] = { "Forward", "Deferred", "Visibility Buffer" };
+		int renderMode = 0;
+		const char* deferredLightingNames[2] = { "Fullscreen", "Light Volumes" };
+		int deferredLighting = 0;
+
+		bool pointLightEnabled = true;
+		bool pointShadowsEnabled = true;
+		float pointShadowFar = 25.0f;
+		float pointShadowBias = 0.05f;
+
+		float minBias = 0.000f;
+		float maxBias = 0.001f;
+		bool showShadowMap = false;
+		bool virtualShadows = false;
+		float vsmLodBias = 0.0f;
+		bool showCascades = false;
+		int previewCascade = 0;
+		bool animateSphere = false;
+
+		const char* shadowModeNames[2] = { "PCF", "EVSM" };
+		int shadowMode = 0;
+		float evsmMinVariance = 0.0001f;
+		float lightBleedReduction = 0.2f;
+
+		// Settings the moments were last generated with, any change regenerates every layer
+		bool momentsValid = false;
+		int momentsBlurRadius = 0;
+		glm::vec2 momentsExponents(0.0f);
+
+		bool useShadowMinMax = true;
+		bool showShadowPath = false;
+		bool minMaxValid = false;
+
+		const char* shadowTapNames[4] = { "1", "4", "9", "16" };
+		const int shadowTapCounts[4] = { 1, 4, 9, 16 };
+		int shadowTapIndex = 2;
+		float shadowFilterRadius = 1.5f;
+
+		GpuTimer shadowPassTimer;
+		GpuTimer momentsTimer;
+		GpuTimer minMaxTimer;
+		GpuTimer pointShadowTimer;
+		GpuTimer localShadowTimer;
+		GpuTimer clusterTimer;
+		GpuTimer litPassTimer;
+		GpuTimer virtualShadowTimer;
+		GpuTimer geometryPassTimer;
+		GpuTimer deferredLightingTimer;
+		GpuTimer visibilityPassTimer;
+		GpuTimer resolvePassTimer;
+		GpuTimer feedbackPassTimer;
+
+		// Lit pass time for each tap count, updated while that count is selected
+		float litPassTimes[4] = {};
+		float evsmLitPassTime = 0.0f;
+
+		// The shadow map compares in its sampler state, the preview needs the raw depth
+		SamplerHandle depthPreviewSampler = genSampler("Shadow map preview");
+		glSamplerParameteri(depthPreviewSampler.get(), GL_TEXTURE_COMPARE_MODE, GL_NONE);
+		glSamplerParameteri(depthPreviewSampler.get(), GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glSamplerParameteri(depthPreviewSampler.get(), GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		const char* effectNames[5] = { "None", "Invert", "Red Overlay", "Zooming Out", "Wave"};
+		int effectIndex = 0;
+
+		// Materials default to layer 0 of both arrays, the bricks
+		TextureManager textures(1024, 1024);
+		textures.load({
+			{ TextureSet::Albedo, "Bricks.jpg" },
+			{ TextureSet::Albedo, "Tiles.jpg" },
+			{ TextureSet::Normal, "BricksNormal.jpg" } });
+		TextureManager::DecodeBenchmark decodeBenchmark;
+
+		// The plane's albedo is paged in from Tiles.jpg as the feedback asks for it
+		VirtualTexture virtualTexture("Tiles.jpg", SCREEN_WIDTH, SCREEN_HEIGHT);
+		for (const SceneObject& object : sceneObjects)
+		{
+			if (object.mesh == &planeMesh)
+			{
+				materials.edit(object.material).virtualAlbedo = true;
+			}
+		}
 
-		// Clear screenBuffer (was here before)
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		litShader.use();
-
-		litShader.setFloat("time", time);
-
-		litShader.setVec3("_DirectionalLight.direction", _DirectionalLight.direction);
-		litShader.setFloat("_DirectionalLight.light.intensity", _DirectionalLight.light.intensity);
-		litShader.setVec3("_DirectionalLight.light.color", _DirectionalLight.light.color);
+		// The budget only covers what the manager can give back, render targets aren't in it
+		float residencyBudgetMB = 64.0f;
+		ResidencyManager residency((size_t)(residencyBudgetMB * 1024.0f * 1024.0f));
+		residency.addTextures(&textures);
+		for (SceneObject& object : sceneObjects)
+		{
+			residency.addMesh(object.name, object.mesh);
+		}
+		residency.addMesh("Quad", &quadMesh);
+		residency.addMesh("Depth quad", &depthQuadMesh);
+		residency.addMesh("Light volume", &lightVolumeMesh);
 
-		litShader.setVec3("_Material.color", _Material.color);
-		litShader.setFloat("_Material.ambientK", _Material.ambientK);
-		litShader.setFloat("_Material.diffuseK", _Material.diffuseK);
-		litShader.setFloat("_Material.specularK", _Material.specularK);
-		litShader.setFloat("_Material.shininess", _Material.shininess);
+		// Bound to units 0 and 2 once per frame, no texture binds between draws. The virtual texture uses 17 and 18.
+		Shader* surfaceShaders[3] = { &litShader, &gbufferShader, &resolveShader };
+		for (Shader* shader : surfaceShaders)
+		{
+			shader->setInt("_AlbedoArray", 0);
+			shader->setInt("_NormalArray", 2);
+		}
 
-		litShader.setMat4("_LightViewProj", lightProjection * lightView);
-		litShader.setVec3("_CameraPosition", camera.getPosition());
+		// A sampler2DArray and a sampler2D of one program can't share a unit even when only one is read
+		shadowPreview.setInt("_ShadowMap", 5);
+		shadowPreview.setInt("_Atlas", 19);
+
+		while (!glfwWindowShouldClose(window)) {
+			ALLOC_SCOPE("Frame");
+
+			processInput(window);
+			glClearColor(bgColor.r,bgColor.g,bgColor.b, 1.0f);
+
+			ImGui_ImplOpenGL3_NewFrame();
+			ImGui_ImplGlfw_NewFrame();
+			ImGui::NewFrame();
+
+			// Allocations from here until the swap count against the frame
+			allocTrackerBeginFrame();
+
+			float time = (float)glfwGetTime();
+			deltaTime = time - lastFrameTime;
+			lastFrameTime = time;
+
+			if (animateSphere)
+			{
+				sphereTransform.position.y = 0.5f + 0.5f * sin(time * 2.0f);
+			}
+
+			float orbitAngle = time * pointLightOrbitSpeed;
+			_PointLight.position = pointLightOrbitCenter + glm::vec3(cos(orbitAngle), 0.0f, sin(orbitAngle)) * pointLightOrbitRange;
+
+			shadowPassTimer.begin();
+			depthOnly.use();
+
+			// Light changes invalidate through the cascade matrices, moved objects have to be checked here
+			AABB objectBounds[SCENE_OBJECT_COUNT];
+			for (int i = 0; i < SCENE_OBJECT_COUNT; i++)
+			{
+				objectBounds[i] = transformAABB(sceneObjects[i].localBounds, sceneObjects[i].transform->getModelMatrix());
+			}
+			shadowMap.update(camera, _DirectionalLight.direction, objectBounds, SCENE_OBJECT_COUNT);
+			bool staticMoved = updateCachedModels(true);
+			bool dynamicMoved = updateCachedModels(false);
+			if (staticMoved)
+			{
+				shadowMap.invalidateStaticCasters();
+			}
+			if (dynamicMoved)
+			{
+				shadowMap.invalidateDynamicCasters();
+			}
+			int cascadeCount = shadowMap.getCascadeCount();
+
+			glViewport(0, 0, shadowMap.getResolution(), shadowMap.getResolution());
+			glEnable(GL_DEPTH_TEST);
+			glCullFace(GL_FRONT);
+
+			// Casters between the light and a cascade's near plane are flattened onto it instead of clipped
+			glEnable(GL_DEPTH_CLAMP);
+
+			// Sampled layers that changed this frame
+			bool layerChanged[MAX_SHADOW_CASCADES] = {};
+
+			glm::mat4 cascadeViewProj[MAX_SHADOW_CASCADES];
+			float cascadeSplits[MAX_SHADOW_CASCADES];
+			float cascadeBiasScale[MAX_SHADOW_CASCADES];
+			for (int i = 0; i < cascadeCount; i++)
+			{
+				const ShadowCascade& cascade = shadowMap.getCascade(i);
+				cascadeViewProj[i] = cascade.viewProjection;
+				cascadeSplits[i] = cascade.splitFar;
+				cascadeBiasScale[i] = cascade.texelSize / shadowMap.getCascade(0).texelSize;
+
+				// The cascades are left stale while the virtual shadow map is used and catch up when switched back
+				if (virtualShadows)
+					continue;
+
+				if (shadowMap.needsStaticRedraw(i))
+				{
+					shadowMap.beginStaticLayer(i);
+					drawScene(depthOnly, cascade.view, cascade.projection, DrawFilter::Static, shadowMap.getCasterVisibility(i));
+					shadowMap.endStaticLayer(i);
+				}
+
+				if (shadowMap.needsComposite(i))
+				{
+					shadowMap.beginComposite(i);
+					drawScene(depthOnly, cascade.view, cascade.projection, DrawFilter::Dynamic, shadowMap.getCasterVisibility(i));
+					shadowMap.endComposite(i);
+					layerChanged[i] = true;
+				}
+			}
+
+			glDisable(GL_DEPTH_CLAMP);
+			shadowMap.endFrame();
+			shadowPassTimer.end();
+
+			if (virtualShadows)
+			{
+				virtualShadowTimer.begin();
+				virtualShadowMap.update(camera, _DirectionalLight.direction, objectBounds, SCENE_OBJECT_COUNT);
+				if (virtualShadowMap.getRenderCount() > 0)
+				{
+					depthOnly.use();
+					glEnable(GL_DEPTH_TEST);
+					glCullFace(GL_FRONT);
+
+					virtualShadowMap.beginRender();
+					for (int i = 0; i < virtualShadowMap.getRenderCount(); i++)
+					{
+						virtualShadowMap.beginPage(i);
+						drawScene(depthOnly, virtualShadowMap.getLightView(), virtualShadowMap.getRender(i).projection,
+							DrawFilter::All, virtualShadowMap.getRenderCasters(i));
+					}
+					virtualShadowMap.endRender();
+				}
+				virtualShadowTimer.end();
+			}
+
+			if (shadowMode == 1 && !virtualShadows)
+			{
+				if (momentsBlurRadius != shadowMoments.blurRadius || momentsExponents != shadowMoments.exponents)
+				{
+					momentsValid = false;
+				}
+
+				momentsTimer.begin();
+				bool anyChanged = false;
+				for (int i = 0; i < cascadeCount; i++)
+				{
+					if (!layerChanged[i] && momentsValid)
+						continue;
+
+					if (!anyChanged)
+					{
+						shadowMoments.beginGenerate();
+						anyChanged = true;
+					}
+					shadowMoments.generate(shadowMap.getBuffer(), i);
+				}
+				if (anyChanged)
+				{
+					shadowMoments.endGenerate();
+				}
+				momentsTimer.end();
+
+				momentsValid = true;
+				momentsBlurRadius = shadowMoments.blurRadius;
+				momentsExponents = shadowMoments.exponents;
+			}
+			else
+			{
+				// The depth layers keep changing while PCF is selected
+				momentsValid = false;
+			}
+
+			if (shadowMode == 0 && useShadowMinMax && !virtualShadows)
+			{
+				minMaxTimer.begin();
+				for (int i = 0; i < cascadeCount; i++)
+				{
+					if (layerChanged[i] || !minMaxValid)
+					{
+						shadowMinMax.generate(shadowMap.getBuffer(), i);
+					}
+				}
+				minMaxTimer.end();
+				minMaxValid = true;
+			}
+			else
+			{
+				minMaxValid = false;
+			}
+
+			bool pointShadowsActive = pointLightEnabled && pointShadowsEnabled && pointShadowMap.isSupported();
+			if (pointShadowsActive)
+			{
+				pointShadowTimer.begin();
+				pointShadowMap.update(_PointLight.position, pointShadowFar, objectBounds, SCENE_OBJECT_COUNT);
+				if (staticMoved || dynamicMoved)
+				{
+					pointShadowMap.invalidate();
+				}
+
+				bool pointShadowRendered = pointShadowMap.needsRedraw();
+				if (pointShadowRendered)
+				{
+					glEnable(GL_DEPTH_TEST);
+					glCullFace(GL_FRONT);
+
+					pointShadowMap.begin();
+					for (int i = 0; i < SCENE_OBJECT_COUNT; i++)
+					{
+						int instances = pointShadowMap.prepareObject(i, sceneObjects[i].transform->getModelMatrix());
+						if (instances > 0)
+						{
+							sceneObjects[i].mesh->drawInstanced(instances);
+						}
+					}
+					pointShadowMap.end();
+				}
+				pointShadowMap.endFrame(pointShadowRendered);
+				pointShadowTimer.end();
+			}
+			else
+			{
+				// Casters that move meanwhile aren't tracked, the cube renders again once the pass is back
+				pointShadowMap.invalidate();
+			}
+
+			if (animateLocalLights)
+			{
+				localLightAngle += deltaTime * 0.2f;
+			}
+			if ((int)scatteredLights.size() != scatteredLightCount)
+			{
+				scatterLights(scatteredLights, scatteredLightCount);
+			}
+			// Shadowed lights go first so they keep their atlas owner index when the scattered count changes
+			buildLocalLights(localLights.lights, spotLightCount, atlasPointLightCount, localLightAngle);
+			localLights.lights.insert(localLights.lights.end(), scatteredLights.begin(), scatteredLights.end());
+			localLights.update(camera, SCREEN_HEIGHT, objectBounds, SCENE_OBJECT_COUNT, staticMoved || dynamicMoved);
+
+			// Light volumes shade the local lights themselves, the cluster lists aren't read
+			bool volumeLighting = renderMode == 1 && deferredLighting == 1;
+			if (clusteredLighting && !volumeLighting)
+			{
+				clusterTimer.begin();
+				localLights.bindForLighting(9);
+				lightClusters.build(camera, (int)localLights.lights.size());
+				clusterTimer.end();
+			}
+
+			localShadowTimer.begin();
+			if (localLights.getStats().renderedViews > 0)
+			{
+				depthOnly.use();
+				glEnable(GL_DEPTH_TEST);
+				glCullFace(GL_FRONT);
+
+				// Perspective depth needs a slope scaled offset on top of the normal offset in the lit shader
+				glEnable(GL_POLYGON_OFFSET_FILL);
+				glPolygonOffset(1.0f, 2.0f);
+
+				ShadowAtlas& atlas = localLights.getAtlas();
+				atlas.beginRender();
+				for (int i = 0; i < localLights.getViewCount(); i++)
+				{
+					const LocalShadowView& view = localLights.getView(i);
+					if (!view.needsRender)
+						continue;
+
+					atlas.beginTile(view.tile);
+					drawScene(depthOnly, view.view, view.projection, DrawFilter::All, localLights.getViewCasters(i));
+				}
+				atlas.endRender();
+
+				glDisable(GL_POLYGON_OFFSET_FILL);
+			}
+			localShadowTimer.end();
+
+			// Everything the lit shaders read besides the surface, shared by the forward and deferred paths
+			auto setLightingUniforms = [&](Shader& shader)
+			{
+				shader.setFloat("time", time);
+
+				shader.setVec3("_DirectionalLight.direction", _DirectionalLight.direction);
+				shader.setFloat("_DirectionalLight.light.intensity", _DirectionalLight.light.intensity);
+				shader.setVec3("_DirectionalLight.light.color", _DirectionalLight.light.color);
+
+				shader.setInt("_PointLightEnabled", pointLightEnabled);
+				shader.setVec3("_PointLight.position", _PointLight.position);
+				shader.setFloat("_PointLight.light.intensity", _PointLight.light.intensity);
+				shader.setVec3("_PointLight.light.color", _PointLight.light.color);
+				shader.setFloat("_PointLight.constK", _PointLight.constK);
+				shader.setFloat("_PointLight.linearK", _PointLight.linearK);
+				shader.setFloat("_PointLight.quadraticK", _PointLight.quadraticK);
+				shader.setInt("_PointShadowsEnabled", pointShadowsActive);
+				shader.setFloat("_PointShadowFar", pointShadowMap.getFarPlane());
+				shader.setFloat("_PointShadowBias", pointShadowBias);
+
+				shader.setInt("_CascadeCount", cascadeCount);
+				shader.setMat4Array("_CascadeViewProj", cascadeCount, cascadeViewProj);
+				shader.setFloatArray("_CascadeSplits", cascadeCount, cascadeSplits);
+				shader.setFloatArray("_CascadeBiasScale", cascadeCount, cascadeBiasScale);
+				shader.setInt("_ShowCascades", showCascades);
+				shader.setVec3("_CameraPosition", camera.getPosition());
 		
-		litShader.setFloat("_MinBias", minBias);
-		litShader.setFloat("_MaxBias", maxBias);
-
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, depthBuffer.getTexture());
-		litShader.setInt("_ShadowMap", 3);
-
-		glCullFace(GL_BACK);
-		drawScene(litShader, camera.getViewMatrix(), camera.getProjectionMatrix());
-
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-		// Disable depth testing
-		glDisable(GL_DEPTH_TEST);
-
-		// Clear color buffer bit
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// Set post processing shader
-		postProc.use();
-
-		// Bind screen buffer's texture to the shader's texture
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, screenBuffer.getTexture(0));
-		postProc.setInt("_Texture1", 4);
-
-		postProc.setInt("effectIndex", effectIndex);
-		postProc.setFloat("time", time);
-
-		// Draw screen quad
-		postProc.setMat4("_Model", quadTransform.getModelMatrix());
-		quadMesh->draw();
-
-		if (showShadowMap)
-		{
-			glBindTexture(GL_TEXTURE_2D, depthBuffer.getTexture());
+				shader.setFloat("_MinBias", minBias);
+				shader.setFloat("_MaxBias", maxBias);
+				shader.setInt("_ShadowTaps", shadowTapCounts[shadowTapIndex]);
+				shader.setFloat("_ShadowFilterRadius", shadowFilterRadius);
+				shader.setInt("_ShadowMode", shadowMode);
+				shader.setInt("_UseShadowMinMax", useShadowMinMax);
+				shader.setInt("_ShowShadowPath", showShadowPath && shadowMode == 0);
+				shader.setVec2("_EvsmExponents", shadowMoments.exponents);
+				shader.setFloat("_EvsmMinVariance", evsmMinVariance);
+				shader.setFloat("_LightBleedReduction", lightBleedReduction);
+
+				glActiveTexture(GL_TEXTURE3);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMap.getBuffer().getTexture());
+				shader.setInt("_ShadowMap", 3);
+
+				glActiveTexture(GL_TEXTURE6);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMoments.getTexture());
+				shader.setInt("_ShadowMoments", 6);
+
+				glActiveTexture(GL_TEXTURE7);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMinMax.getTexture());
+				shader.setInt("_ShadowMinMax", 7);
+
+				glActiveTexture(GL_TEXTURE8);
+				glBindTexture(GL_TEXTURE_CUBE_MAP, pointShadowMap.getTexture());
+				shader.setInt("_PointShadowMap", 8);
+
+				localLights.bindForLighting(9);
+				shader.setInt("_ShadowAtlas", 9);
+				// Light volumes add the local lights after the fullscreen pass
+				shader.setInt("_LocalLightCount", volumeLighting ? 0 : (int)localLights.lights.size());
+				shader.setInt("_ClusteredLighting", clusteredLighting && !volumeLighting);
+				shader.setInt("_ShowClusterHeat", showClusterHeat && clusteredLighting && !volumeLighting);
+				lightClusters.bindForLighting(shader, SCREEN_WIDTH, SCREEN_HEIGHT);
+
+				// Sampler units are set even when unused, two sampler types can't share unit 0
+				shader.setInt("_VirtualShadows", virtualShadows);
+				shader.setInt("_VsmPool", 10);
+				shader.setInt("_VsmPageTable", 11);
+				if (virtualShadows)
+				{
+					virtualShadowMap.bindForLighting(10, 11);
+					shader.setMat4("_VsmLightView", virtualShadowMap.getLightView());
+					shader.setVec2("_VsmDepthRange", virtualShadowMap.getDepthRange());
+					shader.setInt("_VsmLevelCount", virtualShadowMap.getLevelCount());
+					shader.setInt("_VsmPagesPerLevel", virtualShadowMap.getPagesPerLevel());
+					shader.setInt("_VsmPageResolution", virtualShadowMap.getPageResolution());
+					shader.setInt("_VsmPoolPagesPerRow", virtualShadowMap.getPoolPagesPerRow());
+					shader.setFloat("_VsmFirstPageSize", virtualShadowMap.getFirstPageSize());
+					shader.setIVec2Array("_VsmLevelOrigin", virtualShadowMap.getLevelCount(), virtualShadowMap.getLevelOrigins());
+					shader.setFloat("_VsmLodBias", vsmLodBias);
+				}
+			};
+
+			// Uploads this frame's material edits and newly loaded textures
+			materials.bind(8);
+			textures.bind(0, 2);
+
+			// Read back on a later frame, the pages it asks for arrive a few frames after they come into view
+			feedbackPassTimer.begin();
+			virtualTexture.beginFeedback(feedbackShader);
+			glCullFace(GL_BACK);
+			drawScene(feedbackShader, camera.getViewMatrix(), camera.getProjectionMatrix());
+			virtualTexture.endFeedback();
+			feedbackPassTimer.end();
+
+			virtualTexture.update();
+			for (Shader* shader : surfaceShaders)
+			{
+				virtualTexture.bind(*shader, 17, 18);
+			}
+
+			if (renderMode == 0)
+			{
+				// Set active frame buffer to screenBuffer
+				glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+				glBindFramebuffer(GL_FRAMEBUFFER, screenBuffer.getFBO());
+
+				// Enable depth testing for 3D sorting
+				glEnable(GL_DEPTH_TEST);
+
+				// Clear screenBuffer (was here before)
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+				litPassTimer.begin();
+				litShader.use();
+				setLightingUniforms(litShader);
+
+				glCullFace(GL_BACK);
+				drawScene(litShader, camera.getViewMatrix(), camera.getProjectionMatrix());
+				litPassTimer.end();
+			}
+			else if (renderMode == 1)
+			{
+				geometryPassTimer.begin();
+				deferredRenderer.beginGeometry();
+				gbufferShader.use();
+				glCullFace(GL_BACK);
+				drawScene(gbufferShader, camera.getViewMatrix(), camera.getProjectionMatrix());
+				deferredRenderer.endGeometry();
+				geometryPassTimer.end();
+
+				deferredLightingTimer.begin();
+				deferredRenderer.beginLighting();
+
+				// Directional and point light, plus the clustered local lights unless volumes draw them
+				deferredShader.use();
+				setLightingUniforms(deferredShader);
+				deferredRenderer.bindForLighting(deferredShader, camera, 12);
+				deferredRenderer.drawFullscreen();
+
+				if (volumeLighting)
+				{
+					// Only the local light code is live in the volume shader, and the VSM requests
+					// written by the fullscreen pass must not be cleared again
+					volumeShader.setVec3("_CameraPosition", camera.getPosition());
+					volumeShader.setInt("_ShadowAtlas", 9);
+					deferredRenderer.bindForLighting(volumeShader, camera, 12);
+
+					// Shadowed lights cover the most pixels, they get exact stencil masks
+					int shadowedCount = std::min(spotLightCount + atlasPointLightCount, (int)localLights.lights.size());
+					deferredRenderer.drawStencilVolumes(volumeStencilShader, volumeShader, lightVolumeMesh, camera,
+						localLights.lights, 0, shadowedCount);
+					deferredRenderer.drawBatchedVolumes(volumeShader, lightVolumeMesh, camera,
+						shadowedCount, (int)localLights.lights.size() - shadowedCount);
+				}
+
+				deferredRenderer.endLighting();
+				deferredLightingTimer.end();
+			}
+			else
+			{
+				glm::mat4 objectModels[SCENE_OBJECT_COUNT];
+				for (int i = 0; i < SCENE_OBJECT_COUNT; i++)
+				{
+					objectModels[i] = sceneObjects[i].transform->getModelMatrix();
+				}
+				visibilityBuffer.setObjects(objectModels, visibilityMeshes, objectMaterials, SCENE_OBJECT_COUNT);
+
+				visibilityPassTimer.begin();
+				visibilityBuffer.beginGeometry();
+				visibilityShader.use();
+				glCullFace(GL_BACK);
+				drawScene(visibilityShader, camera.getViewMatrix(), camera.getProjectionMatrix());
+				visibilityBuffer.endGeometry();
+				visibilityPassTimer.end();
+
+				resolvePassTimer.begin();
+				visibilityBuffer.beginResolve();
+				resolveShader.use();
+				setLightingUniforms(resolveShader);
+				visibilityBuffer.bindForResolve(resolveShader, camera, 16);
+				visibilityBuffer.drawResolve();
+				visibilityBuffer.endResolve();
+				resolvePassTimer.end();
+			}
+
+			if (virtualShadows)
+			{
+				virtualShadowMap.endFrame();
+			}
+
+			if (pointLightEnabled)
+			{
+				unlitShader.use();
+				lightTransform.position = _PointLight.position;
+				lightTransform.scale = glm::vec3(0.25f);
+				unlitShader.setMat4("_View", camera.getViewMatrix());
+				unlitShader.setMat4("_Projection", camera.getProjectionMatrix());
+				unlitShader.setMat4("_Model", lightTransform.getModelMatrix());
+				unlitShader.setVec3("_Color", _PointLight.light.color);
+				sphereMesh.draw();
+			}
+			if (renderMode == 0 && shadowMode == 1)
+			{
+				evsmLitPassTime = litPassTimer.getMilliseconds();
+			}
+			else if (renderMode == 0)
+			{
+				litPassTimes[shadowTapIndex] = litPassTimer.getMilliseconds();
+			}
+
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+			// Disable depth testing
+			glDisable(GL_DEPTH_TEST);
+
+			// Clear color buffer bit
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			// Set post processing shader
+			postProc.use();
+
+			// Bind screen buffer's texture to the shader's texture
+			glActiveTexture(GL_TEXTURE4);
+			glBindTexture(GL_TEXTURE_2D, screenBuffer.getTexture(0));
 			postProc.setInt("_Texture1", 4);
 
-			postProc.setMat4("_Model", depthQuadTransform.getModelMatrix());
-			depthQuadMesh->draw();
+			postProc.setInt("effectIndex", effectIndex);
+			postProc.setFloat("time", time);
+
+			// Draw screen quad
+			postProc.setMat4("_Model", quadTransform.getModelMatrix());
+			quadMesh.draw();
+
+			if (showShadowMap)
+			{
+				shadowPreview.use();
+
+				glActiveTexture(GL_TEXTURE5);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMap.getBuffer().getTexture());
+				glBindSampler(5, depthPreviewSampler.get());
+				shadowPreview.setInt("_Layer", previewCascade);
+				shadowPreview.setInt("_ShowAtlas", 0);
+
+				shadowPreview.setMat4("_Model", depthQuadTransform.getModelMatrix());
+				depthQuadMesh.draw();
+				glBindSampler(5, 0);
+			}
+
+			if (showAtlas)
+			{
+				shadowPreview.use();
+
+				glActiveTexture(GL_TEXTURE19);
+				glBindTexture(GL_TEXTURE_2D, localLights.getAtlas().getTexture());
+				glBindSampler(19, depthPreviewSampler.get());
+				shadowPreview.setInt("_ShowAtlas", 1);
+
+				shadowPreview.setMat4("_Model", atlasQuadTransform.getModelMatrix());
+				depthQuadMesh.draw();
+				glBindSampler(19, 0);
+			}
+
+			//Draw UI
+			ALLOC_SCOPE("UI");
+			ImGui::Begin("Directional Light");
+
+			ImGui::DragFloat3("Direction", &_DirectionalLight.direction.x, 1, -360, 360);
+			ImGui::DragFloat("Intensity", &_DirectionalLight.light.intensity, 0.01, 0.01, 1);
+			ImGui::ColorEdit3("Color", &_DirectionalLight.light.color.r);
+			ImGui::End();
+
+			ImGui::Begin("Point Light");
+
+			ImGui::Checkbox("Enabled", &pointLightEnabled);
+			ImGui::ColorEdit3("Color", &_PointLight.light.color.r);
+			ImGui::DragFloat("Intensity", &_PointLight.light.intensity, 0.01f, 0.0f, 5.0f);
+			ImGui::DragFloat3("Orbit Center", &pointLightOrbitCenter.x, 0.1f);
+			ImGui::DragFloat("Orbit Range", &pointLightOrbitRange, 0.1f, 0.0f, 20.0f);
+			ImGui::DragFloat("Orbit Speed", &pointLightOrbitSpeed, 0.01f, -5.0f, 5.0f);
+			ImGui::DragFloat("Linear", &_PointLight.linearK, 0.001f, 0.0f, 1.0f);
+			ImGui::DragFloat("Quadratic", &_PointLight.quadraticK, 0.001f, 0.0f, 1.0f);
+			ImGui::Checkbox("Shadows", &pointShadowsEnabled);
+			if (!pointShadowMap.isSupported())
+			{
+				ImGui::Text("ARB_shader_viewport_layer_array is not supported");
+			}
+			ImGui::DragFloat("Shadow Range", &pointShadowFar, 0.5f, 1.0f, 200.0f);
+			ImGui::DragFloat("Shadow Bias", &pointShadowBias, 0.001f, 0.0f, 0.5f);
+			const PointShadowStats& pointStats = pointShadowMap.getStats();
+			ImGui::Text("Faces with casters: %d / 6", pointStats.activeFaces);
+			ImGui::Text("Draws: %d, face instances: %d", pointStats.draws, pointStats.instances);
+			ImGui::Text("Skipped renders: %d", pointStats.skippedFrames);
+			ImGui::Text("Point shadow pass: %.3f ms", pointShadowTimer.getMilliseconds());
+			ImGui::End();
+
+			ImGui::Begin("Local Lights");
+
+			ImGui::SliderInt("Spot Lights", &spotLightCount, 0, 48);
+			ImGui::SliderInt("Point Lights", &atlasPointLightCount, 0, 8);
+			ImGui::Checkbox("Animate", &animateLocalLights);
+			ImGui::DragFloat("Shadow Quality", &localLights.shadowQuality, 0.05f, 0.1f, 4.0f);
+			ImGui::SliderInt("Resize Delay", &localLights.getAtlas().hysteresisFrames, 1, 60);
+			ImGui::Checkbox("Show Atlas", &showAtlas);
+
+			const LocalLightStats& localStats = localLights.getStats();
+			const ShadowAtlasStats& atlasStats = localLights.getAtlas().getStats();
+			ImGui::Text("Visible: %d, shadowed: %d", localStats.visibleLights, localStats.shadowedLights);
+			ImGui::Text("Atlas: %.1f%% used, %d tiles", 100.0 * atlasStats.usedTexels / atlasStats.totalTexels, atlasStats.allocatedTiles);
+			ImGui::Text("Shrunk: %d, dropped: %d, full repacks: %d", atlasStats.shrunkOwners, atlasStats.droppedOwners, atlasStats.fullRepacks);
+			ImGui::Text("Views rendered: %d / %d", localStats.renderedViews, localLights.getViewCount());
+			ImGui::Text("Local shadow pass: %.3f ms", localShadowTimer.getMilliseconds());
+
+			ImGui::SliderInt("Scattered Lights", &scatteredLightCount, 0, 4096);
+			ImGui::Checkbox("Clustered", &clusteredLighting);
+			ImGui::Checkbox("Show Cluster Heat", &showClusterHeat);
+			ImGui::Text("%d lights, %d clusters of up to %d", (int)localLights.lights.size(), lightClusters.getClusterCount(), lightClusters.getMaxLightsPerCluster());
+			ImGui::Text("Cluster build: %.3f ms", clusterTimer.getMilliseconds());
+			ImGui::Text("Lit pass: %.3f ms", litPassTimer.getMilliseconds());
+			ImGui::End();
+
+			ImGui::Begin("Rendering");
+
+			ImGui::Combo("Path", &renderMode, renderModeNames, IM_ARRAYSIZE(renderModeNames));
+			if (renderMode == 1)
+			{
+				ImGui::Combo("Local Lights", &deferredLighting, deferredLightingNames, IM_ARRAYSIZE(deferredLightingNames));
+				if (deferredLighting == 1)
+				{
+					ImGui::DragFloat("Volume Scale", &deferredRenderer.volumeScale, 0.01f, 1.0f, 1.5f);
+				}
+			}
+
+			// Each path keeps its last timings so they can be compared after switching
+			ImGui::Text("Forward lit pass: %.3f ms", litPassTimer.getMilliseconds());
+			ImGui::Text("Deferred geometry: %.3f ms, lighting: %.3f ms", geometryPassTimer.getMilliseconds(), deferredLightingTimer.getMilliseconds());
+			ImGui::Text("Visibility ids: %.3f ms, resolve: %.3f ms", visibilityPassTimer.getMilliseconds(), resolvePassTimer.getMilliseconds());
+			ImGui::Text("Virtual texture feedback: %.3f ms", feedbackPassTimer.getMilliseconds());
+
+			// Bandwidth ignores overdraw in the geometry pass and sky pixels in the fullscreen pass
+			const DeferredStats& deferredStats = deferredRenderer.getStats();
+			double gbufferMB = deferredRenderer.getGBufferBytes() / (1024.0 * 1024.0);
+			double volumeReadMB = volumeLighting ? (double)deferredStats.volumeSamples * deferredRenderer.getBytesPerPixel() / (1024.0 * 1024.0) : 0.0;
+			ImGui::Text("G-buffer: %.1f MB, %d bytes per pixel", gbufferMB, deferredRenderer.getBytesPerPixel());
+			ImGui::Text("Per frame: %.1f MB written, %.1f MB read", gbufferMB, gbufferMB + volumeReadMB);
+			double visibilityMB = visibilityBuffer.getTargetBytes() / (1024.0 * 1024.0);
+			ImGui::Text("Visibility buffer: %.1f MB, %d bytes per pixel", visibilityMB, visibilityBuffer.getBytesPerPixel());
+			ImGui::Text("Shared mesh data: %.1f KB", visibilityBuffer.getGeometryBytes() / 1024.0);
+			if (volumeLighting)
+			{
+				ImGui::Text("Stencil volumes: %d, culled: %d", deferredStats.stencilVolumes, deferredStats.culledVolumes);
+				ImGui::Text("Volume pixels: %u (%.2fx screen)", deferredStats.volumeSamples, (double)deferredStats.volumeSamples / (SCREEN_WIDTH * SCREEN_HEIGHT));
+			}
+			ImGui::End();
+
+			ImGui::Begin("Materials");
+
+			const TextureManager::Stats& textureStats = textures.getStats();
+			ImGui::Text("Albedo %s, normals %s", blockFormatName(textures.getFormat(TextureSet::Albedo)), blockFormatName(textures.getFormat(TextureSet::Normal)));
+			ImGui::Text("%d cached, %d encoded in %.1f ms", textureStats.cacheHits, textureStats.encodedLayers, textureStats.encodeMs);
+			ImGui::Text("Decode %.1f ms summed, load %.1f ms on threads", textureStats.decodeMs, textureStats.loadMs);
+			if (ImGui::Button("Benchmark Decode"))
+			{
+				decodeBenchmark = TextureManager::benchmarkDecode({ "Bricks.jpg", "Tiles.jpg", "BricksNormal.jpg" });
+			}
+			if (decodeBenchmark.images > 0)
+			{
+				ImGui::SameLine();
+				ImGui::Text("%d images: stbi_load %.1f ms serial, %.1f ms threaded (%.2fx)", decodeBenchmark.images, decodeBenchmark.serialMs,
+					decodeBenchmark.threadedMs, decodeBenchmark.serialMs / std::max(decodeBenchmark.threadedMs, 0.001));
+			}
+			const StagingRing& staging = textures.getStaging();
+			ImGui::Text("Staged %.2f MB through a %.0f MB ring, %d stalls", staging.getBytesStaged() / (1024.0 * 1024.0), staging.getSize() / (1024.0 * 1024.0), staging.getStallCount());
+			ImGui::Text("Streaming %d layers, base level %d / %d", textures.getStreamingLayerCount(), textures.getBaseLevel(TextureSet::Albedo), textures.getBaseLevel(TextureSet::Normal));
+			ImGui::Text("%d levels streamed, all resident after %.1f ms", textureStats.streamedLevels, textureStats.streamMs);
+			ImGui::Text("%.2f MB compressed, %.2f MB as RGB8", textureStats.compressedBytes / (1024.0 * 1024.0), textureStats.uncompressedBytes / (1024.0 * 1024.0));
+
+			const VirtualTexture::Stats& virtualStats = virtualTexture.getStats();
+			ImGui::Text("Virtual %dx%d, %d mips: %d / %d pages in %d slots", virtualTexture.getSize(), virtualTexture.getSize(),
+				virtualTexture.getMipCount(), virtualTexture.getResidentPageCount(), virtualTexture.getPageCount(), virtualTexture.getSlotCount());
+			ImGui::Text("%d pages in view, %d drawn coarser", virtualStats.visiblePages, virtualStats.missingPages);
+			ImGui::Text("%d requested, %d uploaded, %d evicted, %d missed readbacks", virtualStats.requestedPages,
+				virtualStats.uploadedPages, virtualStats.evictedPages, virtualStats.missedReadbacks);
+			ImGui::Text("%.2f MB on the GPU for a %.2f MB mip chain", virtualTexture.getBytes() / (1024.0 * 1024.0), virtualTexture.getSourceBytes() / (1024.0 * 1024.0));
+
+			for (int i = 0; i < materials.getCount(); i++)
+			{
+				if (ImGui::TreeNode(materials.getName(i)))
+				{
+					// Only actual edits upload the table again
+					Material material = materials.get(i);
+					bool changed = ImGui::ColorEdit3("Color", &material.color.r);
+					changed |= ImGui::SliderFloat("Ambient", &material.ambientK, 0.0f, 1.0f);
+					changed |= ImGui::SliderFloat("Diffuse", &material.diffuseK, 0.0f, 1.0f);
+					changed |= ImGui::SliderFloat("Specular", &material.specularK, 0.0f, 1.0f);
+					changed |= ImGui::SliderFloat("Shininess", &material.shininess, 1.0f, 512.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
+					changed |= ImGui::SliderInt("Albedo Layer", &material.albedoLayer, 0, textures.getLayerCount(TextureSet::Albedo) - 1);
+					ImGui::SameLine();
+					ImGui::Text("%s", textures.getLayerName(TextureSet::Albedo, material.albedoLayer));
+					changed |= ImGui::SliderInt("Normal Layer", &material.normalLayer, 0, textures.getLayerCount(TextureSet::Normal) - 1);
+					changed |= ImGui::Checkbox("Virtual Albedo", &material.virtualAlbedo);
+					if (changed)
+					{
+						materials.edit(i) = material;
+					}
+					ImGui::TreePop();
+				}
+			}
+			ImGui::End();
+
+			ImGui::Begin("Post Processing");
+
+			ImGui::Combo("Effects", &effectIndex, effectNames, IM_ARRAYSIZE(effectNames));
+			ImGui::End();
+
+			ImGui::Begin("Shadows");
+
+			ImGui::DragFloat("Min Bias", &minBias, 0.001f, 0.001f, 0.1f);
+			ImGui::DragFloat("Max Bias", &maxBias, 0.001f, 0.001f, 0.1f);
+			ImGui::Checkbox("Show Shadow Map", &showShadowMap);
+			ImGui::SliderInt("Preview Cascade", &previewCascade, 0, cascadeCount - 1);
+			ImGui::Checkbox("Show Cascades", &showCascades);
+			ImGui::SliderFloat("Split Lambda", &shadowMap.splitLambda, 0.0f, 1.0f);
+			ImGui::DragFloat("Shadow Distance", &shadowMap.shadowDistance, 1.0f, 5.0f, 1000.0f);
+			ImGui::Checkbox("Fit To Receivers", &shadowMap.fitToScene);
+			const AABB& sceneBounds = shadowMap.getSceneBounds();
+			ImGui::Text("Scene bounds: (%.1f, %.1f, %.1f) - (%.1f, %.1f, %.1f)",
+				sceneBounds.min.x, sceneBounds.min.y, sceneBounds.min.z, sceneBounds.max.x, sceneBounds.max.y, sceneBounds.max.z);
+			for (int i = 0; i < cascadeCount; i++)
+			{
+				const ShadowCascade& cascade = shadowMap.getCascade(i);
+				ImGui::Text("  Cascade %d: %.2f m, %.3f m/texel, %d / %d casters", i, cascadeSplits[i], cascade.texelSize, cascade.casterCount, SCENE_OBJECT_COUNT);
+			}
+			ImGui::Checkbox("Animate Sphere", &animateSphere);
+			ImGui::Checkbox("Cache Static Casters", &shadowMap.caching);
+			const ShadowCacheStats& cacheStats = shadowMap.getCacheStats();
+			ImGui::Text("Skipped shadow pass: %d / %d frames", cacheStats.skippedFrames, cacheStats.frames);
+			ImGui::Text("Static layer redraws: %d, composites: %d", cacheStats.staticRedraws, cacheStats.composites);
+			ImGui::Checkbox("Virtual Shadow Map", &virtualShadows);
+			if (virtualShadows)
+			{
+				const VirtualShadowStats& vsmStats = virtualShadowMap.getStats();
+				ImGui::DragFloat("Level Bias", &vsmLodBias, 0.05f, -2.0f, 4.0f);
+				ImGui::SliderInt("Pages Per Frame", &virtualShadowMap.pageRenderBudget, 1, 256);
+				if (ImGui::Button("Invalidate Pages"))
+				{
+					virtualShadowMap.invalidate();
+				}
+				ImGui::Text("Resident: %d / %d pages, requested: %d", vsmStats.residentPages, virtualShadowMap.getPoolPageCount(), vsmStats.requestedPages);
+				ImGui::Text("Rendered: %d, pending: %d, invalidated: %d", vsmStats.renderedPages, vsmStats.pendingPages, vsmStats.invalidatedPages);
+				ImGui::Text("Evicted: %d, dropped: %d, missed read backs: %d", vsmStats.evictedPages, vsmStats.droppedRequests, vsmStats.missedReadbacks);
+				ImGui::Text("Virtual shadow pass: %.3f ms", virtualShadowTimer.getMilliseconds());
+			}
+			ImGui::Combo("Technique", &shadowMode, shadowModeNames, IM_ARRAYSIZE(shadowModeNames));
+			if (shadowMode == 0)
+			{
+				ImGui::Combo("PCF Taps", &shadowTapIndex, shadowTapNames, IM_ARRAYSIZE(shadowTapNames));
+				ImGui::DragFloat("Filter Radius", &shadowFilterRadius, 0.05f, 0.5f, 8.0f);
+				ImGui::Checkbox("Skip Uniform Regions", &useShadowMinMax);
+				ImGui::Checkbox("Show Kernel Path", &showShadowPath);
+				if (showShadowPath)
+				{
+					ImGui::TextColored(ImVec4(0.3f, 1.0f, 0.3f, 1.0f), "lit");
+					ImGui::SameLine();
+					ImGui::TextColored(ImVec4(1.0f, 0.2f, 0.2f, 1.0f), "full kernel");
+					ImGui::SameLine();
+					ImGui::TextColored(ImVec4(0.3f, 0.3f, 1.0f, 1.0f), "shadowed");
+				}
+			}
+			else
+			{
+				ImGui::SliderInt("Blur Radius", &shadowMoments.blurRadius, 0, 16);
+				ImGui::SliderFloat2("Exponents", &shadowMoments.exponents.x, 1.0f, 5.5f);
+				ImGui::DragFloat("Min Variance", &evsmMinVariance, 0.00001f, 0.0f, 0.01f, "%.5f");
+				ImGui::SliderFloat("Light Bleed Reduction", &lightBleedReduction, 0.0f, 0.95f);
+			}
+			ImGui::Text("Shadow pass: %.3f ms", shadowPassTimer.getMilliseconds());
+			ImGui::Text("EVSM moments: %.3f ms", momentsTimer.getMilliseconds());
+			ImGui::Text("Min/max pyramid: %.3f ms", minMaxTimer.getMilliseconds());
+			ImGui::Text("Lit pass: %.3f ms", litPassTimer.getMilliseconds());
+			for (int i = 0; i < IM_ARRAYSIZE(shadowTapNames); i++)
+			{
+				ImGui::Text("  PCF %2s taps: %.3f ms", shadowTapNames[i], litPassTimes[i]);
+			}
+			ImGui::Text("  EVSM: %.3f ms", evsmLitPassTime);
+			ImGui::End();
+
+			ImGui::Begin("Residency");
+			if (ImGui::SliderFloat("Budget MB", &residencyBudgetMB, 0.25f, 256.0f, "%.2f", ImGuiSliderFlags_Logarithmic))
+			{
+				residency.setBudget((size_t)(residencyBudgetMB * 1024.0f * 1024.0f));
+			}
+			ImGui::Text("Resident %.2f MB, %d evictions, %d reloads", residency.getResidentBytes() / (1024.0 * 1024.0),
+				residency.getEvictionCount(), residency.getReloadCount());
+			for (int i = 0; i < residency.getEntryCount(); i++)
+			{
+				const ResidencyManager::Entry& entry = residency.getEntry(i);
+				if (entry.kind == ResidentKind::Texture)
+				{
+					ImGui::Text("%-14s %8.2f MB  %d frames ago  %d levels dropped", entry.name, entry.bytes / (1024.0 * 1024.0),
+						residency.getFrame() - entry.lastUsedFrame, textures.getDroppedLevels(entry.set));
+				}
+				else
+				{
+					ImGui::Text("%-14s %8.2f MB  %d frames ago%s", entry.name, entry.bytes / (1024.0 * 1024.0),
+						residency.getFrame() - entry.lastUsedFrame, entry.reduced ? "  evicted" : "");
+				}
+			}
+			ImGui::End();
+
+			allocTrackerDrawUI();
+			gpuMemoryDrawUI();
+
+			ImGui::Render();
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+			glfwPollEvents();
+
+			allocTrackerEndFrame();
+			glfwSwapBuffers(window);
+
+			// Frees memory of the least recently used resources once the frame's draws are recorded
+			residency.update();
+
+			// Release GL objects whose last frame has finished on the GPU
+			gpuProcessDeferredDeletions();
+
+			// Everything allocated from the frame arenas this frame is released here
+			resetFrameArenas();
 		}
 
-		//Draw UI
-		ImGui::Begin("Directional Light");
-
-		ImGui::DragFloat3("Direction", &_DirectionalLight.direction.x, 1, -360, 360);
-		ImGui::DragFloat("Intensity", &_DirectionalLight.light.intensity, 0.01, 0.01, 1);
-		ImGui::ColorEdit3("Color", &_DirectionalLight.light.color.r);
-		ImGui::End();
-
-		ImGui::Begin("Post Processing");
-
-		ImGui::Combo("Effects", &effectIndex, effectNames, IM_ARRAYSIZE(effectNames));
-		ImGui::End();
-
-		ImGui::Begin("Shadows");
-
-		ImGui::DragFloat("Min Bias", &minBias, 0.001f, 0.001f, 0.1f);
-		ImGui::DragFloat("Max Bias", &maxBias, 0.001f, 0.001f, 0.1f);
-		ImGui::Checkbox("Show Shadow Map", &showShadowMap);
-		ImGui::End();
-
-		ImGui::Render();
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-		glfwPollEvents();
-
-		glfwSwapBuffers(window);
+		// The meshes are globals, release them while the context is still alive
+		cubeMesh = ew::Mesh();
+		rectangleMesh = ew::Mesh();
+		sphereMesh = ew::Mesh();
+		planeMesh = ew::Mesh();
+		cylinderMesh = ew::Mesh();
+		quadMesh = ew::Mesh();
+		depthQuadMesh = ew::Mesh();
 	}
 
+	gpuFlushDeferredDeletions();
+	gpuReportLeaks();
+
 	glfwTerminate();
+
+	allocTrackerWriteReport();
 	return 0;
 }
 //Author: Eric Winebrenner
@@ -1,6 +1,61 @@
 #version 450                          
 layout (location = 0) out vec4 FragColor;
 
+// Only fragments that pass the depth test request virtual shadow pages
+layout (early_fragment_tests) in;
+
+#if defined(DEFERRED_LIGHTING) || defined(VISIBILITY_BUFFER)
+struct Vertex
+{
+    vec3 worldNormal;
+    vec3 worldPosition;
+    vec2 uv;
+};
+
+// Rebuilt from the G-buffer or the visibility buffer at the start of main
+Vertex vertexOutput;
+float viewDepth;
+
+uniform mat4 _View;
+#endif
+
+#ifdef DEFERRED_LIGHTING
+uniform sampler2D _GBufferAlbedo;
+uniform sampler2D _GBufferNormal;
+uniform sampler2D _GBufferMaterial;
+uniform sampler2D _GBufferDepth;
+uniform mat4 _InverseViewProjection;
+#elif defined(VISIBILITY_BUFFER)
+// Matches VISIBILITY_TRIANGLE_BITS in VisibilityBuffer.h
+#define VISIBILITY_TRIANGLE_BITS 24
+
+uniform usampler2D _VisibilityIds;
+uniform mat4 _ViewProjection;
+
+// Every mesh's ew::Vertex data, 11 floats each: position, normal, uv, tangent
+layout (std430, binding = 5) readonly buffer VisibilityVertices
+{
+    float _VisibilityVertices[];
+};
+
+layout (std430, binding = 6) readonly buffer VisibilityIndices
+{
+    uint _VisibilityIndices[];
+};
+
+struct VisibilityObject
+{
+    mat4 model;
+    mat4 normalMatrix;
+    // x first index, y first vertex, z material
+    ivec4 mesh;
+};
+
+layout (std430, binding = 7) readonly buffer VisibilityObjects
+{
+    VisibilityObject _VisibilityObjects[];
+};
+#else
 in struct Vertex
 {
     vec3 worldNormal;
@@ -9,7 +64,13 @@ in struct Vertex
 }vertexOutput;
 
 in mat3 TBN;
-in vec4 lightSpacePos;
+in float viewDepth;
+#endif
+
+#ifdef LIGHT_VOLUME
+// The one local light this volume shades
+flat in int lightIndex;
+#endif
 
 struct Material
 {
@@ -52,17 +113,188 @@ struct SpotLight
 };
 
 uniform DirectionalLight _DirectionalLight;
-uniform Material _Material;
+uniform PointLight _PointLight;
+uniform bool _PointLightEnabled;
+// Packed by MaterialTable
+struct MaterialData
+{
+    vec4 colorAmbient;
+    // diffuseK, specularK, shininess, normal intensity
+    vec4 params;
+    // x albedo layer, y normal layer, z virtual albedo
+    ivec4 layers;
+};
+
+layout (std430, binding = 8) readonly buffer Materials
+{
+    MaterialData _Materials[];
+};
+
+// Set per draw, the visibility buffer reads it from the object table instead
+uniform int _MaterialIndex;
+
+Material loadMaterial(int index)
+{
+    MaterialData data = _Materials[index];
+    return Material(data.colorAmbient.rgb, data.colorAmbient.a, data.params.x, data.params.y, data.params.z, data.params.w);
+}
+
+// From the material table when the surface is rasterized or resolved, the G-buffer when lighting is deferred
+Material surfaceMaterial;
 uniform vec3 _CameraPosition;
 
-uniform sampler2D _Texture1;
-uniform sampler2D _Texture2;
-uniform sampler2D _ShadowMap;
-uniform sampler2D _Normal;
+// Material textures, layers come from the material table
+uniform sampler2DArray _AlbedoArray;
+uniform sampler2DArrayShadow _ShadowMap;
+
+const int MAX_CASCADES = 4;
+uniform int _CascadeCount;
+uniform mat4 _CascadeViewProj[MAX_CASCADES];
+uniform float _CascadeSplits[MAX_CASCADES];
+uniform float _CascadeBiasScale[MAX_CASCADES];
+uniform bool _ShowCascades;
+uniform sampler2DArray _NormalArray;
+
+// BC5 only stores tangent space xy, z is rebuilt from the unit length
+vec3 unpackNormal(vec2 encoded)
+{
+    vec2 xy = encoded * 2.0 - 1.0;
+    return vec3(xy, sqrt(max(0.0, 1.0 - dot(xy, xy))));
+}
+
+// Virtual albedo, materials with layers.z set read it instead of the albedo array
+uniform usampler2D _VTPageTable;
+uniform sampler2D _VTPhysical;
+uniform int _VTPagesAcross;
+uniform int _VTPageSize;
+uniform int _VTPageBorder;
+uniform int _VTMaxMip;
+uniform float _VTPhysicalSize;
+
+// Nearest mip for the uv derivatives, the same one vtFeedback.frag requests
+int virtualTextureMip(vec2 uvDx, vec2 uvDy, float bias)
+{
+    float texels = float(_VTPagesAcross * _VTPageSize);
+    float footprint = max(length(uvDx * texels), length(uvDy * texels));
+    return clamp(int(floor(log2(max(footprint, 1e-6)) + bias + 0.5)), 0, _VTMaxMip);
+}
+
+// Bilinear from the finest resident page covering uv, the page borders keep it inside the slot
+vec4 sampleVirtualTexture(vec2 uv, vec2 uvDx, vec2 uvDy)
+{
+    uv = fract(uv);
+    int mip = virtualTextureMip(uvDx, uvDy, 0.0);
+    uvec4 entry = texelFetch(_VTPageTable, ivec2(uv * float(_VTPagesAcross >> mip)), mip);
+    // Not even the coarsest page is resident yet
+    if (entry.w == 0u)
+    {
+        return vec4(0.5, 0.5, 0.5, 1.0);
+    }
+
+    vec2 local = fract(uv * float(_VTPagesAcross >> int(entry.z)));
+    vec2 texel = vec2(entry.xy) * float(_VTPageSize + 2 * _VTPageBorder) + float(_VTPageBorder) + local * float(_VTPageSize);
+    return vec4(textureLod(_VTPhysical, texel / _VTPhysicalSize, 0.0).rgb, 1.0);
+}
 
 uniform float time;
 uniform float _MinBias;
 uniform float _MaxBias;
+uniform int _ShadowTaps = 9;
+uniform float _ShadowFilterRadius = 1.5;
+
+// Linear light distance / _PointShadowFar per cube face
+uniform samplerCubeShadow _PointShadowMap;
+uniform bool _PointShadowsEnabled;
+uniform float _PointShadowFar;
+uniform float _PointShadowBias = 0.05;
+
+// Spot and point lights with shadows in a shared atlas, see LocalLights.cpp for the layout
+struct LocalLight
+{
+    vec4 positionType;
+    vec4 directionRange;
+    vec4 colorIntensity;
+    vec4 spotAngles;
+    ivec4 shadow;
+};
+
+struct LocalShadowView
+{
+    mat4 viewProjection;
+    vec4 atlasRect;
+};
+
+layout (std430, binding = 0) readonly buffer LocalLights
+{
+    LocalLight _LocalLights[];
+};
+
+layout (std430, binding = 1) readonly buffer LocalShadowViews
+{
+    LocalShadowView _LocalShadowViews[];
+};
+
+uniform int _LocalLightCount;
+uniform sampler2DShadow _ShadowAtlas;
+
+// Per cluster light lists built by lightClusters.comp
+layout (std430, binding = 3) readonly buffer ClusterLightCounts
+{
+    uint _ClusterLightCounts[];
+};
+
+layout (std430, binding = 4) readonly buffer ClusterLightIndices
+{
+    uint _ClusterLightIndices[];
+};
+
+uniform bool _ClusteredLighting;
+uniform ivec3 _ClusterGrid;
+uniform int _MaxLightsPerCluster;
+// Screen pixels per cluster tile
+uniform vec2 _ClusterTileSize;
+uniform float _ClusterNear;
+uniform float _ClusterSliceScale;
+uniform bool _ShowClusterHeat;
+
+// Min/max depth pyramid used to skip the PCF kernel away from shadow edges
+uniform bool _UseShadowMinMax;
+uniform sampler2DArray _ShadowMinMax;
+uniform bool _ShowShadowPath;
+
+// 0 = PCF, 1 = EVSM
+uniform int _ShadowMode;
+uniform sampler2DArray _ShadowMoments;
+uniform vec2 _EvsmExponents;
+uniform float _EvsmMinVariance = 0.0001;
+uniform float _LightBleedReduction = 0.2;
+
+// Paged shadow map for the directional light, see VirtualShadowMap.h
+const int MAX_VSM_LEVELS = 12;
+
+layout (std430, binding = 2) buffer VirtualPageRequests
+{
+    uint _VsmPageRequests[];
+};
+
+uniform bool _VirtualShadows;
+uniform sampler2DShadow _VsmPool;
+// Physical page + 1 for each cell of each level's window, 0 when unmapped
+uniform usampler2DArray _VsmPageTable;
+uniform mat4 _VsmLightView;
+// Light space z range of every page, (min, max)
+uniform vec2 _VsmDepthRange;
+uniform int _VsmLevelCount;
+uniform int _VsmPagesPerLevel;
+uniform int _VsmPageResolution;
+uniform int _VsmPoolPagesPerRow;
+// World space width of one page on level 0
+uniform float _VsmFirstPageSize;
+uniform ivec2 _VsmLevelOrigin[MAX_VSM_LEVELS];
+uniform float _VsmLodBias;
+
+// Level the virtual shadow was sampled from, for the debug view
+int vsmLevel = 0;
 
 float calcAmbient(float ambientCoefficient)
 {
@@ -119,7 +351,7 @@ float calcGLAttenuation(PointLight light, vec3 vertPos)
     float attenuation;
     float dist = distance(light.position, vertPos);
 
-    attenuation = 1 / (light.constK + light.linearK + (light.quadraticK * dist));
+    attenuation = 1 / (light.constK + (light.linearK * dist) + (light.quadraticK * dist * dist));
 
     return attenuation;
 }
@@ -141,50 +373,544 @@ float calcAngularAttenuation(SpotLight light, vec3 vertPos)
     return attenuation;
 }
 
-float calcShadow(sampler2D shadowMap, vec4 lightSpacePos, vec3 normal, vec3 lightDir)
+// Poisson disk in texels, the first N points are used for an N tap kernel
+const vec2 poissonDisk[16] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725),
+    vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+    vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464),
+    vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+    vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420),
+    vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+    vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590),
+    vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790)
+);
+
+// Cascade covering the given view depth, or _CascadeCount past the last split
+int selectCascade(float depth)
 {
+    for (int i = 0; i < _CascadeCount; i++)
+    {
+        if (depth < _CascadeSplits[i])
+        {
+            return i;
+        }
+    }
+    return _CascadeCount;
+}
+
+// Which path calcShadow took: 0 = coarse lit, 1 = full kernel, 2 = coarse shadowed
+int shadowPath = 1;
+
+// Each tap is a hardware filtered 2x2 comparison, so 1 tap is already a 2x2 PCF
+float calcShadow(sampler2DArrayShadow shadowMap, int cascade, vec3 worldPosition, vec3 normal, vec3 lightDir)
+{
+    // No shadows past the shadow distance
+    if (cascade >= _CascadeCount)
+    {
+        return 0.0;
+    }
+
+    vec4 lightSpacePos = _CascadeViewProj[cascade] * vec4(worldPosition, 1.0);
     vec3 sampleCoord = lightSpacePos.xyz / lightSpacePos.w;
     sampleCoord = sampleCoord * 0.5 + 0.5;
 
-    float shadowMapDepth = texture(shadowMap, sampleCoord.xy).r;
-
     float minBias = _MinBias;//0.005f;
     float maxBias = _MaxBias;//0.015f;
 
-    float bias = max(maxBias * (1.0f - dot(normal, lightDir)), minBias);
-    float depth = sampleCoord.z - bias;
+    // Bias grows with the cascade's texel size
+    float bias = max(maxBias * (1.0f - dot(normalize(normal), normalize(lightDir))), minBias);
+    float depth = sampleCoord.z - bias * _CascadeBiasScale[cascade];
+
+    if (_ShadowTaps <= 1)
+    {
+        return 1.0 - texture(shadowMap, vec4(sampleCoord.xy, cascade, depth));
+    }
+
+    vec2 texelOffset = _ShadowFilterRadius / vec2(textureSize(shadowMap, 0).xy);
+
+    if (_UseShadowMinMax)
+    {
+        // Kernel radius plus the bilinear footprint, in shadow map texels
+        float reach = _ShadowFilterRadius + 1.0;
+        // Level k texels are 2^(k+1) shadow map texels wide and dilated by their own width
+        int level = clamp(int(ceil(log2(reach))) - 1, 0, textureQueryLevels(_ShadowMinMax) - 1);
+        ivec2 levelSize = textureSize(_ShadowMinMax, level).xy;
+        ivec2 texel = ivec2(floor(sampleCoord.xy * vec2(levelSize)));
+
+        // Kernels crossing the map border also sample the lit border, leave those to the full kernel
+        if (all(greaterThanEqual(texel, ivec2(0))) && all(lessThan(texel, levelSize)))
+        {
+            vec2 minMax = texelFetch(_ShadowMinMax, ivec3(texel, cascade), level).rg;
+            if (depth <= minMax.x)
+            {
+                shadowPath = 0;
+                return 0.0;
+            }
+            if (depth > minMax.y)
+            {
+                shadowPath = 2;
+                return 1.0;
+            }
+        }
+    }
+
+    float lit = 0.0f;
+    for (int i = 0; i < _ShadowTaps; i++)
+    {
+        vec2 uv = sampleCoord.xy + poissonDisk[i] * texelOffset;
+        lit += texture(shadowMap, vec4(uv, cascade, depth));
+    }
+
+    return 1.0 - lit / float(_ShadowTaps);
+}
+
+// Cell of a level's window holding the position, x = -1 outside of the window
+ivec2 vsmCell(vec2 lightPosition, int level)
+{
+    ivec2 cell = ivec2(floor(lightPosition / (_VsmFirstPageSize * exp2(float(level))))) - _VsmLevelOrigin[level];
+    if (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, ivec2(_VsmPagesPerLevel))))
+    {
+        return ivec2(-1);
+    }
+    return cell;
+}
+
+void requestVsmPage(ivec2 cell, int level)
+{
+    _VsmPageRequests[(level * _VsmPagesPerLevel + cell.y) * _VsmPagesPerLevel + cell.x] = 1u;
+}
+
+float calcVirtualShadow(vec3 worldPosition, vec3 normal, float footprint)
+{
+    vec3 lightPosition = (_VsmLightView * vec4(worldPosition, 1.0)).xyz;
 
-    float shadow = 0.0f;
+    // Finest level whose texels aren't smaller than the pixel, and whose window holds the position
+    float firstTexelSize = _VsmFirstPageSize / float(_VsmPageResolution);
+    int level = clamp(int(floor(log2(footprint / firstTexelSize) + _VsmLodBias)), 0, _VsmLevelCount - 1);
+    ivec2 cell = vsmCell(lightPosition.xy, level);
+    while (cell.x < 0 && level < _VsmLevelCount - 1)
+    {
+        level++;
+        cell = vsmCell(lightPosition.xy, level);
+    }
+    if (cell.x < 0)
+    {
+        return 0.0;
+    }
 
-    vec2 texelOffset = 1.0 / textureSize(shadowMap, 0);
+    // The coarsest page is requested too so there is a fallback while finer pages are rendered
+    requestVsmPage(cell, level);
+    ivec2 coarsestCell = vsmCell(lightPosition.xy, _VsmLevelCount - 1);
+    if (coarsestCell.x >= 0)
+    {
+        requestVsmPage(coarsestCell, _VsmLevelCount - 1);
+    }
 
-    for (int x = -1; x <= 1; x++)
+    for (int i = level; i < _VsmLevelCount; i++)
     {
-        for (int y = -1; y <= 1; y++)
+        float pageSize = _VsmFirstPageSize * exp2(float(i));
+        float texelSize = pageSize / float(_VsmPageResolution);
+
+        // Push the lookup out along the normal by about one texel of this level
+        vec3 offsetPosition = (_VsmLightView * vec4(worldPosition + normalize(normal) * texelSize * 1.5, 1.0)).xyz;
+        vec2 pageCoord = offsetPosition.xy / pageSize - vec2(_VsmLevelOrigin[i]);
+        ivec2 pageCell = ivec2(floor(pageCoord));
+        if (any(lessThan(pageCell, ivec2(0))) || any(greaterThanEqual(pageCell, ivec2(_VsmPagesPerLevel))))
         {
-            vec2 uv = sampleCoord.xy + vec2(x * texelOffset.x, y * texelOffset.y);
-            shadow += step(texture(shadowMap, uv).r, depth);
+            continue;
         }
+
+        uint entry = texelFetch(_VsmPageTable, ivec3(pageCell, i), 0).r;
+        if (entry == 0u)
+        {
+            continue;
+        }
+
+        int physical = int(entry - 1u);
+        vec2 poolPage = vec2(physical % _VsmPoolPagesPerRow, physical / _VsmPoolPagesPerRow);
+        float poolSize = float(_VsmPoolPagesPerRow * _VsmPageResolution);
+        float depth = (_VsmDepthRange.y - offsetPosition.z) / (_VsmDepthRange.y - _VsmDepthRange.x);
+        depth -= texelSize / (_VsmDepthRange.y - _VsmDepthRange.x);
+
+        // Neighbouring pages aren't neighbours in the pool, keep every tap inside this one
+        vec2 pageTexel = fract(pageCoord) * float(_VsmPageResolution);
+        float lit = 0.0;
+        int taps = max(_ShadowTaps, 1);
+        for (int t = 0; t < taps; t++)
+        {
+            vec2 tapTexel = pageTexel + (taps > 1 ? poissonDisk[t] * _ShadowFilterRadius : vec2(0.0));
+            tapTexel = clamp(tapTexel, vec2(0.5), vec2(float(_VsmPageResolution) - 0.5));
+            lit += texture(_VsmPool, vec3((poolPage * float(_VsmPageResolution) + tapTexel) / poolSize, depth));
+        }
+
+        vsmLevel = i;
+        return 1.0 - lit / float(taps);
+    }
+
+    return 0.0;
+}
+
+// One hardware compare against the cube, bias grows at grazing angles
+float calcPointShadow(vec3 worldPosition, vec3 normal)
+{
+    vec3 lightToFragment = worldPosition - _PointLight.position;
+    float dist = length(lightToFragment);
+    if (dist >= _PointShadowFar)
+    {
+        return 0.0;
+    }
+
+    float cosAngle = clamp(dot(normalize(normal), -lightToFragment / dist), 0.0, 1.0);
+    float bias = _PointShadowBias * (2.0 - cosAngle);
+    return 1.0 - texture(_PointShadowMap, vec4(lightToFragment, (dist - bias) / _PointShadowFar));
+}
+
+float calcLocalShadow(LocalLight light, vec3 worldPosition, vec3 normal)
+{
+    if (light.shadow.x < 0)
+    {
+        return 0.0;
+    }
+
+    // Point lights pick the cube face from the major axis
+    int viewIndex = light.shadow.x;
+    vec3 lightToFragment = worldPosition - light.positionType.xyz;
+    if (light.shadow.y == 6)
+    {
+        vec3 axis = abs(lightToFragment);
+        if (axis.x >= axis.y && axis.x >= axis.z)
+            viewIndex += lightToFragment.x > 0.0 ? 0 : 1;
+        else if (axis.y >= axis.z)
+            viewIndex += lightToFragment.y > 0.0 ? 2 : 3;
+        else
+            viewIndex += lightToFragment.z > 0.0 ? 4 : 5;
+    }
+    LocalShadowView view = _LocalShadowViews[viewIndex];
+
+    // Push the lookup out along the normal by about one texel at this distance
+    float tileTexels = view.atlasRect.z * float(textureSize(_ShadowAtlas, 0).x);
+    float texelWorldSize = 2.0 * length(lightToFragment) / tileTexels;
+    vec4 clipPosition = view.viewProjection * vec4(worldPosition + normalize(normal) * texelWorldSize, 1.0);
+    vec3 ndc = clipPosition.xyz / clipPosition.w;
+    if (any(greaterThan(abs(ndc.xy), vec2(1.0))))
+    {
+        return 0.0;
+    }
+
+    // Keep the bilinear footprint inside the tile
+    vec2 halfTexel = 0.5 / vec2(textureSize(_ShadowAtlas, 0));
+    vec2 uv = view.atlasRect.xy + (ndc.xy * 0.5 + 0.5) * view.atlasRect.zw;
+    uv = clamp(uv, view.atlasRect.xy + halfTexel, view.atlasRect.xy + view.atlasRect.zw - halfTexel);
+
+    return 1.0 - texture(_ShadowAtlas, vec3(uv, ndc.z * 0.5 + 0.5));
+}
+
+// Diffuse and specular of a local light, windowed inverse square falloff reaching zero at its range
+vec3 calcLocalLight(LocalLight light, Vertex vertex, vec3 shadowNormal)
+{
+    vec3 toLight = light.positionType.xyz - vertex.worldPosition;
+    float dist = length(toLight);
+    float range = light.directionRange.w;
+    if (dist >= range)
+    {
+        return vec3(0.0);
+    }
+
+    vec3 lightDirection = toLight / dist;
+    float window = clamp(1.0 - pow(dist / range, 4.0), 0.0, 1.0);
+    float attenuation = window * window / (dist * dist + 1.0);
+
+    if (light.positionType.w == 0.0)
+    {
+        float cosAngle = dot(-lightDirection, light.directionRange.xyz);
+        attenuation *= clamp((cosAngle - light.spotAngles.x) / (light.spotAngles.y - light.spotAngles.x), 0.0, 1.0);
+    }
+
+    if (attenuation <= 0.0)
+    {
+        return vec3(0.0);
+    }
+
+    float diffuse = calcDiffuse(surfaceMaterial.diffuseK, lightDirection, vertex.worldNormal);
+    float specular = calcSpecular(surfaceMaterial.specularK, lightDirection, vertex.worldPosition, vertex.worldNormal, surfaceMaterial.shininess, _CameraPosition);
+    float shadow = calcLocalShadow(light, vertex.worldPosition, shadowNormal);
+
+    return (diffuse + specular) * light.colorIntensity.rgb * light.colorIntensity.a * attenuation * (1.0 - shadow);
+}
+
+// Upper bound on the lit fraction from the mean and variance of the occluder depth
+float chebyshevUpperBound(vec2 moments, float depth, float minVariance)
+{
+    if (depth <= moments.x)
+    {
+        return 1.0;
+    }
+
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float delta = depth - moments.x;
+    float pMax = variance / (variance + delta * delta);
+
+    // Cut off the tail of the bound to hide light bleeding between overlapping casters
+    return clamp((pMax - _LightBleedReduction) / (1.0 - _LightBleedReduction), 0.0, 1.0);
+}
+
+// One trilinear fetch of the blurred moments replaces the PCF kernel
+float calcShadowEVSM(int cascade, vec3 worldPosition)
+{
+    if (cascade >= _CascadeCount)
+    {
+        return 0.0;
+    }
+
+    vec4 lightSpacePos = _CascadeViewProj[cascade] * vec4(worldPosition, 1.0);
+    vec3 sampleCoord = lightSpacePos.xyz / lightSpacePos.w;
+    sampleCoord = sampleCoord * 0.5 + 0.5;
+
+    if (any(lessThan(sampleCoord.xy, vec2(0.0))) || any(greaterThan(sampleCoord.xy, vec2(1.0))))
+    {
+        return 0.0;
     }
-    shadow /= 10f;
 
-    return shadow;
+    float depth = clamp(sampleCoord.z, 0.0, 1.0) * 2.0 - 1.0;
+    float positive = exp(_EvsmExponents.x * depth);
+    float negative = -exp(-_EvsmExponents.y * depth);
+
+    vec4 moments = texture(_ShadowMoments, vec3(sampleCoord.xy, cascade));
+
+    // Minimum variance scaled by the derivative of each warp
+    float positiveMinVariance = _EvsmMinVariance * _EvsmExponents.x * positive;
+    float negativeMinVariance = _EvsmMinVariance * _EvsmExponents.y * negative;
+    positiveMinVariance *= positiveMinVariance;
+    negativeMinVariance *= negativeMinVariance;
+
+    float lit = min(chebyshevUpperBound(moments.xy, positive, positiveMinVariance),
+        chebyshevUpperBound(moments.zw, negative, negativeMinVariance));
+
+    return 1.0 - lit;
+}
+
+#ifdef VISIBILITY_BUFFER
+vec3 visibilityVec3(uint vertex, uint offset)
+{
+    uint base = vertex * 11u + offset;
+    return vec3(_VisibilityVertices[base], _VisibilityVertices[base + 1u], _VisibilityVertices[base + 2u]);
+}
+
+vec2 visibilityVec2(uint vertex, uint offset)
+{
+    uint base = vertex * 11u + offset;
+    return vec2(_VisibilityVertices[base], _VisibilityVertices[base + 1u]);
+}
+
+// Perspective correct barycentrics of an NDC position, from the screen space ones divided by w
+vec3 visibilityBarycentrics(vec4 clip0, vec4 clip1, vec4 clip2, vec2 ndc)
+{
+    vec3 invW = 1.0 / vec3(clip0.w, clip1.w, clip2.w);
+    vec2 ndc0 = clip0.xy * invW.x;
+    vec2 edge1 = clip1.xy * invW.y - ndc0;
+    vec2 edge2 = clip2.xy * invW.z - ndc0;
+    vec2 offset = ndc - ndc0;
+
+    float area = edge1.x * edge2.y - edge2.x * edge1.y;
+    float b1 = (offset.x * edge2.y - edge2.x * offset.y) / area;
+    float b2 = (edge1.x * offset.y - offset.x * edge1.y) / area;
+
+    vec3 weights = vec3(1.0 - b1 - b2, b1, b2) * invW;
+    return weights / (weights.x + weights.y + weights.z);
+}
+#endif
+
+#ifdef DEFERRED_LIGHTING
+// Inverse of the octahedral mapping in gbuffer.frag
+vec3 octDecode(vec2 encoded)
+{
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-normal.z, 0.0);
+    normal.x += normal.x >= 0.0 ? -fold : fold;
+    normal.y += normal.y >= 0.0 ? -fold : fold;
+    return normalize(normal);
 }
+#endif
 
 void main(){ 
-    vec3 normal = texture(_Normal, vertexOutput.uv).rgb;
-    normal = (normal * 2.0f) - 1.0f;
+    vec3 albedo;
+    float alpha;
+#ifdef VISIBILITY_BUFFER
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    uint id = texelFetch(_VisibilityIds, pixel, 0).r;
+    // Nothing was drawn here
+    if (id == 0xFFFFFFFFu)
+    {
+        discard;
+    }
+
+    VisibilityObject object = _VisibilityObjects[id >> VISIBILITY_TRIANGLE_BITS];
+    uint firstIndex = uint(object.mesh.x) + (id & ((1u << VISIBILITY_TRIANGLE_BITS) - 1u)) * 3u;
+    uvec3 corners = uvec3(_VisibilityIndices[firstIndex], _VisibilityIndices[firstIndex + 1u], _VisibilityIndices[firstIndex + 2u]) + uint(object.mesh.y);
+
+    mat3 worldCorners = mat3(
+        (object.model * vec4(visibilityVec3(corners.x, 0u), 1.0)).xyz,
+        (object.model * vec4(visibilityVec3(corners.y, 0u), 1.0)).xyz,
+        (object.model * vec4(visibilityVec3(corners.z, 0u), 1.0)).xyz);
+    vec4 clip0 = _ViewProjection * vec4(worldCorners[0], 1.0);
+    vec4 clip1 = _ViewProjection * vec4(worldCorners[1], 1.0);
+    vec4 clip2 = _ViewProjection * vec4(worldCorners[2], 1.0);
+
+    // Barycentrics here and one pixel over stand in for the derivatives of the forward varyings
+    vec2 pixelSize = 2.0 / vec2(textureSize(_VisibilityIds, 0));
+    vec2 ndc = gl_FragCoord.xy * pixelSize - 1.0;
+    vec3 weights = visibilityBarycentrics(clip0, clip1, clip2, ndc);
+    vec3 weightsX = visibilityBarycentrics(clip0, clip1, clip2, ndc + vec2(pixelSize.x, 0.0));
+    vec3 weightsY = visibilityBarycentrics(clip0, clip1, clip2, ndc + vec2(0.0, pixelSize.y));
+
+    mat3 normalMatrix = mat3(object.normalMatrix);
+    mat3 normals = mat3(visibilityVec3(corners.x, 3u), visibilityVec3(corners.y, 3u), visibilityVec3(corners.z, 3u));
+    mat3 tangents = mat3(visibilityVec3(corners.x, 8u), visibilityVec3(corners.y, 8u), visibilityVec3(corners.z, 8u));
+    mat3x2 uvs = mat3x2(visibilityVec2(corners.x, 6u), visibilityVec2(corners.y, 6u), visibilityVec2(corners.z, 6u));
+
+    vertexOutput.worldPosition = worldCorners * weights;
+    vertexOutput.worldNormal = normalMatrix * (normals * weights);
+    vertexOutput.uv = uvs * weights;
+    vec2 uvDx = uvs * weightsX - vertexOutput.uv;
+    vec2 uvDy = uvs * weightsY - vertexOutput.uv;
+    viewDepth = -(_View * vec4(vertexOutput.worldPosition, 1.0)).z;
+
+    // Same basis as defaultLit.vert
+    vec3 t = normalize(normalMatrix * (tangents * weights));
+    vec3 n = normalize(vertexOutput.worldNormal);
+    mat3 TBN = mat3(t, normalize(cross(t, n)), n);
+
+    MaterialData materialData = _Materials[object.mesh.z];
+    vec3 normal = unpackNormal(textureGrad(_NormalArray, vec3(vertexOutput.uv, materialData.layers.y), uvDx, uvDy).rg);
     normal = normalize(normal * TBN);
 
+    surfaceMaterial = loadMaterial(object.mesh.z);
+    vec4 textureColor = materialData.layers.z != 0
+        ? sampleVirtualTexture(vertexOutput.uv, uvDx, uvDy)
+        : textureGrad(_AlbedoArray, vec3(vertexOutput.uv, materialData.layers.x), uvDx, uvDy);
+    albedo = textureColor.rgb * surfaceMaterial.color;
+    alpha = textureColor.a;
+#elif defined(DEFERRED_LIGHTING)
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(_GBufferDepth, pixel, 0).r;
+    // Nothing was drawn here
+    if (depth >= 1.0)
+    {
+        discard;
+    }
+
+    vec2 ndc = gl_FragCoord.xy / vec2(textureSize(_GBufferDepth, 0)) * 2.0 - 1.0;
+    vec4 position = _InverseViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    vertexOutput.worldPosition = position.xyz / position.w;
+    vertexOutput.uv = vec2(0.0);
+    viewDepth = -(_View * vec4(vertexOutput.worldPosition, 1.0)).z;
+
+    vec4 normals = texelFetch(_GBufferNormal, pixel, 0);
+    vec3 normal = octDecode(normals.xy);
+    vertexOutput.worldNormal = octDecode(normals.zw);
+
+    vec4 materialParams = texelFetch(_GBufferMaterial, pixel, 0);
+    surfaceMaterial.color = vec3(1.0);
+    surfaceMaterial.ambientK = materialParams.x;
+    surfaceMaterial.diffuseK = materialParams.y;
+    surfaceMaterial.specularK = materialParams.z;
+    surfaceMaterial.shininess = exp2(materialParams.w * 9.0);
+    surfaceMaterial.normalIntensity = 1.0;
+
+    albedo = texelFetch(_GBufferAlbedo, pixel, 0).rgb;
+    alpha = 1.0;
+#else
+    ivec4 layers = _Materials[_MaterialIndex].layers;
+    vec3 normal = unpackNormal(texture(_NormalArray, vec3(vertexOutput.uv, layers.y)).rg);
+    normal = normalize(normal * TBN);
+
+    surfaceMaterial = loadMaterial(_MaterialIndex);
+    vec4 textureColor = layers.z != 0
+        ? sampleVirtualTexture(vertexOutput.uv, dFdx(vertexOutput.uv), dFdy(vertexOutput.uv))
+        : texture(_AlbedoArray, vec3(vertexOutput.uv, layers.x));
+    albedo = textureColor.rgb * surfaceMaterial.color;
+    alpha = textureColor.a;
+#endif
+
     Vertex newVertex = vertexOutput;
     newVertex.worldNormal = normal;
 
-    vec3 lightCol;
-    float shadow = calcShadow(_ShadowMap, lightSpacePos, vertexOutput.worldNormal, _DirectionalLight.direction);
+#ifdef LIGHT_VOLUME
+    FragColor = vec4(albedo * calcLocalLight(_LocalLights[lightIndex], newVertex, vertexOutput.worldNormal), 1.0);
+#else
+
+    vec3 lightCol = vec3(0.0);
+    int cascade = selectCascade(viewDepth);
+    float shadow;
+    if (_VirtualShadows)
+    {
+        vec3 worldPosition = vertexOutput.worldPosition;
+        float footprint = max(length(dFdx(worldPosition)), length(dFdy(worldPosition)));
+        shadow = calcVirtualShadow(worldPosition, vertexOutput.worldNormal, footprint);
+    }
+    else if (_ShadowMode == 1)
+    {
+        shadow = calcShadowEVSM(cascade, vertexOutput.worldPosition);
+    }
+    else
+    {
+        shadow = calcShadow(_ShadowMap, cascade, vertexOutput.worldPosition, vertexOutput.worldNormal, _DirectionalLight.direction);
+    }
+
+    lightCol += calcPhong(newVertex, surfaceMaterial, _DirectionalLight.light, _DirectionalLight.direction, _CameraPosition) * (1.0 - shadow);
+
+    if (_PointLightEnabled)
+    {
+        vec3 pointDirection = normalize(_PointLight.position - vertexOutput.worldPosition);
+        float pointShadow = _PointShadowsEnabled ? calcPointShadow(vertexOutput.worldPosition, vertexOutput.worldNormal) : 0.0;
+        float attenuation = calcGLAttenuation(_PointLight, vertexOutput.worldPosition);
+        lightCol += calcPhong(newVertex, surfaceMaterial, _PointLight.light, pointDirection, _CameraPosition) * attenuation * (1.0 - pointShadow);
+    }
+
+    int clusterLightCount = 0;
+    if (_ClusteredLighting)
+    {
+        ivec2 tile = min(ivec2(gl_FragCoord.xy / _ClusterTileSize), _ClusterGrid.xy - 1);
+        int slice = clamp(int(log(max(viewDepth, _ClusterNear) / _ClusterNear) * _ClusterSliceScale), 0, _ClusterGrid.z - 1);
+        int cluster = (slice * _ClusterGrid.y + tile.y) * _ClusterGrid.x + tile.x;
+
+        clusterLightCount = int(_ClusterLightCounts[cluster]);
+        int listLength = min(clusterLightCount, _MaxLightsPerCluster);
+        for (int i = 0; i < listLength; i++)
+        {
+            uint index = _ClusterLightIndices[cluster * _MaxLightsPerCluster + i];
+            lightCol += calcLocalLight(_LocalLights[index], newVertex, vertexOutput.worldNormal);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < _LocalLightCount; i++)
+        {
+            lightCol += calcLocalLight(_LocalLights[i], newVertex, vertexOutput.worldNormal);
+        }
+    }
+
+    FragColor = vec4(albedo * lightCol, alpha);
 
-    lightCol += calcPhong(newVertex, _Material, _DirectionalLight.light, _DirectionalLight.direction, _CameraPosition) * (1.0 - shadow);
+    // Blue to red as the list fills up, white where it overflowed
+    if (_ShowClusterHeat)
+    {
+        float fill = float(clusterLightCount) / float(_MaxLightsPerCluster);
+        vec3 heat = fill > 1.0 ? vec3(1.0) : mix(vec3(0.0, 0.0, 1.0), vec3(1.0, 0.0, 0.0), fill);
+        FragColor.rgb = mix(FragColor.rgb, heat, 0.6);
+    }
 
-    vec2 modifiedUV = vertexOutput.uv;
+    if (_ShowShadowPath)
+    {
+        const vec3 pathColors[3] = vec3[](vec3(0.3, 1.0, 0.3), vec3(1.0, 0.2, 0.2), vec3(0.3, 0.3, 1.0));
+        FragColor.rgb = mix(FragColor.rgb, pathColors[shadowPath], 0.6);
+    }
 
-    FragColor = texture(_Texture1, vertexOutput.uv) * vec4(lightCol * _Material.color, 1.0f);
-}
\ No newline at end of file
+    if (_ShowCascades)
+    {
+        const vec3 cascadeColors[MAX_CASCADES + 1] = vec3[](
+            vec3(1.0, 0.3, 0.3), vec3(0.3, 1.0, 0.3), vec3(0.3, 0.3, 1.0), vec3(1.0, 1.0, 0.3), vec3(1.0));
+        FragColor.rgb *= cascadeColors[_VirtualShadows ? vsmLevel % (MAX_CASCADES + 1) : cascade];
+    }
+#endif
+}
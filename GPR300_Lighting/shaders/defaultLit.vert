@@ -8,8 +8,6 @@ uniform mat4 _Model;
 uniform mat4 _View;
 uniform mat4 _Projection;
 
-uniform mat4 _LightViewProj;
-
 out struct Vertex
 {
     vec3 worldNormal;
@@ -18,7 +16,7 @@ out struct Vertex
 }vertexOutput;
 
 out mat3 TBN;
-out vec4 lightSpacePos;
+out float viewDepth;
 
 void main(){    
 
@@ -31,6 +29,7 @@ void main(){
     vec3 b = normalize(cross(t, n));
     TBN = mat3(t, b, n);
 
-    lightSpacePos = _LightViewProj * _Model * vec4(vPos, 1);
-    gl_Position = _Projection * _View * _Model * vec4(vPos,1);
+    vec4 viewPosition = _View * _Model * vec4(vPos, 1);
+    viewDepth = -viewPosition.z;
+    gl_Position = _Projection * viewPosition;
 }
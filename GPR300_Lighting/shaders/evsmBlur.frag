@@ -0,0 +1,43 @@
+#version 450
+out vec4 FragColor;
+
+// First pass reads depth and blurs horizontally, second pass blurs the moments vertically
+uniform bool _FromDepth;
+uniform sampler2DArray _DepthMap;
+uniform int _Layer;
+uniform sampler2D _Moments;
+
+uniform int _Radius;
+uniform vec2 _Exponents;
+
+// Positive and negative exponential warp of depth and their squares
+vec4 calcMoments(float depth)
+{
+	depth = depth * 2.0 - 1.0;
+	float positive = exp(_Exponents.x * depth);
+	float negative = -exp(-_Exponents.y * depth);
+	return vec4(positive, positive * positive, negative, negative * negative);
+}
+
+void main()
+{
+	ivec2 coord = ivec2(gl_FragCoord.xy);
+	ivec2 size = _FromDepth ? textureSize(_DepthMap, 0).xy : textureSize(_Moments, 0);
+	ivec2 stepDir = _FromDepth ? ivec2(1, 0) : ivec2(0, 1);
+
+	float sigma = max(float(_Radius) * 0.5, 0.5);
+
+	vec4 sum = vec4(0.0);
+	float weightSum = 0.0;
+	for (int i = -_Radius; i <= _Radius; i++)
+	{
+		ivec2 tap = clamp(coord + stepDir * i, ivec2(0), size - 1);
+		float weight = exp(-float(i * i) / (2.0 * sigma * sigma));
+
+		vec4 moments = _FromDepth ? calcMoments(texelFetch(_DepthMap, ivec3(tap, _Layer), 0).r) : texelFetch(_Moments, tap, 0);
+		sum += moments * weight;
+		weightSum += weight;
+	}
+
+	FragColor = sum / weightSum;
+}
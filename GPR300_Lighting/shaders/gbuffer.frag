@@ -0,0 +1,119 @@
+#version 450
+// Surface attributes for deferred lighting, decoded again in defaultLit.frag
+layout (location = 0) out vec4 GBufferAlbedo;
+layout (location = 1) out vec4 GBufferNormal;
+layout (location = 2) out vec4 GBufferMaterial;
+
+in struct Vertex
+{
+    vec3 worldNormal;
+    vec3 worldPosition;
+    vec2 uv;
+}vertexOutput;
+
+in mat3 TBN;
+in float viewDepth;
+
+struct Material
+{
+    vec3 color;
+    float ambientK, diffuseK, specularK;
+    float shininess;
+    float normalIntensity;
+};
+
+// Packed by MaterialTable
+struct MaterialData
+{
+    vec4 colorAmbient;
+    // diffuseK, specularK, shininess, normal intensity
+    vec4 params;
+    // x albedo layer, y normal layer, z virtual albedo
+    ivec4 layers;
+};
+
+layout (std430, binding = 8) readonly buffer Materials
+{
+    MaterialData _Materials[];
+};
+
+// Set per draw
+uniform int _MaterialIndex;
+
+Material loadMaterial(int index)
+{
+    MaterialData data = _Materials[index];
+    return Material(data.colorAmbient.rgb, data.colorAmbient.a, data.params.x, data.params.y, data.params.z, data.params.w);
+}
+uniform sampler2DArray _AlbedoArray;
+uniform sampler2DArray _NormalArray;
+
+// BC5 only stores tangent space xy, z is rebuilt from the unit length
+vec3 unpackNormal(vec2 encoded)
+{
+    vec2 xy = encoded * 2.0 - 1.0;
+    return vec3(xy, sqrt(max(0.0, 1.0 - dot(xy, xy))));
+}
+
+// Virtual albedo, materials with layers.z set read it instead of the albedo array
+uniform usampler2D _VTPageTable;
+uniform sampler2D _VTPhysical;
+uniform int _VTPagesAcross;
+uniform int _VTPageSize;
+uniform int _VTPageBorder;
+uniform int _VTMaxMip;
+uniform float _VTPhysicalSize;
+
+// Nearest mip for the uv derivatives, the same one vtFeedback.frag requests
+int virtualTextureMip(vec2 uvDx, vec2 uvDy, float bias)
+{
+    float texels = float(_VTPagesAcross * _VTPageSize);
+    float footprint = max(length(uvDx * texels), length(uvDy * texels));
+    return clamp(int(floor(log2(max(footprint, 1e-6)) + bias + 0.5)), 0, _VTMaxMip);
+}
+
+// Bilinear from the finest resident page covering uv, the page borders keep it inside the slot
+vec4 sampleVirtualTexture(vec2 uv, vec2 uvDx, vec2 uvDy)
+{
+    uv = fract(uv);
+    int mip = virtualTextureMip(uvDx, uvDy, 0.0);
+    uvec4 entry = texelFetch(_VTPageTable, ivec2(uv * float(_VTPagesAcross >> mip)), mip);
+    // Not even the coarsest page is resident yet
+    if (entry.w == 0u)
+    {
+        return vec4(0.5, 0.5, 0.5, 1.0);
+    }
+
+    vec2 local = fract(uv * float(_VTPagesAcross >> int(entry.z)));
+    vec2 texel = vec2(entry.xy) * float(_VTPageSize + 2 * _VTPageBorder) + float(_VTPageBorder) + local * float(_VTPageSize);
+    return vec4(textureLod(_VTPhysical, texel / _VTPhysicalSize, 0.0).rgb, 1.0);
+}
+
+// Unit vector to two signed components on an octahedron unfolded into a square
+vec2 octEncode(vec3 normal)
+{
+    normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+    if (normal.z < 0.0)
+    {
+        vec2 folded = 1.0 - abs(normal.yx);
+        normal.xy = vec2(normal.x >= 0.0 ? folded.x : -folded.x, normal.y >= 0.0 ? folded.y : -folded.y);
+    }
+    return normal.xy;
+}
+
+void main()
+{
+    ivec4 layers = _Materials[_MaterialIndex].layers;
+    vec3 normal = unpackNormal(texture(_NormalArray, vec3(vertexOutput.uv, layers.y)).rg);
+    normal = normalize(normal * TBN);
+
+    Material material = loadMaterial(_MaterialIndex);
+    vec3 albedo = layers.z != 0
+        ? sampleVirtualTexture(vertexOutput.uv, dFdx(vertexOutput.uv), dFdy(vertexOutput.uv)).rgb
+        : texture(_AlbedoArray, vec3(vertexOutput.uv, layers.x)).rgb;
+    GBufferAlbedo = vec4(albedo * material.color, 1.0);
+    // Mapped normal for shading, geometric normal for shadow offsets
+    GBufferNormal = vec4(octEncode(normal), octEncode(normalize(vertexOutput.worldNormal)));
+    // Shininess up to 512 stored as log2 / 9
+    GBufferMaterial = vec4(material.ambientK, material.diffuseK, material.specularK, log2(max(material.shininess, 1.0)) / 9.0);
+}
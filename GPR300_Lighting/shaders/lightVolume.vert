@@ -0,0 +1,44 @@
+#version 450
+// Unit sphere scaled over the reach of one local light per instance
+layout (location = 0) in vec3 vPos;
+
+struct LocalLight
+{
+    vec4 positionType;
+    vec4 directionRange;
+    vec4 colorIntensity;
+    vec4 spotAngles;
+    ivec4 shadow;
+};
+
+layout (std430, binding = 0) readonly buffer LocalLights
+{
+    LocalLight _LocalLights[];
+};
+
+uniform mat4 _ViewProjection;
+uniform int _FirstLight;
+// Pushes the faceted sphere's faces outside of the true bounds
+uniform float _VolumeScale = 1.1;
+
+flat out int lightIndex;
+
+void main()
+{
+    lightIndex = _FirstLight + gl_InstanceID;
+    LocalLight light = _LocalLights[lightIndex];
+
+    vec3 center = light.positionType.xyz;
+    float range = light.directionRange.w;
+    float radius = range;
+    // Spot lights are bounded around the middle of their cone, as in localLightBounds
+    if (light.positionType.w == 0.0)
+    {
+        float cosOuter = max(light.spotAngles.x, 0.0175);
+        float baseRadius = range * sqrt(1.0 - cosOuter * cosOuter) / cosOuter;
+        center += light.directionRange.xyz * range * 0.5;
+        radius = sqrt(range * range * 0.25 + baseRadius * baseRadius);
+    }
+
+    gl_Position = _ViewProjection * vec4(center + vPos * radius * _VolumeScale, 1.0);
+}
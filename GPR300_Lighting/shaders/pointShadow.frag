@@ -0,0 +1,12 @@
+#version 450
+
+in vec3 worldPosition;
+
+uniform vec3 _LightPosition;
+uniform float _FarPlane;
+
+// Linear distance to the light, so the lit shader can compare without the face's projection
+void main()
+{
+	gl_FragDepth = length(worldPosition - _LightPosition) / _FarPlane;
+}
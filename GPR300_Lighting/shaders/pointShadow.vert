@@ -0,0 +1,22 @@
+#version 450
+#extension GL_ARB_shader_viewport_layer_array : require
+layout (location = 0) in vec3 vPos;
+layout (location = 1) in vec3 vNormal;
+layout (location = 2) in vec2 vUV;
+layout (location = 3) in vec3 vTangent;
+
+uniform mat4 _Model;
+uniform mat4 _FaceViewProj[6];
+// Cube face drawn by each instance, faces without this object are left out
+uniform int _FaceIndices[6];
+
+out vec3 worldPosition;
+
+void main()
+{
+	int face = _FaceIndices[gl_InstanceID];
+	gl_Layer = face;
+
+	worldPosition = vec3(_Model * vec4(vPos, 1.0));
+	gl_Position = _FaceViewProj[face] * vec4(worldPosition, 1.0);
+}
@@ -0,0 +1,18 @@
+#version 450
+out vec4 FragColor;
+
+in vec2 uv;
+
+// Bound with a non-comparing sampler so raw depth can be read
+uniform sampler2DArray _ShadowMap;
+uniform int _Layer;
+
+// Shows the local light atlas instead of a cascade
+uniform bool _ShowAtlas;
+uniform sampler2D _Atlas;
+
+void main()
+{
+	float depth = _ShowAtlas ? texture(_Atlas, uv).r : texture(_ShadowMap, vec3(uv, _Layer)).r;
+	FragColor = vec4(vec3(depth), 1);
+}
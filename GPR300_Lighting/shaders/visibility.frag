@@ -0,0 +1,13 @@
+#version 450
+// Matches VISIBILITY_TRIANGLE_BITS in VisibilityBuffer.h
+#define VISIBILITY_TRIANGLE_BITS 24
+
+layout (location = 0) out uint VisibilityId;
+
+uniform int _ObjectIndex;
+
+void main()
+{
+    // gl_PrimitiveID counts the triangles of the draw, which covers the whole mesh
+    VisibilityId = (uint(_ObjectIndex) << VISIBILITY_TRIANGLE_BITS) | uint(gl_PrimitiveID);
+}
@@ -0,0 +1,56 @@
+#version 450
+// Virtual texture page and mip each pixel wants, read back by VirtualTexture
+layout (location = 0) out uint FeedbackPage;
+
+in struct Vertex
+{
+    vec3 worldNormal;
+    vec3 worldPosition;
+    vec2 uv;
+}vertexOutput;
+
+// Packed by MaterialTable
+struct MaterialData
+{
+    vec4 colorAmbient;
+    // diffuseK, specularK, shininess, normal intensity
+    vec4 params;
+    // x albedo layer, y normal layer, z virtual albedo
+    ivec4 layers;
+};
+
+layout (std430, binding = 8) readonly buffer Materials
+{
+    MaterialData _Materials[];
+};
+
+// Set per draw
+uniform int _MaterialIndex;
+
+uniform int _VTPagesAcross;
+uniform int _VTPageSize;
+uniform int _VTMaxMip;
+// Makes up for the derivatives of the smaller target
+uniform float _VTFeedbackBias;
+
+// Same as in defaultLit.frag
+int virtualTextureMip(vec2 uvDx, vec2 uvDy, float bias)
+{
+    float texels = float(_VTPagesAcross * _VTPageSize);
+    float footprint = max(length(uvDx * texels), length(uvDy * texels));
+    return clamp(int(floor(log2(max(footprint, 1e-6)) + bias + 0.5)), 0, _VTMaxMip);
+}
+
+void main()
+{
+    // Other surfaces still write depth so they hide what is behind them
+    int mip = virtualTextureMip(dFdx(vertexOutput.uv), dFdy(vertexOutput.uv), _VTFeedbackBias);
+    if (_Materials[_MaterialIndex].layers.z == 0)
+    {
+        FeedbackPage = 0xFFFFFFFFu;
+        return;
+    }
+
+    uvec2 page = uvec2(fract(vertexOutput.uv) * float(_VTPagesAcross >> mip));
+    FeedbackPage = page.x | (page.y << 12) | (uint(mip) << 24);
+}